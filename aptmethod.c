@@ -27,6 +27,7 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
 #include "error.h"
 #include "mprintf.h"
 #include "strlist.h"
@@ -40,6 +41,8 @@
 #include "filecntl.h"
 #include "hooks.h"
 
+struct aptworker;
+
 struct tobedone {
 	/*@null@*/
 	struct tobedone *next;
@@ -54,19 +57,21 @@ struct tobedone {
 	/* callback and its data: */
 	queue_callback *callback;
 	/*@null@*/void *privdata1, *privdata2;
+	/* the worker this was sent to, NULL if not yet sent */
+	/*@null@*//*@dependent@*/struct aptworker *worker;
 	/* there is no fallback or that was already used */
 	bool lasttry, ignore;
 	/* how often this was redirected */
 	unsigned int redirect_count;
+	/* how often this was retried after a transient failure,
+	 * and when it may be requested again */
+	unsigned int retry_count;
+	time_t notbefore;
 };
 
-struct aptmethod {
-	/*@only@*/ /*@null@*/
-	struct aptmethod *next;
-	char *name;
-	char *baseuri;
-	/*@null@*/char *fallbackbaseuri;
-	/*@null@*/char *config;
+/* one running instance of a method: */
+struct aptworker {
+	/*@dependent@*/struct aptmethod *method;
 	int mstdin, mstdout;
 	pid_t child;
 
@@ -77,19 +82,48 @@ struct aptmethod {
 		ams_failed
 	} status;
 
-	/*@null@*/struct tobedone *tobedone;
-	/*@null@*//*@dependent@*/struct tobedone *lasttobedone;
-	/*@null@*//*@dependent@*/const struct tobedone *nexttosend;
 	/* what is currently read: */
 	/*@null@*/char *inputbuffer;
 	size_t input_size, alreadyread;
 	/* What is currently written: */
 	/*@null@*/char *command;
 	size_t alreadywritten, output_length;
+	/* number of files requested but not yet answered */
+	unsigned int inflight;
+};
+
+/* if there is more than one worker, each only gets that many files
+ * requested at a time, so that idle workers can take over the rest: */
+#define WORKER_MAXINFLIGHT 2
+/* the longest time (in seconds) to wait before retrying a file */
+#define RETRY_MAXDELAY 64
+
+struct aptmethod {
+	/*@only@*/ /*@null@*/
+	struct aptmethod *next;
+	char *name;
+	char *baseuri;
+	/*@null@*/char *fallbackbaseuri;
+	/*@null@*/char *config;
+
+	/* all workers share this queue */
+	/*@null@*/struct tobedone *tobedone;
+	/*@null@*//*@dependent@*/struct tobedone *lasttobedone;
+	/*@null@*//*@dependent@*/struct tobedone *nexttosend;
 	/* old (<= squeeze) 103 behavior detected */
 	bool old103;
 	/* new (>= wheezy) 103 behavior detected, no more workarounds necessary */
 	bool new103;
+	/* the method said it does not want to run multiple times */
+	bool singleinstance;
+
+	/* how many transient failures may still be retried in this run */
+	unsigned int retriesleft;
+	/* files waiting for their retry */
+	/*@null@*/struct tobedone *delayed;
+
+	unsigned int workercount;
+	struct aptworker *workers;
 };
 
 struct aptmethodrun {
@@ -114,87 +148,100 @@ static void free_todolist(/*@only@*/ struct tobedone *todo) {
 }
 
 static void aptmethod_free(/*@only@*/struct aptmethod *method) {
+	unsigned int i;
+
 	if (method == NULL)
 		return;
 	free(method->name);
 	free(method->baseuri);
 	free(method->config);
 	free(method->fallbackbaseuri);
-	free(method->inputbuffer);
-	free(method->command);
+	for (i = 0 ; i < method->workercount ; i++) {
+		free(method->workers[i].inputbuffer);
+		free(method->workers[i].command);
+	}
+	free(method->workers);
 
 	free_todolist(method->tobedone);
+	free_todolist(method->delayed);
 
 	free(method);
 }
 
-retvalue aptmethod_shutdown(struct aptmethodrun *run) {
-	retvalue result = RET_OK, r;
-	struct aptmethod *method, *lastmethod, **method_ptr;
-
-	/* first get rid of everything not running: */
-	method_ptr = &run->methods;
-	while (*method_ptr != NULL) {
+static struct aptworker *findworker(struct aptmethodrun *run, pid_t child) {
+	struct aptmethod *method;
+	unsigned int i;
 
-		if ((*method_ptr)->child > 0) {
-			if (verbose > 10)
-				fprintf(stderr,
-"Still waiting for %d\n", (int)(*method_ptr)->child);
-			method_ptr = &(*method_ptr)->next;
-			continue;
-		} else {
-			/*@only@*/ struct aptmethod *h;
-			h = (*method_ptr);
-			*method_ptr = h->next;
-			h->next = NULL;
-			aptmethod_free(h);
+	for (method = run->methods ; method != NULL ; method = method->next) {
+		for (i = 0 ; i < method->workercount ; i++) {
+			if (method->workers[i].child == child)
+				return &method->workers[i];
 		}
 	}
+	return NULL;
+}
+
+static bool workersrunning(const struct aptmethodrun *run) {
+	const struct aptmethod *method;
+	unsigned int i;
 
-	/* finally get rid of all the processes: */
 	for (method = run->methods ; method != NULL ; method = method->next) {
-		if (method->mstdin >= 0) {
-			(void)close(method->mstdin);
-			if (verbose > 30)
-				fprintf(stderr, "Closing stdin of %d\n",
-						(int)method->child);
+		for (i = 0 ; i < method->workercount ; i++) {
+			if (method->workers[i].child > 0)
+				return true;
 		}
-		method->mstdin = -1;
-		if (method->mstdout >= 0) {
-			(void)close(method->mstdout);
-			if (verbose > 30)
-				fprintf(stderr, "Closing stdout of %d\n",
-						(int)method->child);
+	}
+	return false;
+}
+
+retvalue aptmethod_shutdown(struct aptmethodrun *run) {
+	retvalue result = RET_OK, r;
+	struct aptmethod *method;
+	struct aptworker *worker;
+	unsigned int i;
+
+	/* first get rid of all the processes: */
+	for (method = run->methods ; method != NULL ; method = method->next) {
+		for (i = 0 ; i < method->workercount ; i++) {
+			worker = &method->workers[i];
+			if (worker->child <= 0)
+				continue;
+			if (verbose > 10)
+				fprintf(stderr,
+"Still waiting for %d\n", (int)worker->child);
+			if (worker->mstdin >= 0) {
+				(void)close(worker->mstdin);
+				if (verbose > 30)
+					fprintf(stderr, "Closing stdin of %d\n",
+							(int)worker->child);
+			}
+			worker->mstdin = -1;
+			if (worker->mstdout >= 0) {
+				(void)close(worker->mstdout);
+				if (verbose > 30)
+					fprintf(stderr, "Closing stdout of %d\n",
+							(int)worker->child);
+			}
+			worker->mstdout = -1;
 		}
-		method->mstdout = -1;
 	}
-	while (run->methods != NULL || uncompress_running()) {
+	while (workersrunning(run) || uncompress_running()) {
 		pid_t pid;int status;
 
 		pid = wait(&status);
-		lastmethod = NULL; method = run->methods;
-		while (method != NULL) {
-			if (method->child == pid) {
-				struct aptmethod *next = method->next;
-
-				if (lastmethod != NULL) {
-					lastmethod->next = next;
-				} else
-					run->methods = next;
-
-				aptmethod_free(method);
-				pid = -1;
-				break;
-			} else {
-				lastmethod = method;
-				method = method->next;
-			}
-		}
-		if (pid > 0) {
+		worker = findworker(run, pid);
+		if (worker != NULL) {
+			worker->child = -1;
+		} else if (pid > 0) {
 			r = uncompress_checkpid(pid, status);
 			RET_UPDATE(result, r);
 		}
 	}
+	while (run->methods != NULL) {
+		method = run->methods;
+		run->methods = method->next;
+		aptmethod_free(method);
+	}
 	free(run);
 	return result;
 }
@@ -211,17 +258,32 @@ retvalue aptmethod_initialize_run(struct aptmethodrun **run) {
 	return RET_OK;
 }
 
-retvalue aptmethod_newmethod(struct aptmethodrun *run, const char *uri, const char *fallbackuri, const struct strlist *config, struct aptmethod **m) {
+retvalue aptmethod_newmethod(struct aptmethodrun *run, const char *uri, const char *fallbackuri, const struct strlist *config, unsigned int workercount, unsigned int retries, struct aptmethod **m) {
 	struct aptmethod *method;
 	const char *p;
+	unsigned int i;
+
+	assert (workercount > 0);
 
 	method = zNEW(struct aptmethod);
 	if (FAILEDTOALLOC(method))
 		return RET_ERROR_OOM;
-	method->mstdin = -1;
-	method->mstdout = -1;
-	method->child = -1;
-	method->status = ams_notstarted;
+	method->workers = nzNEW(workercount, struct aptworker);
+	if (FAILEDTOALLOC(method->workers)) {
+		free(method);
+		return RET_ERROR_OOM;
+	}
+	method->workercount = workercount;
+	method->retriesleft = retries;
+	for (i = 0 ; i < workercount ; i++) {
+		struct aptworker *worker = &method->workers[i];
+
+		worker->method = method;
+		worker->mstdin = -1;
+		worker->mstdout = -1;
+		worker->child = -1;
+		worker->status = ams_notstarted;
+	}
 	p = uri;
 	while (*p != '\0' && (*p == '_' || *p == '-' ||
 		(*p>='a' && *p<='z') || (*p>='A' && *p<='Z') ||
@@ -230,30 +292,35 @@ retvalue aptmethod_newmethod(struct aptmethodrun *run, const char *uri, const ch
 	}
 	if (*p == '\0') {
 		fprintf(stderr, "No colon found in method-URI '%s'!\n", uri);
+		free(method->workers);
 		free(method);
 		return RET_ERROR;
 	}
 	if (*p != ':') {
 		fprintf(stderr,
 "Unexpected character '%c' in method-URI '%s'!\n", *p, uri);
+		free(method->workers);
 		free(method);
 		return RET_ERROR;
 	}
 	if (p == uri) {
 		fprintf(stderr,
 "Zero-length name in method-URI '%s'!\n", uri);
+		free(method->workers);
 		free(method);
 		return RET_ERROR;
 	}
 
 	method->name = strndup(uri, p-uri);
 	if (FAILEDTOALLOC(method->name)) {
+		free(method->workers);
 		free(method);
 		return RET_ERROR_OOM;
 	}
 	method->baseuri = strdup(uri);
 	if (FAILEDTOALLOC(method->baseuri)) {
 		free(method->name);
+		free(method->workers);
 		free(method);
 		return RET_ERROR_OOM;
 	}
@@ -264,6 +331,7 @@ retvalue aptmethod_newmethod(struct aptmethodrun *run, const char *uri, const ch
 		if (FAILEDTOALLOC(method->fallbackbaseuri)) {
 			free(method->baseuri);
 			free(method->name);
+			free(method->workers);
 			free(method);
 			return RET_ERROR_OOM;
 		}
@@ -279,6 +347,7 @@ retvalue aptmethod_newmethod(struct aptmethodrun *run, const char *uri, const ch
 		free(method->fallbackbaseuri);
 		free(method->baseuri);
 		free(method->name);
+		free(method->workers);
 		free(method);
 		return RET_ERROR_OOM;
 	}
@@ -290,24 +359,19 @@ retvalue aptmethod_newmethod(struct aptmethodrun *run, const char *uri, const ch
 
 /**************************Fire up a method*****************************/
 
-inline static retvalue aptmethod_startup(struct aptmethod *method) {
+static retvalue startworker(struct aptworker *worker) {
+	const struct aptmethod *method = worker->method;
 	pid_t f;
 	int mstdin[2];
 	int mstdout[2];
 	int r;
 
-	/* When there is nothing to get, there is no reason to startup
-	 * the method. */
-	if (method->tobedone == NULL) {
-		return RET_NOTHING;
-	}
-
 	/* when we are already running, we are already ready...*/
-	if (method->child > 0) {
+	if (worker->child > 0) {
 		return RET_OK;
 	}
 
-	method->status = ams_waitforcapabilities;
+	worker->status = ams_waitforcapabilities;
 
 	r = pipe(mstdin);
 	if (r < 0) {
@@ -375,7 +439,7 @@ inline static retvalue aptmethod_startup(struct aptmethod *method) {
 		exit(255);
 	}
 	/* the main program continues... */
-	method->child = f;
+	worker->child = f;
 	if (verbose > 10)
 		fprintf(stderr,
 "Method '%s' started as %d\n", method->baseuri, (int)f);
@@ -383,20 +447,51 @@ inline static retvalue aptmethod_startup(struct aptmethod *method) {
 	(void)close(mstdout[1]);
 	markcloseonexec(mstdin[1]);
 	markcloseonexec(mstdout[0]);
-	method->mstdin = mstdin[1];
-	method->mstdout = mstdout[0];
-	method->inputbuffer = NULL;
-	method->input_size = 0;
-	method->alreadyread = 0;
-	method->command = NULL;
-	method->output_length = 0;
-	method->alreadywritten = 0;
+	worker->mstdin = mstdin[1];
+	worker->mstdout = mstdout[0];
+	free(worker->inputbuffer);
+	worker->inputbuffer = NULL;
+	worker->input_size = 0;
+	worker->alreadyread = 0;
+	free(worker->command);
+	worker->command = NULL;
+	worker->output_length = 0;
+	worker->alreadywritten = 0;
 	return RET_OK;
 }
 
+inline static retvalue aptmethod_startup(struct aptmethod *method) {
+	const struct tobedone *todo;
+	unsigned int i, needed;
+	retvalue result, r;
+
+	/* When there is nothing to get, there is no reason to startup
+	 * the method. */
+	if (method->tobedone == NULL) {
+		return RET_NOTHING;
+	}
+
+	/* no need for more workers than files to get: */
+	needed = 0;
+	for (todo = method->tobedone ; todo != NULL ; todo = todo->next) {
+		if (++needed >= method->workercount)
+			break;
+	}
+
+	result = RET_NOTHING;
+	for (i = 0 ; i < needed ; i++) {
+		r = startworker(&method->workers[i]);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	return result;
+}
+
 /**************************how to add files*****************************/
 
 static inline void enqueue(struct aptmethod *method, /*@only@*/struct tobedone *todo) {
+	assert (todo->worker == NULL);
 	todo->next = NULL;
 	if (method->lasttobedone == NULL)
 		method->nexttosend = method->lasttobedone = method->tobedone = todo;
@@ -408,6 +503,50 @@ static inline void enqueue(struct aptmethod *method, /*@only@*/struct tobedone *
 	}
 }
 
+/* remove an item from the queue (lasttodo being the item before it) */
+static void dequeue(struct aptmethod *method, struct tobedone *todo, /*@null@*/struct tobedone *lasttodo) {
+	if (lasttodo == NULL)
+		method->tobedone = todo->next;
+	else
+		lasttodo->next = todo->next;
+	if (method->nexttosend == todo) {
+		/* just in case some method received
+		 * files before we request them ;-) */
+		method->nexttosend = todo->next;
+	}
+	if (method->lasttobedone == todo) {
+		method->lasttobedone = lasttodo;
+	}
+	todo->next = NULL;
+	if (todo->worker != NULL) {
+		assert (todo->worker->inflight > 0);
+		todo->worker->inflight--;
+		todo->worker = NULL;
+	}
+}
+
+/* a worker died or failed, give what it had requested to the others */
+static void releaseworker(struct aptworker *worker) {
+	struct aptmethod *method = worker->method;
+	struct tobedone *todo, *lasttodo, *h;
+
+	lasttodo = NULL; todo = method->tobedone;
+	while (todo != NULL && worker->inflight > 0) {
+		if (todo->worker != worker) {
+			lasttodo = todo;
+			todo = todo->next;
+			continue;
+		}
+		h = todo->next;
+		dequeue(method, todo, lasttodo);
+		if (todo->ignore)
+			todo_free(todo);
+		else
+			enqueue(method, todo);
+		todo = h;
+	}
+}
+
 static retvalue enqueuenew(struct aptmethod *method, /*@only@*/char *uri, /*@only@*/char *destfile, queue_callback *callback, void *privdata1, void *privdata2) {
 	struct tobedone *todo;
 
@@ -433,9 +572,12 @@ static retvalue enqueuenew(struct aptmethod *method, /*@only@*/char *uri, /*@onl
 	todo->callback = callback;
 	todo->privdata1 = privdata1;
 	todo->privdata2 = privdata2;
+	todo->worker = NULL;
 	todo->lasttry = method->fallbackbaseuri == NULL;
 	todo->ignore = false;
 	todo->redirect_count = 0;
+	todo->retry_count = 0;
+	todo->notbefore = 0;
 	enqueue(method, todo);
 	return RET_OK;
 }
@@ -446,6 +588,22 @@ retvalue aptmethod_enqueue(struct aptmethod *method, const char *origfile, /*@on
 			destfile, callback, privdata1, privdata2);
 }
 
+/* the file method does not copy anything but tells where the file
+ * already is, so it can be hardlinked instead of needing space: */
+char *aptmethod_localfile(const struct aptmethod *method, const char *origfile) {
+	const char *p;
+
+	if (strcmp(method->name, "file") != 0 ||
+			method->fallbackbaseuri != NULL)
+		return NULL;
+	p = method->baseuri + 5;
+	if (p[0] == '/' && p[1] == '/')
+		p += 2;
+	if (*p != '/')
+		return NULL;
+	return calc_dirconcat(p, origfile);
+}
+
 retvalue aptmethod_enqueueindex(struct aptmethod *method, const char *suite, const char *origfile, const char *suffix, const char *destfile, const char *downloadsuffix, queue_callback *callback, void *privdata1, void *privdata2) {
 	return enqueuenew(method,
 			mprintf("%s/%s/%s%s",
@@ -497,8 +655,51 @@ static retvalue requeue_or_fail(struct aptmethod *method, /*@only@*/struct tobed
 	}
 }
 
+/* try again later, waiting longer each time (the file is not deleted,
+ * so methods supporting this will continue where they stopped) */
+static retvalue delayretry(struct aptmethod *method, /*@only@*/struct tobedone *todo) {
+	unsigned int delay;
+
+	assert (method->retriesleft > 0);
+	method->retriesleft--;
+	if (todo->retry_count < 7)
+		delay = 1 << todo->retry_count;
+	else
+		delay = RETRY_MAXDELAY;
+	if (delay > RETRY_MAXDELAY)
+		delay = RETRY_MAXDELAY;
+	todo->retry_count++;
+	todo->notbefore = time(NULL) + delay;
+	if (verbose >= 0)
+		fprintf(stderr, "Retrying '%s' in %u seconds...\n",
+				todo->uri, delay);
+	todo->next = method->delayed;
+	method->delayed = todo;
+	return RET_OK;
+}
+
+/* put all files whose delay is over back into the queue,
+ * returns how long to wait for the next one (or -1 if none) */
+static long requeue_delayed(struct aptmethod *method, time_t now) {
+	struct tobedone *todo, **todo_p;
+	long wait = -1;
+
+	todo_p = &method->delayed;
+	while ((todo = *todo_p) != NULL) {
+		if (todo->notbefore <= now) {
+			*todo_p = todo->next;
+			enqueue(method, todo);
+			continue;
+		}
+		if (wait < 0 || todo->notbefore - now < wait)
+			wait = todo->notbefore - now;
+		todo_p = &todo->next;
+	}
+	return wait;
+}
+
 /* look which file could not be received and remove it: */
-static retvalue urierror(struct aptmethod *method, const char *uri, /*@only@*/char *message) {
+static retvalue urierror(struct aptmethod *method, const char *uri, /*@only@*/char *message, bool transient) {
 	struct tobedone *todo, *lasttodo;
 
 	lasttodo = NULL; todo = method->tobedone;
@@ -506,23 +707,15 @@ static retvalue urierror(struct aptmethod *method, const char *uri, /*@only@*/ch
 		if (strcmp(todo->uri, uri) == 0)  {
 
 			/* remove item: */
-			if (lasttodo == NULL)
-				method->tobedone = todo->next;
-			else
-				lasttodo->next = todo->next;
-			if (method->nexttosend == todo) {
-				/* just in case some method received
-				 * files before we request them ;-) */
-				method->nexttosend = todo->next;
-			}
-			if (method->lasttobedone == todo) {
-				method->lasttobedone = todo->next;
-			}
+			dequeue(method, todo, lasttodo);
 			fprintf(stderr,
 "aptmethod error receiving '%s':\n'%s'\n",
 					uri, (message != NULL)?message:"");
 			/* put message in failed items to show it later? */
 			free(message);
+			if (transient && !todo->ignore
+					&& method->retriesleft > 0)
+				return delayretry(method, todo);
 			return requeue_or_fail(method, todo);
 		}
 		lasttodo = todo;
@@ -554,18 +747,7 @@ static retvalue uriredirect(struct aptmethod *method, const char *uri, /*@only@*
 			}
 
 			/* remove item: */
-			if (lasttodo == NULL)
-				method->tobedone = todo->next;
-			else
-				lasttodo->next = todo->next;
-			if (method->nexttosend == todo) {
-				/* just in case some method received
-				 * files before we request them ;-) */
-				method->nexttosend = todo->next;
-			}
-			if (method->lasttobedone == todo) {
-				method->lasttobedone = todo->next;
-			}
+			dequeue(method, todo, lasttodo);
 			if (todo->redirected_filename == NULL
 			    && todo->redirect_count < 2) {
 				if (verbose > 0)
@@ -670,18 +852,7 @@ static retvalue uridone(struct aptmethod *method, const char *uri, const char *f
 			todo->ignore = true;
 		} else {
 			/* remove item: */
-			if (lasttodo == NULL)
-				method->tobedone = todo->next;
-			else
-				lasttodo->next = todo->next;
-			if (method->nexttosend == todo) {
-				/* just in case some method received
-				 * files before we request them ;-) */
-				method->nexttosend = todo->next;
-			}
-			if (method->lasttobedone == todo) {
-				method->lasttobedone = todo->next;
-			}
+			dequeue(method, todo, lasttodo);
 			todo_free(todo);
 		}
 		return r;
@@ -719,38 +890,38 @@ static retvalue logmessage(const struct aptmethod *method, const char *chunk, co
 	fprintf(stderr, "aptmethod '%s': '%s'\n", method->baseuri, type);
 	return RET_OK;
 }
-static inline retvalue gotcapabilities(struct aptmethod *method, const char *chunk) {
+static inline retvalue gotcapabilities(struct aptworker *worker, const char *chunk) {
 	retvalue r;
 
 	r = chunk_gettruth(chunk, "Single-Instance");
 	if (RET_WAS_ERROR(r))
 		return r;
-// TODO: what to do with this?
-//	if (r != RET_NOTHING) {
-//		fprintf(stderr, "WARNING: Single-instance not yet supported!\n");
-//	}
+	if (r != RET_NOTHING) {
+		/* only the first worker will get anything to do then */
+		worker->method->singleinstance = true;
+	}
 	r = chunk_gettruth(chunk, "Send-Config");
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (r != RET_NOTHING) {
-		assert(method->command == NULL);
-		method->alreadywritten = 0;
-		method->command = method->config;
-		method->config = NULL;
-		method->output_length = strlen(method->command);
+		assert(worker->command == NULL);
+		worker->alreadywritten = 0;
+		/* every worker needs it, so keep the original */
+		worker->command = strdup(worker->method->config);
+		if (FAILEDTOALLOC(worker->command))
+			return RET_ERROR_OOM;
+		worker->output_length = strlen(worker->command);
 		if (verbose > 11) {
 			fprintf(stderr, "Sending config: '%s'\n",
-					method->command);
+					worker->command);
 		}
-	} else {
-		free(method->config);
-		method->config = NULL;
 	}
-	method->status = ams_ok;
+	worker->status = ams_ok;
 	return RET_OK;
 }
 
-static inline retvalue goturidone(struct aptmethod *method, const char *chunk) {
+static inline retvalue goturidone(struct aptworker *worker, const char *chunk) {
+	struct aptmethod *method = worker->method;
 	static const char * const method_hash_names[cs_COUNT] =
 		{ "MD5-Hash", "SHA1-Hash", "SHA256-Hash",
 		  "Size" };
@@ -768,7 +939,7 @@ static inline retvalue goturidone(struct aptmethod *method, const char *chunk) {
 "Missing URI header in uridone received from '%s' method!\n",
 				method->name);
 		r = RET_ERROR;
-		method->status = ams_failed;
+		worker->status = ams_failed;
 	}
 	if (RET_WAS_ERROR(r))
 		return r;
@@ -783,10 +954,11 @@ static inline retvalue goturidone(struct aptmethod *method, const char *chunk) {
 "Missing Filename header in uridone received from '%s' method!\n",
 					method->name);
 			r = urierror(method, uri, strdup(
-"<no error but missing Filename from apt-method>"));
+"<no error but missing Filename from apt-method>"), false);
 		} else {
 			r = urierror(method, uri, mprintf(
-"<File not there, apt-method suggests '%s' instead>", altfilename));
+"<File not there, apt-method suggests '%s' instead>", altfilename),
+				false);
 			free(altfilename);
 		}
 		free(uri);
@@ -850,7 +1022,10 @@ static inline retvalue goturierror(struct aptmethod *method, const char *chunk)
 		return r;
 	}
 
-	r = urierror(method, uri, message);
+	/* only errors the method itself deems worth retrying
+	 * (like a timeout or connection reset) are retried */
+	r = urierror(method, uri, message,
+			RET_IS_OK(chunk_gettruth(chunk, "Transient-Failure")));
 	free(uri);
 	return r;
 }
@@ -882,7 +1057,8 @@ static inline retvalue gotredirect(struct aptmethod *method, const char *chunk)
 	return r;
 }
 
-static inline retvalue parsereceivedblock(struct aptmethod *method, const char *input) {
+static inline retvalue parsereceivedblock(struct aptworker *worker, const char *input) {
+	struct aptmethod *method = worker->method;
 	const char *p;
 	retvalue r;
 #define OVERLINE {while (*p != '\0' && *p != '\n') p++; if (*p == '\n') p++; }
@@ -905,7 +1081,7 @@ static inline retvalue parsereceivedblock(struct aptmethod *method, const char *
 						fprintf(stderr, "Got '%s'\n",
 								input);
 					}
-					return gotcapabilities(method, input);
+					return gotcapabilities(worker, input);
 				/* 101 Log */
 				case '1':
 					if (verbose > 10) {
@@ -942,7 +1118,7 @@ static inline retvalue parsereceivedblock(struct aptmethod *method, const char *
 				/* 201 URI Done */
 				case '1':
 					OVERLINE;
-					return goturidone(method, p);
+					return goturidone(worker, p);
 				default:
 					fprintf(stderr,
 "Error or unsupported message received: '%s'\n",
@@ -959,7 +1135,7 @@ static inline retvalue parsereceivedblock(struct aptmethod *method, const char *
 				case '1':
 					OVERLINE;
 					(void)logmessage(method, p, "general error");
-					method->status = ams_failed;
+					worker->status = ams_failed;
 					r = RET_ERROR;
 					break;
 				default:
@@ -979,63 +1155,62 @@ static inline retvalue parsereceivedblock(struct aptmethod *method, const char *
 	}
 }
 
-static retvalue receivedata(struct aptmethod *method) {
+static retvalue receivedata(struct aptworker *worker) {
 	retvalue result;
 	ssize_t r;
 	char *p;
 	int consecutivenewlines;
 
-	assert (method->status != ams_ok || method->tobedone != NULL);
-	if (method->status != ams_waitforcapabilities
-			&& method->status != ams_ok)
+	if (worker->status != ams_waitforcapabilities
+			&& worker->status != ams_ok)
 		return RET_NOTHING;
 
 	/* First look if we have enough room to read.. */
-	if (method->alreadyread + 1024 >= method->input_size) {
+	if (worker->alreadyread + 1024 >= worker->input_size) {
 		char *newptr;
 
-		if (method->input_size >= (size_t)128000) {
+		if (worker->input_size >= (size_t)128000) {
 			fprintf(stderr,
 "Ridiculously long answer from method!\n");
-			method->status = ams_failed;
+			worker->status = ams_failed;
 			return RET_ERROR;
 		}
 
-		newptr = realloc(method->inputbuffer, method->alreadyread+1024);
+		newptr = realloc(worker->inputbuffer, worker->alreadyread+1024);
 		if (FAILEDTOALLOC(newptr)) {
 			return RET_ERROR_OOM;
 		}
-		method->inputbuffer = newptr;
-		method->input_size = method->alreadyread + 1024;
+		worker->inputbuffer = newptr;
+		worker->input_size = worker->alreadyread + 1024;
 	}
-	assert (method->inputbuffer != NULL);
+	assert (worker->inputbuffer != NULL);
 	/* then read as much as the pipe is able to fill of our buffer */
 
-	r = read(method->mstdout, method->inputbuffer + method->alreadyread,
-			method->input_size - method->alreadyread - 1);
+	r = read(worker->mstdout, worker->inputbuffer + worker->alreadyread,
+			worker->input_size - worker->alreadyread - 1);
 
 	if (r < 0) {
 		int e = errno;
 		fprintf(stderr, "Error %d reading pipe from aptmethod: %s\n",
 				e, strerror(e));
-		method->status = ams_failed;
+		worker->status = ams_failed;
 		return RET_ERRNO(e);
 	}
-	method->alreadyread += r;
+	worker->alreadyread += r;
 
 	result = RET_NOTHING;
 	while(true) {
 		retvalue res;
 
-		r = method->alreadyread;
-		p = method->inputbuffer;
+		r = worker->alreadyread;
+		p = worker->inputbuffer;
 		consecutivenewlines = 0;
 
 		while (r > 0) {
 			if (*p == '\0') {
 				fprintf(stderr,
 "Unexpected Zeroes in method output!\n");
-				method->status = ams_failed;
+				worker->status = ams_failed;
 				return RET_ERROR;
 			} else if (*p == '\n') {
 				consecutivenewlines++;
@@ -1050,33 +1225,46 @@ static retvalue receivedata(struct aptmethod *method) {
 			return result;
 		}
 		*p ='\0'; p++; r--;
-		res = parsereceivedblock(method, method->inputbuffer);
+		res = parsereceivedblock(worker, worker->inputbuffer);
 		if (r > 0)
-			memmove(method->inputbuffer, p, r);
-		method->alreadyread = r;
+			memmove(worker->inputbuffer, p, r);
+		worker->alreadyread = r;
 		RET_UPDATE(result, res);
 	}
 }
 
-static retvalue senddata(struct aptmethod *method) {
+/* if there is something left to request and this worker may take it */
+static inline bool worker_cantake(const struct aptworker *worker) {
+	const struct aptmethod *method = worker->method;
+
+	if (method->nexttosend == NULL)
+		return false;
+	if (method->singleinstance)
+		return worker == &method->workers[0];
+	return method->workercount <= 1
+		|| worker->inflight < WORKER_MAXINFLIGHT;
+}
+
+static retvalue senddata(struct aptworker *worker) {
+	struct aptmethod *method = worker->method;
 	size_t l;
 	ssize_t r;
 
-	if (method->status != ams_ok)
+	if (worker->status != ams_ok)
 		return RET_NOTHING;
 
-	if (method->command == NULL) {
-		const struct tobedone *todo;
+	if (worker->command == NULL) {
+		struct tobedone *todo;
 
 		/* nothing queued to send, nothing to be queued...*/
-		todo = method->nexttosend;
-		if (todo == NULL)
+		if (!worker_cantake(worker))
 			return RET_OK;
+		todo = method->nexttosend;
 
 		if (interrupted())
 			return RET_ERROR_INTERRUPTED;
 
-		method->alreadywritten = 0;
+		worker->alreadywritten = 0;
 		// TODO: make sure this is already checked for earlier...
 		assert (strchr(todo->uri, '\n') == NULL &&
 		        strchr(todo->filename, '\n') == NULL);
@@ -1086,40 +1274,42 @@ static retvalue senddata(struct aptmethod *method) {
 		 * but this is done elsewhere already
 		unlink(todo->filename);
 		*/
-		method->command = mprintf(
+		worker->command = mprintf(
 			 "600 URI Acquire\nURI: %s\nFilename: %s\n\n",
 			 todo->uri,
 			 (todo->redirected_filename==NULL)
 			 	?todo->filename
 			 	:todo->redirected_filename);
-		if (FAILEDTOALLOC(method->command)) {
+		if (FAILEDTOALLOC(worker->command)) {
 			return RET_ERROR_OOM;
 		}
 		if (verbose > 20)
-			fprintf(stderr, "Will sent: '%s'\n", method->command);
-		method->output_length = strlen(method->command);
-		method->nexttosend = method->nexttosend->next;
+			fprintf(stderr, "Will sent: '%s'\n", worker->command);
+		worker->output_length = strlen(worker->command);
+		method->nexttosend = todo->next;
+		todo->worker = worker;
+		worker->inflight++;
 	}
 
 
-	l = method->output_length - method->alreadywritten;
+	l = worker->output_length - worker->alreadywritten;
 
-	r = write(method->mstdin, method->command + method->alreadywritten, l);
+	r = write(worker->mstdin, worker->command + worker->alreadywritten, l);
 	if (r < 0) {
 		int e = errno;
 
 		fprintf(stderr, "Error %d writing to pipe: %s\n",
 				e, strerror(e));
 		//TODO: disable the whole method??
-		method->status = ams_failed;
+		worker->status = ams_failed;
 		return RET_ERRNO(e);
 	} else if ((size_t)r < l) {
-		method->alreadywritten += r;
+		worker->alreadywritten += r;
 		return RET_OK;
 	}
 
-	free(method->command);
-	method->command = NULL;
+	free(worker->command);
+	worker->command = NULL;
 	return RET_OK;
 }
 
@@ -1128,14 +1318,10 @@ static retvalue checkchilds(struct aptmethodrun *run) {
 	retvalue result = RET_OK, r;
 
 	while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
-		struct aptmethod *method;
+		struct aptworker *worker;
 
-		for (method = run->methods ; method != NULL ;
-		                             method = method->next) {
-			if (method->child == child)
-				break;
-		}
-		if (method == NULL) {
+		worker = findworker(run, child);
+		if (worker == NULL) {
 			/* perhaps an uncompressor terminated */
 			r = uncompress_checkpid(child, status);
 			if (RET_IS_OK(r))
@@ -1152,17 +1338,19 @@ static retvalue checkchilds(struct aptmethodrun *run) {
 			}
 		}
 		/* Make sure we do not cope with this child any more */
-		if (method->mstdin != -1) {
-			(void)close(method->mstdin);
-			method->mstdin = -1;
+		if (worker->mstdin != -1) {
+			(void)close(worker->mstdin);
+			worker->mstdin = -1;
 		}
-		if (method->mstdout != -1) {
-			(void)close(method->mstdout);
-			method->mstdout = -1;
+		if (worker->mstdout != -1) {
+			(void)close(worker->mstdout);
+			worker->mstdout = -1;
 		}
-		method->child = -1;
-		if (method->status != ams_failed)
-			method->status = ams_notstarted;
+		worker->child = -1;
+		if (worker->status != ams_failed)
+			worker->status = ams_notstarted;
+		/* what it did not answer yet, other workers might get */
+		releaseworker(worker);
 
 		/* say something if it exited unnormal: */
 		if (WIFEXITED(status)) {
@@ -1172,15 +1360,17 @@ static retvalue checkchilds(struct aptmethodrun *run) {
 			if (exitcode != 0) {
 				fprintf(stderr,
 "Method %s://%s exited with non-zero exit code %d!\n",
-					method->name, method->baseuri,
+					worker->method->name,
+					worker->method->baseuri,
 					exitcode);
-				method->status = ams_notstarted;
+				worker->status = ams_notstarted;
 				result = RET_ERROR;
 			}
 		} else {
 			fprintf(stderr, "Method %s://%s exited unnormally!\n",
-					method->name, method->baseuri);
-			method->status = ams_notstarted;
+					worker->method->name,
+					worker->method->baseuri);
+			worker->status = ams_notstarted;
 			result = RET_ERROR;
 		}
 	}
@@ -1192,7 +1382,12 @@ static retvalue checkchilds(struct aptmethodrun *run) {
 static retvalue readwrite(struct aptmethodrun *run, /*@out@*/int *workleft) {
 	int maxfd, v;
 	fd_set readfds, writefds;
+	struct timeval timeout, *timeout_p;
+	long delay, nextretry = -1;
+	time_t now = time(NULL);
 	struct aptmethod *method;
+	struct aptworker *worker;
+	unsigned int i;
 	retvalue result, r;
 
 	/* First calculate what to look at: */
@@ -1201,34 +1396,55 @@ static retvalue readwrite(struct aptmethodrun *run, /*@out@*/int *workleft) {
 	maxfd = 0;
 	*workleft = 0;
 	for (method = run->methods ; method != NULL ; method = method->next) {
-		if (method->status == ams_ok &&
-		    (method->command != NULL || method->nexttosend != NULL)) {
-			FD_SET(method->mstdin, &writefds);
-			if (method->mstdin > maxfd)
-				maxfd = method->mstdin;
+	    if (method->delayed != NULL) {
+		delay = requeue_delayed(method, now);
+		if (delay >= 0) {
+			(*workleft)++;
+			if (nextretry < 0 || delay < nextretry)
+				nextretry = delay;
+		}
+	    }
+	    for (i = 0 ; i < method->workercount ; i++) {
+		worker = &method->workers[i];
+
+		if (worker->status == ams_ok &&
+		    (worker->command != NULL || worker_cantake(worker))) {
+			FD_SET(worker->mstdin, &writefds);
+			if (worker->mstdin > maxfd)
+				maxfd = worker->mstdin;
 			(*workleft)++;
 			if (verbose > 19)
 				fprintf(stderr, "want to write to '%s'\n",
 						method->baseuri);
 		}
-		if (method->status == ams_waitforcapabilities ||
-				(method->status == ams_ok &&
-				method->tobedone != NULL)) {
-			FD_SET(method->mstdout, &readfds);
-			if (method->mstdout > maxfd)
-				maxfd = method->mstdout;
+		if (worker->status == ams_waitforcapabilities ||
+				(worker->status == ams_ok &&
+				worker->inflight > 0)) {
+			FD_SET(worker->mstdout, &readfds);
+			if (worker->mstdout > maxfd)
+				maxfd = worker->mstdout;
 			(*workleft)++;
 			if (verbose > 19)
 				fprintf(stderr, "want to read from '%s'\n",
 						method->baseuri);
 		}
+	    }
 	}
 
-	if (*workleft == 0)
+	if (uncompress_running())
+		/* also wake up when an uncompressor exits */
+		uncompress_fdset(&readfds, &maxfd);
+	else if (*workleft == 0)
 		return RET_NOTHING;
-
-	// TODO: think about a timeout...
-	v = select(maxfd + 1, &readfds, &writefds, NULL, NULL);
+	if (nextretry >= 0) {
+		/* wake up when the next retry is due */
+		timeout.tv_sec = nextretry;
+		timeout.tv_usec = 0;
+		timeout_p = &timeout;
+	} else
+		timeout_p = NULL;
+
+	v = select(maxfd + 1, &readfds, &writefds, NULL, timeout_p);
 	if (v < 0) {
 		int e = errno;
 		//TODO: handle (e == EINTR) && interrupted() specially
@@ -1243,16 +1459,23 @@ static retvalue readwrite(struct aptmethodrun *run, /*@out@*/int *workleft) {
 
 	maxfd = 0;
 	for (method = run->methods ; method != NULL ; method = method->next) {
-		if (method->mstdout != -1 &&
-				FD_ISSET(method->mstdout, &readfds)) {
-			r = receivedata(method);
+	    for (i = 0 ; i < method->workercount ; i++) {
+		worker = &method->workers[i];
+
+		if (worker->mstdout != -1 &&
+				FD_ISSET(worker->mstdout, &readfds)) {
+			r = receivedata(worker);
 			RET_UPDATE(result, r);
 		}
-		if (method->mstdin != -1 &&
-				FD_ISSET(method->mstdin, &writefds)) {
-			r = senddata(method);
+		if (worker->mstdin != -1 &&
+				FD_ISSET(worker->mstdin, &writefds)) {
+			r = senddata(worker);
 			RET_UPDATE(result, r);
 		}
+		/* let the other workers try what this one could not do */
+		if (worker->status == ams_failed)
+			releaseworker(worker);
+	    }
 	}
 	return result;
 }
@@ -1284,4 +1507,3 @@ retvalue aptmethod_download(struct aptmethodrun *run) {
 
 	return result;
 }
-
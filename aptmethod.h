@@ -16,11 +16,16 @@ enum queue_action { qa_abort, qa_got, qa_error };
 typedef retvalue queue_callback(enum queue_action, void *, void *, const char * /*uri*/, const char * /*gotfilename*/, const char * /*wantedfilename*/, /*@null@*/const struct checksums *, const char * /*methodname*/);
 
 retvalue aptmethod_initialize_run(/*@out@*/struct aptmethodrun **);
-retvalue aptmethod_newmethod(struct aptmethodrun *, const char * /*uri*/, const char * /*fallbackuri*/, const struct strlist * /*config*/, /*@out@*/struct aptmethod **);
+/* workercount is the number of instances of the method to run in parallel,
+ * retries how many transient failures may be retried in this run */
+retvalue aptmethod_newmethod(struct aptmethodrun *, const char * /*uri*/, const char * /*fallbackuri*/, const struct strlist * /*config*/, unsigned int /*workercount*/, unsigned int /*retries*/, /*@out@*/struct aptmethod **);
 
 retvalue aptmethod_enqueue(struct aptmethod *, const char * /*origfile*/, /*@only@*/char */*destfile*/, queue_callback *, void *, void *);
 retvalue aptmethod_enqueueindex(struct aptmethod *, const char * /*suite*/, const char * /*origfile*/, const char *, const char * /*destfile*/, const char *, queue_callback *, void *, void *);
 
+/* the local file a file method would return, NULL for other methods */
+/*@null@*/char *aptmethod_localfile(const struct aptmethod *, const char * /*origfile*/);
+
 retvalue aptmethod_download(struct aptmethodrun *);
 retvalue aptmethod_shutdown(/*@only@*/struct aptmethodrun *);
 
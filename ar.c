@@ -256,6 +256,28 @@ ssize_t ar_archivemember_read(struct archive *a, void *d, const void **p) {
 	return bytesread;
 }
 
+#if ARCHIVE_VERSION_NUMBER < 3000000
+off_t ar_archivemember_skip(struct archive *a, void *d, off_t request) {
+#else
+int64_t ar_archivemember_skip(struct archive *a, void *d, int64_t request) {
+#endif
+	struct ar_archive *ar = d;
+	off_t skipped;
+	const char *msg;
+	int e;
+
+	if (ar->member == NULL)
+		return 0;
+	skipped = uncompress_skip(ar->member, request);
+	if (skipped < 0) {
+		(void)uncompress_fdclose(ar->member, &e, &msg);
+		ar->member = NULL;
+		archive_set_error(a, e, "%s", msg);
+		return -1;
+	}
+	return skipped;
+}
+
 int ar_archivemember_open(struct archive *a, void *d) {
 	struct ar_archive *ar = d;
 	retvalue r;
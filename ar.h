@@ -18,5 +18,8 @@ void ar_archivemember_setcompression(struct ar_archive *, enum compression);
 int ar_archivemember_close(struct archive *, void *);
 int ar_archivemember_open(struct archive *, void *);
 ssize_t ar_archivemember_read(struct archive *, void *, const void **);
+/* seeks over data in uncompressed members, for libarchive to not read
+ * the contents of files it is only asked to skip */
+archive_skip_callback ar_archivemember_skip;
 
 #endif
@@ -498,13 +498,21 @@ void binaries_debdone(struct deb_headers *pkg) {
 	free(pkg->control);
 	free(pkg->section);
 	free(pkg->priority);
+	free(pkg->filelist);
 }
 
-retvalue binaries_readdeb(struct deb_headers *deb, const char *filename, bool needssourceversion) {
+retvalue binaries_readdeb(struct deb_headers *deb, const char *filename, bool needssourceversion, bool needsfilelist) {
 	retvalue r;
 	char *architecture;
 
-	r = extractcontrol(&deb->control, filename);
+	/* might already be read by someone else */
+	if (deb->control != NULL)
+		r = RET_OK;
+	else if (needsfilelist)
+		r = extractcontrolandfilelist(&deb->control,
+				&deb->filelist, &deb->filelistsize, filename);
+	else
+		r = extractcontrol(&deb->control, filename);
 	if (RET_WAS_ERROR(r))
 		return r;
 	/* first look for fields that should be there */
@@ -37,14 +37,18 @@ struct deb_headers {
 	/* optional fields: */
 	/*@null@*/char *section;
 	/*@null@*/char *priority;
+	/* only read when requested, might be NULL anyway: */
+	/*@null@*/char *filelist;
+	size_t filelistsize;
 };
 
 /* read contents of filename into deb_headers.
  * - does not follow retvalue conventions, some fields may be set even when
  *   error returned
- * - no checks for sanity of values, left to the caller */
+ * - no checks for sanity of values, left to the caller
+ * - if control is already set, only that is parsed */
 
-retvalue binaries_readdeb(struct deb_headers *, const char *filename, bool /*needssourceversion*/);
+retvalue binaries_readdeb(struct deb_headers *, const char *filename, bool /*needssourceversion*/, bool /*needsfilelist*/);
 void binaries_debdone(struct deb_headers *);
 
 retvalue binaries_calcfilekeys(component_t, const struct deb_headers *, packagetype_t, /*@out@*/struct strlist *);
@@ -954,6 +954,21 @@ static retvalue changes_includefiles(struct changes *changes) {
 
 	r = RET_NOTHING;
 
+	/* let the kernel already read the later files while
+	 * the first ones are copied */
+	for (e = changes->files; e != NULL ; e = e->next) {
+		char *fullfilename;
+
+		if (e->wasalreadythere && checksums_iscomplete(e->checksums))
+			continue;
+		fullfilename = calc_dirconcat(changes->incomingdirectory,
+				e->basename);
+		if (FAILEDTOALLOC(fullfilename))
+			return RET_ERROR_OOM;
+		checksums_prefetch(fullfilename);
+		free(fullfilename);
+	}
+
 	for (e = changes->files; e != NULL ; e = e->next) {
 		assert (e->filekey != NULL);
 
@@ -39,6 +39,8 @@
 #include "tracking.h"
 #include "override.h"
 #include "hooks.h"
+#include "contents.h"
+#include "filelist.h"
 
 /* This file includes the code to include binaries, i.e.
    to create the chunk for the Packages.gz-file and
@@ -73,7 +75,7 @@ void deb_free(/*@only@*/struct debpackage *pkg) {
 }
 
 /* read the data from a .deb, make some checks and extract some data */
-static retvalue deb_read(/*@out@*/struct debpackage **pkg, const char *filename, bool needssourceversion) {
+static retvalue deb_read(/*@out@*/struct debpackage **pkg, const char *filename, bool needssourceversion, bool needsfilelist) {
 	retvalue r;
 	struct debpackage *deb;
 
@@ -81,7 +83,8 @@ static retvalue deb_read(/*@out@*/struct debpackage **pkg, const char *filename,
 	if (FAILEDTOALLOC(deb))
 		return RET_ERROR_OOM;
 
-	r = binaries_readdeb(&deb->deb, filename, needssourceversion);
+	r = binaries_readdeb(&deb->deb, filename, needssourceversion,
+			needsfilelist);
 	if (RET_IS_OK(r))
 		r = properpackagename(deb->deb.name);
 	if (RET_IS_OK(r))
@@ -240,7 +243,8 @@ retvalue deb_prepare(/*@out@*/struct debpackage **deb, component_t forcecomponen
 
 	/* First taking a closer look in the file: */
 
-	r = deb_read(&pkg, debfilename, true);
+	r = deb_read(&pkg, debfilename, true,
+			contents_needsfilelists(distribution, packagetype));
 	if (RET_WAS_ERROR(r)) {
 		return r;
 	}
@@ -320,11 +324,27 @@ retvalue deb_prepare(/*@out@*/struct debpackage **deb, component_t forcecomponen
 	return RET_OK;
 }
 
+/* the file list was read together with the control data,
+ * so generating Contents files later does not need to read it again */
+static retvalue deb_storefilelist(const struct debpackage *pkg) {
+	if (pkg->deb.filelist == NULL)
+		return RET_NOTHING;
+	return filelist_store(pkg->filekey, pkg->deb.filelist,
+			pkg->deb.filelistsize);
+}
+
 retvalue deb_addprepared(const struct debpackage *pkg, const struct atomlist *forcearchitectures, packagetype_t packagetype, struct distribution *distribution, struct trackingdata *trackingdata) {
-	return binaries_adddeb(&pkg->deb, forcearchitectures,
+	retvalue r;
+
+	r = binaries_adddeb(&pkg->deb, forcearchitectures,
 			packagetype, distribution, trackingdata,
 			pkg->component, &pkg->filekeys,
 			pkg->deb.control);
+	if (RET_IS_OK(r)) {
+		retvalue r2 = deb_storefilelist(pkg);
+		RET_ENDUPDATE(r, r2);
+	}
+	return r;
 }
 
 /* insert the given .deb into the mirror in <component> in the <distribution>
@@ -341,7 +361,8 @@ retvalue deb_add(component_t forcecomponent, const struct atomlist *forcearchite
 
 	causingfile = debfilename;
 
-	r = deb_read(&pkg, debfilename, tracks != NULL);
+	r = deb_read(&pkg, debfilename, tracks != NULL,
+			contents_needsfilelists(distribution, packagetype));
 	if (RET_WAS_ERROR(r)) {
 		return r;
 	}
@@ -383,6 +404,10 @@ retvalue deb_add(component_t forcecomponent, const struct atomlist *forcearchite
 			(tracks!=NULL)?&trackingdata:NULL,
 			pkg->component, &pkg->filekeys,
 			pkg->deb.control);
+	if (RET_IS_OK(r)) {
+		retvalue r2 = deb_storefilelist(pkg);
+		RET_ENDUPDATE(r, r2);
+	}
 	RET_UPDATE(distribution->status, r);
 	deb_free(pkg);
 
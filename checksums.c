@@ -1212,9 +1212,28 @@ retvalue checksums_complete(struct checksums **checksums_p, const char *fullfile
 	return checksums_test(fullfilename, *checksums_p, checksums_p);
 }
 
+static inline void readsequentially(UNUSED(int fd)) {
+#ifdef HAVE_POSIX_FADVISE
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+void checksums_prefetch(UNUSED(const char *fullfilename)) {
+#ifdef HAVE_POSIX_FADVISE
+	int fd;
+
+	fd = open(fullfilename, O_RDONLY|O_NOCTTY);
+	if (fd < 0)
+		/* errors are reported when the file is actually read */
+		return;
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	(void)close(fd);
+#endif
+}
+
 retvalue checksums_read(const char *fullfilename, /*@out@*/struct checksums **checksums_p) {
 	struct checksumscontext context;
-	static const size_t bufsize = 16384;
+	static const size_t bufsize = 65536;
 	unsigned char *buffer = malloc(bufsize);
 	ssize_t sizeread;
 	int e, i;
@@ -1238,6 +1257,7 @@ retvalue checksums_read(const char *fullfilename, /*@out@*/struct checksums **ch
 		free(buffer);
 		return RET_ERRNO(e);
 	}
+	readsequentially(infd);
 	do {
 		sizeread = read(infd, buffer, bufsize);
 		if (sizeread < 0) {
@@ -1263,7 +1283,7 @@ retvalue checksums_read(const char *fullfilename, /*@out@*/struct checksums **ch
 
 retvalue checksums_copyfile(const char *destination, const char *source, bool deletetarget, struct checksums **checksums_p) {
 	struct checksumscontext context;
-	static const size_t bufsize = 16384;
+	static const size_t bufsize = 65536;
 	unsigned char *buffer = malloc(bufsize);
 	ssize_t sizeread, towrite, written;
 	const unsigned char *start;
@@ -1315,6 +1335,7 @@ retvalue checksums_copyfile(const char *destination, const char *source, bool de
 			return RET_ERRNO(e);
 		}
 	}
+	readsequentially(infd);
 	checksumscontext_init(&context);
 	do {
 		sizeread = read(infd, buffer, bufsize);
@@ -71,6 +71,10 @@ retvalue checksums_linkorcopyfile(const char * /*destination*/, const char * /*o
 /* calculare checksums of a file: */
 retvalue checksums_read(const char * /*fullfilename*/, /*@out@*/struct checksums **);
 
+/* tell the kernel the file will be read soon, so it can already be
+ * read in while other files are still processed: */
+void checksums_prefetch(const char * /*fullfilename*/);
+
 /* replace the contents of a file with data and calculate the new checksums */
 retvalue checksums_replace(const char * /*filename*/, const char *, size_t, /*@out@*//*@null@*/struct checksums **);
 
@@ -33,6 +33,9 @@
 #include "files.h"
 #include "ignore.h"
 #include "configparser.h"
+#include "filecntl.h"
+#include "uncompression.h"
+#include "database.h"
 
 /* options are zerroed when called, when error is returned contentsopions_done
  * is called by the caller */
@@ -160,10 +163,110 @@ retvalue contentsoptions_parse(struct distribution *distribution, struct configi
 	return RET_OK;
 }
 
+/* The file lists of Architecture: all packages are the same in every
+ * architecture, so they are only built once and merged into the
+ * Contents files of each architecture while writing them */
+
+struct sharedcontents {
+	/*@null@*/struct sharedcontents *next;
+	packagetype_t type;
+	/* atom_unknown for the files combining all components */
+	component_t component;
+	/* package, section and filekey of each package */
+	struct strlist packages;
+	/*@null@*/struct filelist_list *list;
+};
+
+static void sharedcontents_free(/*@only@*/struct sharedcontents *shared) {
+	while (shared != NULL) {
+		struct sharedcontents *h = shared->next;
+
+		strlist_done(&shared->packages);
+		if (shared->list != NULL)
+			filelist_free(shared->list);
+		free(shared);
+		shared = h;
+	}
+}
+
+static bool samepackages(const struct strlist *a, const struct strlist *b) {
+	int i;
+
+	if (a->count != b->count)
+		return false;
+	for (i = 0 ; i < a->count ; i++) {
+		if (strcmp(a->values[i], b->values[i]) != 0)
+			return false;
+	}
+	return true;
+}
+
+/* get the file list of the given Architecture: all packages,
+ * reusing the one of the last architecture if it is the same */
+static retvalue sharedcontents_get(struct sharedcontents **cache_p, packagetype_t type, component_t component, struct strlist *packages, /*@out@*/const struct filelist_list **list_p) {
+	struct sharedcontents *shared;
+	retvalue r;
+	int i;
+
+	for (shared = *cache_p ; shared != NULL ; shared = shared->next) {
+		if (shared->type == type && shared->component == component)
+			break;
+	}
+	if (shared == NULL) {
+		shared = zNEW(struct sharedcontents);
+		if (FAILEDTOALLOC(shared))
+			return RET_ERROR_OOM;
+		shared->type = type;
+		shared->component = component;
+		strlist_init(&shared->packages);
+		shared->next = *cache_p;
+		*cache_p = shared;
+	} else if (shared->list != NULL &&
+			samepackages(&shared->packages, packages)) {
+		*list_p = shared->list;
+		return RET_OK;
+	}
+	strlist_done(&shared->packages);
+	strlist_move(&shared->packages, packages);
+	if (shared->list != NULL) {
+		filelist_free(shared->list);
+		shared->list = NULL;
+	}
+	r = filelist_init(&shared->list);
+	if (RET_WAS_ERROR(r))
+		return r;
+	for (i = 0 ; i + 2 < shared->packages.count ; i += 3) {
+		r = filelist_addpackage(shared->list,
+				shared->packages.values[i],
+				shared->packages.values[i + 1],
+				shared->packages.values[i + 2]);
+		if (RET_WAS_ERROR(r)) {
+			filelist_free(shared->list);
+			shared->list = NULL;
+			return r;
+		}
+	}
+	*list_p = shared->list;
+	return RET_OK;
+}
+
+struct contentscollector {
+	/* package, section and filekey of each package */
+	struct strlist packages;
+	/* the same for the Architecture: all packages */
+	struct strlist all;
+};
+
+static void collector_done(struct contentscollector *collector) {
+	strlist_done(&collector->packages);
+	strlist_done(&collector->all);
+}
+
 static retvalue addpackagetocontents(UNUSED(struct distribution *di), UNUSED(struct target *ta), const char *packagename, const struct packagedata *packagedata, void *data) {
-	struct filelist_list *contents = data;
+	struct contentscollector *collector = data;
+	struct strlist *into;
 	retvalue r;
-	char *section, *filekey;
+	char *section, *filekey, *architecture;
 
 	r = chunk_getvalue(packagedata->chunk, "Section", &section);
 	/* Ignoring packages without section, as they should not exist anyway */
@@ -175,19 +278,443 @@ static retvalue addpackagetocontents(UNUSED(struct distribution *di), UNUSED(str
 		free(section);
 		return r;
 	}
-	r = filelist_addpackage(contents, packagename, section, filekey);
+	r = chunk_getvalue(packagedata->chunk, "Architecture", &architecture);
+	if (RET_WAS_ERROR(r)) {
+		free(filekey);
+		free(section);
+		return r;
+	}
+	into = &collector->packages;
+	if (RET_IS_OK(r)) {
+		if (strcmp(architecture, "all") == 0)
+			into = &collector->all;
+		free(architecture);
+	}
+	r = strlist_add_dup(into, packagename);
+	if (RET_IS_OK(r))
+		r = strlist_add(into, section);
+	else
+		free(section);
+	if (RET_IS_OK(r))
+		r = strlist_add(into, filekey);
+	else
+		free(filekey);
+	return r;
+}
+
+/* To only apply the changes to the Contents file generated the last
+ * time, the digest of that file and the name, section and filekey of
+ * every package in it are stored in contents.states.db */
+
+struct contentsstate {
+	/* "name section filekey", sorted */
+	char **lines;
+	int count;
+	/* only set for states read from the database */
+	/*@null@*/char *record;
+	/*@null@*/const char *digest;
+};
+
+static void state_done(struct contentsstate *state) {
+	int i;
+
+	if (state->record == NULL) {
+		for (i = 0 ; i < state->count ; i++)
+			free(state->lines[i]);
+	}
+	free(state->lines);
+	free(state->record);
+}
+
+static int linecompare(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static retvalue state_calc(const struct contentscollector *collector, /*@out@*/struct contentsstate *state) {
+	const struct strlist *l;
+	int i, count;
+
+	memset(state, 0, sizeof(*state));
+	count = (collector->packages.count + collector->all.count) / 3;
+	if (count == 0)
+		return RET_OK;
+	state->lines = nzNEW(count, char *);
+	if (FAILEDTOALLOC(state->lines))
+		return RET_ERROR_OOM;
+	for (l = &collector->packages ; l != NULL ;
+			l = (l == &collector->packages) ? &collector->all : NULL) {
+		for (i = 0 ; i + 2 < l->count ; i += 3) {
+			char *line = mprintf("%s %s %s", l->values[i],
+					l->values[i + 1], l->values[i + 2]);
+
+			if (FAILEDTOALLOC(line)) {
+				state_done(state);
+				return RET_ERROR_OOM;
+			}
+			state->lines[state->count++] = line;
+		}
+	}
+	qsort(state->lines, state->count, sizeof(char *), linecompare);
+	return RET_OK;
+}
+
+static retvalue state_read(struct table *states, const char *filename, /*@out@*/struct contentsstate *state) {
+	char *record, *p;
+	int count;
+	retvalue r;
+
+	memset(state, 0, sizeof(*state));
+	r = table_getrecord(states, filename, &record);
+	if (!RET_IS_OK(r))
+		return r;
+	count = 0;
+	for (p = record ; *p != '\0' ; p++) {
+		if (*p == '\n')
+			count++;
+	}
+	state->record = record;
+	state->digest = record;
+	if (count > 0) {
+		state->lines = nzNEW(count, char *);
+		if (FAILEDTOALLOC(state->lines)) {
+			state_done(state);
+			return RET_ERROR_OOM;
+		}
+	}
+	for (p = strchr(record, '\n') ; p != NULL ; p = strchr(p, '\n')) {
+		*(p++) = '\0';
+		state->lines[state->count++] = p;
+		/* was written sorted, if not something is broken */
+		if (state->count > 1 && strcmp(state->lines[state->count - 2],
+					p) > 0) {
+			state_done(state);
+			return RET_NOTHING;
+		}
+	}
+	return RET_OK;
+}
+
+static retvalue state_store(struct table *states, const char *filename, const char *digest, const struct contentsstate *state) {
+	size_t len;
+	char *record, *p;
+	int i;
+	retvalue r;
+
+	len = strlen(digest);
+	for (i = 0 ; i < state->count ; i++)
+		len += 1 + strlen(state->lines[i]);
+	record = malloc(len + 1);
+	if (FAILEDTOALLOC(record))
+		return RET_ERROR_OOM;
+	p = stpcpy(record, digest);
+	for (i = 0 ; i < state->count ; i++) {
+		*(p++) = '\n';
+		p = stpcpy(p, state->lines[i]);
+	}
+	r = table_adduniqsizedstring(states, filename, record, len + 1,
+			true, false);
+	free(record);
+	return r;
+}
+
+/* the names of all packages added, removed or changed */
+static retvalue changednames(const struct contentsstate *old, const struct contentsstate *new, /*@out@*/struct strlist *names) {
+	int o = 0, n = 0, c;
+	const char *line;
+	char *name;
+	retvalue r;
+
+	strlist_init(names);
+	while (o < old->count || n < new->count) {
+		if (o >= old->count)
+			c = 1;
+		else if (n >= new->count)
+			c = -1;
+		else
+			c = strcmp(old->lines[o], new->lines[n]);
+		if (c == 0) {
+			o++; n++;
+			continue;
+		}
+		line = (c < 0) ? old->lines[o++] : new->lines[n++];
+		name = strndup(line, strcspn(line, " "));
+		if (FAILEDTOALLOC(name))
+			r = RET_ERROR_OOM;
+		else
+			r = strlist_add(names, name);
+		if (RET_WAS_ERROR(r)) {
+			strlist_done(names);
+			return r;
+		}
+	}
+	qsort(names->values, names->count, sizeof(char *), linecompare);
+	return RET_OK;
+}
+
+static bool isobsolete(const char *name, size_t len, void *data) {
+	const struct strlist *names = data;
+	int lo = 0, hi = names->count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int c = strncmp(names->values[mid], name, len);
+
+		if (c == 0 && names->values[mid][len] != '\0')
+			c = 1;
+		if (c == 0)
+			return true;
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+struct contentsrun {
+	struct release *release;
+	/*@null@*/struct table *states;
+	/* may apply the changes to the last files */
+	bool incremental;
+	/*@null@*/struct sharedcontents *shared;
+};
+
+static retvalue startcontentsfile(struct release *release, const char *filename, /*@null@*/const char *symlinkas, compressionset compressions, bool onlyneeded, struct filetorelease **file_p) {
+	if (symlinkas != NULL)
+		return release_startlinkedfile(release, filename, symlinkas,
+				compressions, onlyneeded, file_p);
+	else
+		return release_startfile(release, filename,
+				compressions, onlyneeded, file_p);
+}
+
+/* the old file to read, RET_NOTHING if there is none */
+static retvalue oldcontentsfile(struct release *release, const char *filename, compressionset compressions, /*@out@*/char **fullfilename_p, /*@out@*/enum compression *compression_p) {
+	enum compression c;
+	char *fullfilename;
+
+	if ((compressions & IC_FLAG(ic_uncompressed)) != 0)
+		c = c_none;
+	else if ((compressions & IC_FLAG(ic_gzip)) != 0)
+		c = c_gzip;
+#ifdef HAVE_LIBBZ2
+	else if ((compressions & IC_FLAG(ic_bzip2)) != 0)
+		c = c_bzip2;
+#endif
+#ifdef HAVE_LIBLZMA
+	else if ((compressions & IC_FLAG(ic_xz)) != 0)
+		c = c_xz;
+#endif
+	else
+		return RET_NOTHING;
+	if (!uncompression_supported(c))
+		return RET_NOTHING;
+	fullfilename = mprintf("%s/%s%s", release_dirofdist(release),
+			filename, uncompression_suffix[c]);
+	if (FAILEDTOALLOC(fullfilename))
+		return RET_ERROR_OOM;
+	if (!isregularfile(fullfilename)) {
+		free(fullfilename);
+		return RET_NOTHING;
+	}
+	*fullfilename_p = fullfilename;
+	*compression_p = c;
+	return RET_OK;
+}
+
+/* with --jobs, extract the file lists not yet in the cache in parallel
+ * before filelist_addpackage needs them (only those of changed packages,
+ * if changed is given) */
+static retvalue prefetchfilelists(const struct strlist *packages, /*@null@*/const struct strlist *changed) {
+	struct filelistextraction *extraction;
+	retvalue result, r;
+	int i;
+
+	if (global.jobs <= 1)
+		return RET_NOTHING;
+	r = filelist_extract_start(&extraction, true);
+	if (RET_WAS_ERROR(r))
+		return r;
+	result = RET_NOTHING;
+	for (i = 0 ; i + 2 < packages->count ; i += 3) {
+		const char *name = packages->values[i];
+
+		if (changed != NULL &&
+				!isobsolete(name, strlen(name), (void*)changed))
+			continue;
+		r = filelist_extract_add(extraction, packages->values[i + 2]);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r) || interrupted())
+			break;
+	}
+	r = filelist_extract_finish(extraction);
+	RET_ENDUPDATE(result, r);
+	if (RET_IS_OK(result) && interrupted())
+		result = RET_ERROR_INTERRUPTED;
+	return result;
+}
+
+static retvalue addchanged(struct filelist_list *list, const struct strlist *packages, const struct strlist *changed) {
+	retvalue r;
+	int i;
+
+	for (i = 0 ; i + 2 < packages->count ; i += 3) {
+		const char *name = packages->values[i];
+
+		if (!isobsolete(name, strlen(name), (void*)changed))
+			continue;
+		r = filelist_addpackage(list, name,
+				packages->values[i + 1],
+				packages->values[i + 2]);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	return RET_OK;
+}
+
+/* apply the changes since the last time to the old file,
+ * RET_NOTHING if that is not possible (*file_p is then a new file) */
+static retvalue updatecontents(struct contentsrun *run, const char *filename, /*@null@*/const char *symlinkas, compressionset compressions, const struct contentscollector *collector, const struct contentsstate *state, struct filetorelease **file_p, /*@out@*/char **digest_p) {
+	struct contentsstate old;
+	struct strlist changed;
+	struct filelist_list *list;
+	enum compression compression;
+	char *oldfilename;
+	retvalue r;
 
-	free(filekey);
-	free(section);
+	r = oldcontentsfile(run->release, filename, compressions,
+			&oldfilename, &compression);
+	if (!RET_IS_OK(r))
+		return r;
+	r = state_read(run->states, filename, &old);
+	if (!RET_IS_OK(r)) {
+		free(oldfilename);
+		return r;
+	}
+	r = changednames(&old, state, &changed);
+	if (!RET_IS_OK(r)) {
+		state_done(&old);
+		free(oldfilename);
+		return r;
+	}
+	/* not worth it if most is new */
+	if (changed.count > state->count / 2) {
+		strlist_done(&changed);
+		state_done(&old);
+		free(oldfilename);
+		return RET_NOTHING;
+	}
+	r = prefetchfilelists(&collector->packages, &changed);
+	if (!RET_WAS_ERROR(r))
+		r = prefetchfilelists(&collector->all, &changed);
+	if (!RET_WAS_ERROR(r))
+		r = filelist_init(&list);
+	if (RET_IS_OK(r)) {
+		r = addchanged(list, &collector->packages, &changed);
+		if (!RET_WAS_ERROR(r))
+			r = addchanged(list, &collector->all, &changed);
+		if (!RET_WAS_ERROR(r))
+			r = filelist_writeupdated(list, oldfilename,
+					compression, old.digest,
+					isobsolete, &changed,
+					*file_p, digest_p);
+		filelist_free(list);
+	}
+	strlist_done(&changed);
+	state_done(&old);
+	if (r == RET_NOTHING) {
+		if (verbose > 0)
+			printf(
+"  %s is not as generated the last time, generating it anew...\n",
+					oldfilename);
+		release_abortfile(*file_p);
+		*file_p = NULL;
+		r = startcontentsfile(run->release, filename, symlinkas,
+				compressions, false, file_p);
+		assert (r != RET_NOTHING);
+		if (RET_IS_OK(r))
+			r = RET_NOTHING;
+	}
+	free(oldfilename);
 	return r;
 }
 
-static retvalue gentargetcontents(struct target *target, struct release *release, bool onlyneeded, bool symlink) {
+static retvalue fullcontents(struct contentsrun *run, struct contentscollector *collector, packagetype_t type, component_t component, struct filetorelease *file, /*@out@*/char **digest_p) {
+	const struct filelist_list *shared = NULL;
+	struct filelist_list *contents;
+	retvalue r;
+	int i;
+
+	r = prefetchfilelists(&collector->packages, NULL);
+	if (!RET_WAS_ERROR(r))
+		r = prefetchfilelists(&collector->all, NULL);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = filelist_init(&contents);
+	if (RET_WAS_ERROR(r))
+		return r;
+	for (i = 0 ; i + 2 < collector->packages.count ; i += 3) {
+		r = filelist_addpackage(contents,
+				collector->packages.values[i],
+				collector->packages.values[i + 1],
+				collector->packages.values[i + 2]);
+		if (RET_WAS_ERROR(r)) {
+			filelist_free(contents);
+			return r;
+		}
+	}
+	if (collector->all.count > 0) {
+		r = sharedcontents_get(&run->shared, type, component,
+				&collector->all, &shared);
+		if (RET_WAS_ERROR(r)) {
+			filelist_free(contents);
+			return r;
+		}
+	}
+	r = filelist_write(contents, shared, file, digest_p);
+	filelist_free(contents);
+	return r;
+}
+
+/* write the collected packages to the file and finish it */
+static retvalue writecontents(struct contentsrun *run, const char *filename, /*@null@*/const char *symlinkas, compressionset compressions, struct contentscollector *collector, packagetype_t type, component_t component, /*@only@*/struct filetorelease *file) {
+	struct contentsstate state;
+	char *digest = NULL;
+	retvalue r;
+
+	r = state_calc(collector, &state);
+	if (RET_WAS_ERROR(r)) {
+		release_abortfile(file);
+		return r;
+	}
+	r = RET_NOTHING;
+	if (run->incremental && run->states != NULL)
+		r = updatecontents(run, filename, symlinkas, compressions,
+				collector, &state, &file, &digest);
+	if (r == RET_NOTHING)
+		r = fullcontents(run, collector, type, component,
+				file, &digest);
+	if (RET_WAS_ERROR(r)) {
+		if (file != NULL)
+			release_abortfile(file);
+		state_done(&state);
+		return r;
+	}
+	r = release_finishfile(run->release, file);
+	if (RET_IS_OK(r) && run->states != NULL)
+		r = state_store(run->states, filename, digest, &state);
+	free(digest);
+	state_done(&state);
+	return r;
+}
+
+static retvalue gentargetcontents(struct contentsrun *run, struct target *target, bool onlyneeded, bool symlink) {
 	retvalue result, r;
-	char *contentsfilename;
+	char *contentsfilename, *symlinkas = NULL;
 	struct filetorelease *file;
-	struct filelist_list *contents;
+	struct contentscollector collector;
 	struct target_cursor iterator;
+	compressionset compressions = target->distribution->contents.compressions;
 
 	if (onlyneeded && target->saved_wasmodified)
 		onlyneeded = false;
@@ -200,36 +727,27 @@ static retvalue gentargetcontents(struct target *target, struct release *release
 		return RET_ERROR_OOM;
 
 	if (symlink) {
-		char *symlinkas = mprintf("%sContents-%s",
+		symlinkas = mprintf("%sContents-%s",
 				(target->packagetype == pt_udeb)?"s":"",
 				atoms_architectures[target->architecture]);
 		if (FAILEDTOALLOC(symlinkas)) {
 			free(contentsfilename);
 			return RET_ERROR_OOM;
 		}
-		r = release_startlinkedfile(release, contentsfilename,
-				symlinkas,
-				target->distribution->contents.compressions,
-				onlyneeded, &file);
-		free(symlinkas);
-	} else
-		r = release_startfile(release, contentsfilename,
-				target->distribution->contents.compressions,
-				onlyneeded, &file);
+	}
+	r = startcontentsfile(run->release, contentsfilename, symlinkas,
+			compressions, onlyneeded, &file);
 	if (!RET_IS_OK(r)) {
+		free(symlinkas);
 		free(contentsfilename);
 		return r;
 	}
 	if (verbose > 0) {
 		printf(" generating %s...\n", contentsfilename);
 	}
-	free(contentsfilename);
 
-	r = filelist_init(&contents);
-	if (RET_WAS_ERROR(r)) {
-		release_abortfile(file);
-		return r;
-	}
+	strlist_init(&collector.packages);
+	strlist_init(&collector.all);
 	result = target_openiterator(target, READONLY, &iterator);
 	if (RET_IS_OK(result)) {
 		const char *package;
@@ -237,7 +755,8 @@ static retvalue gentargetcontents(struct target *target, struct release *release
 
 		while (target_nextpackage(&iterator, &package, &packagedata)) {
 			r = addpackagetocontents(target->distribution,
-					target, package, &packagedata, contents);
+					target, package, &packagedata,
+					&collector);
 			RET_UPDATE(result, r);
 			if (RET_WAS_ERROR(r))
 				break;
@@ -246,20 +765,22 @@ static retvalue gentargetcontents(struct target *target, struct release *release
 		RET_ENDUPDATE(result, r);
 	}
 	if (!RET_WAS_ERROR(result))
-		result = filelist_write(contents, file);
-	if (RET_WAS_ERROR(result))
-		release_abortfile(file);
+		result = writecontents(run, contentsfilename, symlinkas,
+				compressions, &collector,
+				target->packagetype, target->component, file);
 	else
-		result = release_finishfile(release, file);
-	filelist_free(contents);
+		release_abortfile(file);
+	collector_done(&collector);
+	free(symlinkas);
+	free(contentsfilename);
 	return result;
 }
 
-static retvalue genarchcontents(struct distribution *distribution, architecture_t architecture, packagetype_t type, struct release *release, bool onlyneeded) {
+static retvalue genarchcontents(struct contentsrun *run, struct distribution *distribution, architecture_t architecture, packagetype_t type, bool onlyneeded) {
 	retvalue result = RET_NOTHING, r;
 	char *contentsfilename;
 	struct filetorelease *file;
-	struct filelist_list *contents;
+	struct contentscollector collector;
 	const struct atomlist *components;
 	struct target *target;
 	bool combinedonlyifneeded;
@@ -289,7 +810,7 @@ static retvalue genarchcontents(struct distribution *distribution, architecture_
 		if (onlyneeded && target->saved_wasmodified)
 			combinedonlyifneeded = false;
 		if (distribution->contents.flags.percomponent) {
-			r = gentargetcontents(target, release, onlyneeded,
+			r = gentargetcontents(run, target, onlyneeded,
 					distribution->contents.
 					 flags.compatsymlink &&
 					!distribution->contents.
@@ -309,7 +830,7 @@ static retvalue genarchcontents(struct distribution *distribution, architecture_
 					atoms_architectures[architecture]);
 			if (FAILEDTOALLOC(symlinkas))
 				return RET_ERROR_OOM;
-			release_warnoldfileorlink(release, symlinkas,
+			release_warnoldfileorlink(run->release, symlinkas,
 				distribution->contents.compressions);
 			free(symlinkas);
 		}
@@ -321,7 +842,7 @@ static retvalue genarchcontents(struct distribution *distribution, architecture_
 			atoms_architectures[architecture]);
 	if (FAILEDTOALLOC(contentsfilename))
 		return RET_ERROR_OOM;
-	r = release_startfile(release, contentsfilename,
+	r = release_startfile(run->release, contentsfilename,
 			distribution->contents.compressions,
 			combinedonlyifneeded, &file);
 	if (!RET_IS_OK(r)) {
@@ -331,23 +852,20 @@ static retvalue genarchcontents(struct distribution *distribution, architecture_
 	if (verbose > 0) {
 		printf(" generating %s...\n", contentsfilename);
 	}
-	free(contentsfilename);
 
-	r = filelist_init(&contents);
-	if (RET_WAS_ERROR(r)) {
-		release_abortfile(file);
-		return r;
-	}
+	strlist_init(&collector.packages);
+	strlist_init(&collector.all);
 	r = distribution_foreach_package_c(distribution,
 			components, architecture, type,
-			addpackagetocontents, contents);
+			addpackagetocontents, &collector);
 	if (!RET_WAS_ERROR(r))
-		r = filelist_write(contents, file);
-	if (RET_WAS_ERROR(r))
-		release_abortfile(file);
+		r = writecontents(run, contentsfilename, NULL,
+				distribution->contents.compressions,
+				&collector, type, atom_unknown, file);
 	else
-		r = release_finishfile(release, file);
-	filelist_free(contents);
+		release_abortfile(file);
+	collector_done(&collector);
+	free(contentsfilename);
 	RET_UPDATE(result, r);
 	return result;
 }
@@ -356,10 +874,19 @@ retvalue contents_generate(struct distribution *distribution, struct release *re
 	retvalue result, r;
 	int i;
 	const struct atomlist *architectures;
+	struct contentsrun run;
 
 	if (distribution->contents.compressions == 0)
 		distribution->contents.compressions = IC_FLAG(ic_gzip);
 
+	run.release = release;
+	run.incremental = onlyneeded;
+	run.shared = NULL;
+	r = database_opencontentsstates(distribution->codename, &run.states);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		run.states = NULL;
+
 	result = RET_NOTHING;
 	if (distribution->contents_architectures_set) {
 		architectures = &distribution->contents_architectures;
@@ -373,17 +900,28 @@ retvalue contents_generate(struct distribution *distribution, struct release *re
 			continue;
 
 		if (!distribution->contents.flags.nodebs) {
-			r = genarchcontents(distribution,
-					architecture, pt_deb,
-					release, onlyneeded);
+			r = genarchcontents(&run, distribution,
+					architecture, pt_deb, onlyneeded);
 			RET_UPDATE(result, r);
 		}
 		if (distribution->contents.flags.udebs) {
-			r = genarchcontents(distribution,
-					architecture, pt_udeb,
-					release, onlyneeded);
+			r = genarchcontents(&run, distribution,
+					architecture, pt_udeb, onlyneeded);
 			RET_UPDATE(result, r);
 		}
 	}
+	sharedcontents_free(run.shared);
+	if (run.states != NULL) {
+		r = table_close(run.states);
+		RET_UPDATE(result, r);
+	}
 	return result;
 }
+
+bool contents_needsfilelists(const struct distribution *distribution, packagetype_t packagetype) {
+	if (!distribution->contents.flags.enabled)
+		return false;
+	if (packagetype == pt_udeb)
+		return distribution->contents.flags.udebs;
+	return packagetype == pt_deb && !distribution->contents.flags.nodebs;
+}
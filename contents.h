@@ -28,5 +28,7 @@ struct configiterator;
 
 retvalue contentsoptions_parse(struct distribution *, struct configiterator *);
 retvalue contents_generate(struct distribution *, struct release *, bool /*onlyneeded*/);
+/* if the file lists of new packages of this type will be needed */
+bool contents_needsfilelists(const struct distribution *, packagetype_t);
 
 #endif
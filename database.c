@@ -1042,6 +1042,33 @@ retvalue table_close(struct table *table) {
 	return result;
 }
 
+static retvalue table_sync(struct table *table) {
+	int dbret;
+
+	if (table == NULL || table->berkeleydb == NULL)
+		return RET_NOTHING;
+	dbret = table->berkeleydb->sync(table->berkeleydb, 0);
+	if (dbret != 0) {
+		fprintf(stderr, "db_sync(%s, %s): %s\n",
+				table->name, table->subname,
+				db_strerror(dbret));
+		return RET_DBERR(dbret);
+	}
+	return RET_OK;
+}
+
+retvalue database_sync(void) {
+	retvalue result = RET_NOTHING, r;
+
+	r = table_sync(rdb_references);
+	RET_UPDATE(result, r);
+	r = table_sync(rdb_checksums);
+	RET_UPDATE(result, r);
+	r = table_sync(rdb_contents);
+	RET_UPDATE(result, r);
+	return result;
+}
+
 retvalue table_getcomplexrecord(struct table *table, bool secondary, const char *key, /*@out@*/void **data_p, /*@out@*/size_t *len_p) {
 	int dbret;
 	DBT Key, Data;
@@ -1405,6 +1432,21 @@ retvalue table_newglobalcursor(struct table *table, struct cursor **cursor_p) {
 	return RET_OK;
 }
 
+/* like table_newglobalcursor, but only return the first entry of each
+ * key in tables with duplicates */
+retvalue table_newglobaluniqcursor(struct table *table, struct cursor **cursor_p) {
+	struct cursor *cursor;
+	retvalue r;
+
+	r = table_newglobalcursor(table, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+	if (cursor != NULL)
+		cursor->flags = DB_NEXT_NODUP;
+	*cursor_p = cursor;
+	return RET_OK;
+}
+
 static inline retvalue parse_pair(struct table *table, const void *key, size_t key_size, const void *data, size_t data_size, /*@null@*//*@out@*/const char **key_p, /*@out@*/const char **value_p, /*@out@*/const char **data_p, /*@out@*/size_t *datalen_p) {
 	/*@dependant@*/ const char *separator;
 
@@ -2187,6 +2229,16 @@ retvalue database_openreleasecache(const char *codename, struct table **cachedb_
 	return r;
 }
 
+retvalue database_opencontentsstates(const char *codename, struct table **table_p) {
+	retvalue r;
+
+	r = database_table("contents.states.db", codename,
+			 dbt_HASH, DB_CREATE, table_p);
+	if (RET_IS_OK(r))
+		(*table_p)->verbose = false;
+	return r;
+}
+
 static retvalue table_copy(struct table *oldtable, struct table *newtable) {
 	retvalue r;
 	struct cursor *cursor;
@@ -2551,3 +2603,25 @@ retvalue database_translate_legacy_checksums(bool verbosedb) {
 bool database_allcreated(void) {
 	return rdb_capabilities.createnewtables;
 }
+
+/* mark the database as containing data only understood by
+ * this version (or newer) */
+retvalue database_requireversion(const char *version) {
+	char *v;
+	int c;
+	retvalue r;
+
+	if (rdb_lastsupportedversion != NULL) {
+		r = dpkgversions_cmp(rdb_lastsupportedversion, version, &c);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (c >= 0)
+			return RET_NOTHING;
+	}
+	v = strdup(version);
+	if (FAILEDTOALLOC(v))
+		return RET_ERROR_OOM;
+	free(rdb_lastsupportedversion);
+	rdb_lastsupportedversion = v;
+	return RET_OK;
+}
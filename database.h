@@ -17,6 +17,8 @@ struct cursor;
 
 retvalue database_create(struct distribution *, bool fast, bool /*nopackages*/, bool /*allowunused*/, bool /*readonly*/, size_t /*waitforlock*/, bool /*verbosedb*/);
 retvalue database_close(void);
+/* for long running commands: write the tables kept open to disk */
+retvalue database_sync(void);
 
 retvalue database_openfiles(void);
 retvalue database_openreferences(void);
@@ -24,10 +26,12 @@ retvalue database_listpackages(/*@out@*/struct strlist *);
 retvalue database_droppackages(const char *);
 retvalue database_openpackages(const char *, bool /*readonly*/, /*@out@*/struct table **);
 retvalue database_openreleasecache(const char *, /*@out@*/struct table **);
+retvalue database_opencontentsstates(const char *, /*@out@*/struct table **);
 retvalue database_opentracking(const char *, bool /*readonly*/, /*@out@*/struct table **);
 retvalue database_translate_filelists(void);
 retvalue database_translate_legacy_checksums(bool /*verbosedb*/);
 bool database_allcreated(void);
+retvalue database_requireversion(const char *);
 
 retvalue table_close(/*@only@*/struct table *);
 
@@ -49,6 +53,7 @@ retvalue table_checkrecord(struct table *, const char *key, const char *data);
 retvalue table_removerecord(struct table *, const char *key, const char *data);
 
 retvalue table_newglobalcursor(struct table *, /*@out@*/struct cursor **);
+retvalue table_newglobaluniqcursor(struct table *, /*@out@*/struct cursor **);
 retvalue table_newduplicatecursor(struct table *, bool secondary, const char *, /*@out@*/struct cursor **, /*@out@*/const void **, /*@out@*/size_t *);
 retvalue table_newduplicatepairedcursor(struct table *table, const char *key, struct cursor **cursor_p, const char **value_p, const char **data_p, size_t *datalen_p);
 retvalue table_newpairedcursor(struct table *, const char *, const char *, /*@out@*/struct cursor **, /*@out@*//*@null@*/const char **, /*@out@*//*@null@*/size_t *);
@@ -171,6 +171,37 @@ static retvalue read_control_tar(char **control, const char *debfile, struct ar_
 	return RET_ERROR_MISSING;
 }
 
+retvalue extractcontrolmember(struct ar_archive *ar, const char *membername, const char *debfile, bool *hadcandidate_p, char **control) {
+	struct archive *tar;
+	enum compression c;
+	retvalue r;
+
+	if (strncmp(membername, "control.tar", 11) != 0)
+		return RET_NOTHING;
+	*hadcandidate_p = true;
+	for (c = 0 ; c < c_COUNT ; c++) {
+		if (strcmp(membername + 11, uncompression_suffix[c]) == 0)
+			break;
+	}
+	if (c >= c_COUNT || !uncompression_supported(c))
+		return RET_NOTHING;
+	ar_archivemember_setcompression(ar, c);
+	tar = archive_read_new();
+	r = read_control_tar(control, debfile, ar, tar);
+	// TODO run archive_read_close to get error messages?
+	archive_read_free(tar);
+	return r;
+}
+
+void missingcontrolmember(const char *debfile, bool hadcandidate) {
+	if (hadcandidate)
+		fprintf(stderr,
+"Could not find a suitable control.tar file within '%s'!\n", debfile);
+	else
+		fprintf(stderr,
+"Could not find a control.tar file within '%s'!\n", debfile);
+}
+
 retvalue extractcontrol(char **control, const char *debfile) {
 	struct ar_archive *ar;
 	retvalue r;
@@ -182,48 +213,20 @@ retvalue extractcontrol(char **control, const char *debfile) {
 	assert (r != RET_NOTHING);
 	do {
 		char *filename;
-		enum compression c;
 
 		r = ar_nextmember(ar, &filename);
 		if (RET_IS_OK(r)) {
-			if (strncmp(filename, "control.tar", 11) != 0) {
-				free(filename);
-				continue;
-			}
-			hadcandidate = true;
-			for (c = 0 ; c < c_COUNT ; c++) {
-				if (strcmp(filename + 11,
-						uncompression_suffix[c]) == 0)
-					break;
-			}
-			if (c >= c_COUNT) {
-				free(filename);
-				continue;
-			}
-			ar_archivemember_setcompression(ar, c);
-			if (uncompression_supported(c)) {
-				struct archive *tar;
-
-				tar = archive_read_new();
-				r = read_control_tar(control, debfile, ar, tar);
-				// TODO run archive_read_close to get error messages?
-				archive_read_free(tar);
-				if (r != RET_NOTHING) {
-					ar_close(ar);
-					free(filename);
-					return r;
-				}
-
-			}
+			r = extractcontrolmember(ar, filename, debfile,
+					&hadcandidate, control);
 			free(filename);
+			if (r != RET_NOTHING) {
+				ar_close(ar);
+				return r;
+			}
+			r = RET_OK;
 		}
 	} while (RET_IS_OK(r));
 	ar_close(ar);
-	if (hadcandidate)
-		fprintf(stderr,
-"Could not find a suitable control.tar file within '%s'!\n", debfile);
-	else
-		fprintf(stderr,
-"Could not find a control.tar file within '%s'!\n", debfile);
+	missingcontrolmember(debfile, hadcandidate);
 	return RET_ERROR_MISSING;
 }
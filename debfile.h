@@ -12,4 +12,14 @@ retvalue extractcontrol(/*@out@*/char **, const char *);
 /* Read a list of files from a .deb file */
 retvalue getfilelist(/*@out@*/char **, /*@out@*/ size_t *, const char *);
 
+/* Read both at once, the list is NULL if it could not be read */
+retvalue extractcontrolandfilelist(/*@out@*/char **, /*@out@*/char **, /*@out@*/size_t *, const char *);
+
+/* for debfile.c and debfilecontents.c: read the control file if the current
+ * member of the .deb is the control.tar (RET_NOTHING if it is not or is
+ * compressed in some unsupported way), and tell none was found */
+struct ar_archive;
+retvalue extractcontrolmember(struct ar_archive *, const char * /*membername*/, const char * /*debfile*/, bool * /*hadcandidate*/, /*@out@*/char ** /*control*/);
+void missingcontrolmember(const char * /*debfile*/, bool /*hadcandidate*/);
+
 #endif
@@ -50,9 +50,11 @@ static retvalue read_data_tar(/*@out@*/char **list, /*@out@*/size_t *size, const
 
 	archive_read_support_format_tar(tar);
 	archive_read_support_format_gnutar(tar);
-	a = archive_read_open(tar, ar,
+	/* uncompressed data.tar members can skip over the file contents */
+	a = archive_read_open2(tar, ar,
 			ar_archivemember_open,
 			ar_archivemember_read,
+			ar_archivemember_skip,
 			ar_archivemember_close);
 	if (a != ARCHIVE_OK) {
 		filelistcompressor_cancel(&c);
@@ -134,6 +136,37 @@ static retvalue read_data_tar(/*@out@*/char **list, /*@out@*/size_t *size, const
 }
 
 
+static retvalue readdatamember(struct ar_archive *ar, const char *membername, const char *debfile, bool *hadcandidate_p, /*@out@*/char **filelist, /*@out@*/size_t *size) {
+	struct archive *tar;
+	enum compression c;
+	retvalue r;
+
+	if (strncmp(membername, "data.tar", 8) != 0)
+		return RET_NOTHING;
+	*hadcandidate_p = true;
+	for (c = 0 ; c < c_COUNT ; c++) {
+		if (strcmp(membername + 8, uncompression_suffix[c]) == 0)
+			break;
+	}
+	if (c >= c_COUNT || !uncompression_supported(c))
+		return RET_NOTHING;
+	ar_archivemember_setcompression(ar, c);
+	tar = archive_read_new();
+	r = read_data_tar(filelist, size, debfile, ar, tar);
+	// TODO: check how to get an error message here..
+	archive_read_free(tar);
+	return r;
+}
+
+static void missingdata(const char *debfile, bool hadcandidate) {
+	if (hadcandidate)
+		fprintf(stderr,
+"Could not find a suitable data.tar file within '%s'!\n", debfile);
+	else
+		fprintf(stderr,
+"Could not find a data.tar file within '%s'!\n", debfile);
+}
+
 retvalue getfilelist(/*@out@*/char **filelist, size_t *size, const char *debfile) {
 	struct ar_archive *ar;
 	retvalue r;
@@ -145,49 +178,77 @@ retvalue getfilelist(/*@out@*/char **filelist, size_t *size, const char *debfile
 	assert (r != RET_NOTHING);
 	do {
 		char *filename;
-		enum compression c;
 
 		r = ar_nextmember(ar, &filename);
 		if (RET_IS_OK(r)) {
-			if (strncmp(filename, "data.tar", 8) != 0) {
-				free(filename);
-				continue;
-			}
-			hadcandidate = true;
-			for (c = 0 ; c < c_COUNT ; c++) {
-				if (strcmp(filename + 8,
-						uncompression_suffix[c]) == 0)
-					break;
-			}
-			if (c >= c_COUNT) {
-				free(filename);
-				continue;
-			}
-			ar_archivemember_setcompression(ar, c);
-			if (uncompression_supported(c)) {
-				struct archive *tar;
-
-				tar = archive_read_new();
-				r = read_data_tar(filelist, size,
-						debfile, ar, tar);
-				// TODO: check how to get an error message here..
-				archive_read_free(tar);
-				if (r != RET_NOTHING) {
-					ar_close(ar);
-					free(filename);
-					return r;
-				}
-
-			}
+			r = readdatamember(ar, filename, debfile,
+					&hadcandidate, filelist, size);
 			free(filename);
+			if (r != RET_NOTHING) {
+				ar_close(ar);
+				return r;
+			}
+			r = RET_OK;
 		}
 	} while (RET_IS_OK(r));
 	ar_close(ar);
-	if (hadcandidate)
-		fprintf(stderr,
-"Could not find a suitable data.tar file within '%s'!\n", debfile);
-	else
-		fprintf(stderr,
-"Could not find a data.tar file within '%s'!\n", debfile);
+	missingdata(debfile, hadcandidate);
 	return RET_ERROR_MISSING;
 }
+
+/* the control.tar comes before the data.tar, so both can be read
+ * in one pass over the file */
+retvalue extractcontrolandfilelist(char **control, char **filelist, size_t *size, const char *debfile) {
+	struct ar_archive *ar;
+	char *c = NULL, *l = NULL;
+	size_t s = 0;
+	retvalue r;
+	bool hadcontrol = false, haddata = false, datafailed = false;
+
+	r = ar_open(&ar, debfile);
+	if (RET_WAS_ERROR(r))
+		return r;
+	assert (r != RET_NOTHING);
+	do {
+		char *filename;
+
+		r = ar_nextmember(ar, &filename);
+		if (!RET_IS_OK(r))
+			break;
+		if (c == NULL)
+			r = extractcontrolmember(ar, filename, debfile,
+					&hadcontrol, &c);
+		else
+			r = RET_NOTHING;
+		if (r == RET_NOTHING && l == NULL && !datafailed) {
+			r = readdatamember(ar, filename, debfile,
+					&haddata, &l, &s);
+			/* only the control data is needed to include it,
+			 * the list is tried again when generating Contents */
+			if (RET_WAS_ERROR(r) && r != RET_ERROR_OOM &&
+					r != RET_ERROR_INTERRUPTED) {
+				datafailed = true;
+				r = RET_NOTHING;
+			}
+		}
+		free(filename);
+		if (RET_WAS_ERROR(r))
+			break;
+		r = RET_OK;
+	} while (c == NULL || (l == NULL && !datafailed));
+	ar_close(ar);
+	if (RET_WAS_ERROR(r)) {
+		free(c);
+		free(l);
+		return r;
+	}
+	if (c == NULL) {
+		missingcontrolmember(debfile, hadcontrol);
+		free(l);
+		return RET_ERROR_MISSING;
+	}
+	*control = c;
+	*filelist = l;
+	*size = s;
+	return RET_OK;
+}
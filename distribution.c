@@ -804,7 +804,31 @@ retvalue distribution_snapshot(struct distribution *distribution, const char *na
 	return result;
 }
 
-static retvalue export(struct distribution *distribution, bool onlyneeded) {
+static void export_failed(struct distribution *distribution) {
+	struct target *target;
+	bool workleft = false;
+
+	fprintf(stderr, "ERROR: Could not finish exporting '%s'!\n",
+			distribution->codename);
+	for (target=distribution->targets; target != NULL ;
+	                                   target = target->next) {
+		workleft |= target->saved_wasmodified;
+	}
+	if (workleft) {
+		(void)fputs(
+"This means that from outside your repository will still look like before (and\n"
+"should still work if this old state worked), but the changes intended with this\n"
+"call will not be visible until you call export directly (via reprepro export)\n"
+"Changes will also get visible when something else changes the same file and\n"
+"thus creates a new export of that file, but even changes to other parts of the\n"
+"same distribution will not!\n",
+				stderr);
+	}
+}
+
+/* generate all index files and the Release file (unsigned if signlater)
+ * in their temporary places, RET_NOTHING if there is nothing to do */
+static retvalue export_prepare(struct distribution *distribution, bool onlyneeded, bool signlater, /*@out@*/struct release **release_p) {
 	struct target *target;
 	retvalue result, r;
 	struct release *release;
@@ -850,38 +874,49 @@ static retvalue export(struct distribution *distribution, bool onlyneeded) {
 		r = contents_generate(distribution, release, onlyneeded);
 	}
 	if (!RET_WAS_ERROR(result)) {
-		result = release_prepare(release, distribution, onlyneeded);
+		if (signlater)
+			result = release_prepareunsigned(release, distribution,
+					onlyneeded);
+		else
+			result = release_prepare(release, distribution,
+					onlyneeded);
 		if (result == RET_NOTHING) {
 			release_free(release);
 			return result;
 		}
 	}
 	if (RET_WAS_ERROR(result)) {
-		bool workleft = false;
 		release_free(release);
-		fprintf(stderr, "ERROR: Could not finish exporting '%s'!\n",
-				distribution->codename);
-		for (target=distribution->targets; target != NULL ;
-		                                   target = target->next) {
-			workleft |= target->saved_wasmodified;
-		}
-		if (workleft) {
-			(void)fputs(
-"This means that from outside your repository will still look like before (and\n"
-"should still work if this old state worked), but the changes intended with this\n"
-"call will not be visible until you call export directly (via reprepro export)\n"
-"Changes will also get visible when something else changes the same file and\n"
-"thus creates a new export of that file, but even changes to other parts of the\n"
-"same distribution will not!\n",
-					stderr);
-		}
-	} else {
-		r = release_finish(release, distribution);
-		RET_UPDATE(result, r);
+		export_failed(distribution);
+		return result;
+	}
+	*release_p = release;
+	return RET_OK;
+}
+
+/* move everything in place, signresult is the result of signing it */
+static retvalue export_finish(struct distribution *distribution, /*@only@*/struct release *release, retvalue signresult) {
+	retvalue r;
+
+	if (RET_WAS_ERROR(signresult)) {
+		release_free(release);
+		export_failed(distribution);
+		return signresult;
 	}
-	if (RET_IS_OK(result))
+	r = release_finish(release, distribution);
+	if (RET_IS_OK(r))
 		distribution->status = RET_NOTHING;
-	return result;
+	return r;
+}
+
+static retvalue export(struct distribution *distribution, bool onlyneeded) {
+	struct release *release;
+	retvalue r;
+
+	r = export_prepare(distribution, onlyneeded, false, &release);
+	if (!RET_IS_OK(r))
+		return r;
+	return export_finish(distribution, release, RET_OK);
 }
 
 retvalue distribution_fullexport(struct distribution *distribution) {
@@ -901,10 +936,56 @@ retvalue distribution_freelist(struct distribution *distributions) {
 	return result;
 }
 
+/* With --jobs the Release files of all distributions to export are
+ * generated first and then signed in parallel, as signing them one
+ * after the other can take quite some time. Everything is only moved
+ * in place after that, each distribution for itself as usual. */
+struct deferredexports {
+	int count;
+	struct distribution **distributions;
+	struct release **releases;
+	retvalue *results;
+};
+
+static retvalue exportlist_one(struct distribution *d, /*@null@*/struct deferredexports *deferred) {
+	struct release *release;
+	retvalue r;
+
+	if (deferred == NULL)
+		return export(d, true);
+	r = export_prepare(d, true, true, &release);
+	if (!RET_IS_OK(r))
+		return r;
+	deferred->distributions[deferred->count] = d;
+	deferred->releases[deferred->count] = release;
+	deferred->count++;
+	return RET_OK;
+}
+
+static retvalue exportlist_deferred(struct deferredexports *deferred) {
+	retvalue result = RET_NOTHING, r;
+	int i;
+
+	if (deferred->count > 0)
+		release_sign(deferred->releases, deferred->results,
+				deferred->count);
+	for (i = 0 ; i < deferred->count ; i++) {
+		r = export_finish(deferred->distributions[i],
+				deferred->releases[i], deferred->results[i]);
+		RET_UPDATE(result, r);
+	}
+	free(deferred->distributions);
+	free(deferred->releases);
+	free(deferred->results);
+	return result;
+}
+
 retvalue distribution_exportlist(enum exportwhen when, struct distribution *distributions) {
 	retvalue result, r;
 	bool todo = false;
 	struct distribution *d;
+	struct deferredexports deferred, *deferred_p = NULL;
+	int count = 0;
 
 	if (when == EXPORT_SILENT_NEVER) {
 		for (d = distributions ; d != NULL ; d = d->next) {
@@ -935,6 +1016,24 @@ retvalue distribution_exportlist(enum exportwhen when, struct distribution *dist
 	if (verbose >= 0 && todo)
 		printf("Exporting indices...\n");
 
+	if (todo && global.jobs > 1) {
+		for (d = distributions ; d != NULL ; d = d->next)
+			count++;
+		setzero(struct deferredexports, &deferred);
+		deferred.distributions = nzNEW(count, struct distribution *);
+		deferred.releases = nzNEW(count, struct release *);
+		deferred.results = nzNEW(count, retvalue);
+		if (FAILEDTOALLOC(deferred.distributions) ||
+				FAILEDTOALLOC(deferred.releases) ||
+				FAILEDTOALLOC(deferred.results)) {
+			free(deferred.distributions);
+			free(deferred.releases);
+			free(deferred.results);
+			return RET_ERROR_OOM;
+		}
+		deferred_p = &deferred;
+	}
+
 	result = RET_NOTHING;
 	for (d=distributions; d != NULL; d = d->next) {
 		if (d->exportoptions[deo_noexport])
@@ -969,7 +1068,7 @@ retvalue distribution_exportlist(enum exportwhen when, struct distribution *dist
 "Please report this and how you got this message as bugreport. Thanks.\n"
 "Doing a export despite --export=changed....\n",
 						d->codename);
-					r = export(d, true);
+					r = exportlist_one(d, deferred_p);
 					RET_UPDATE(result, r);
 					break;
 				}
@@ -979,13 +1078,37 @@ retvalue distribution_exportlist(enum exportwhen when, struct distribution *dist
 					(d->status == RET_NOTHING &&
 					  when != EXPORT_CHANGED) ||
 					when == EXPORT_FORCE);
-			r = export(d, true);
+			r = exportlist_one(d, deferred_p);
 			RET_UPDATE(result, r);
 		}
 	}
+	if (deferred_p != NULL) {
+		r = exportlist_deferred(deferred_p);
+		RET_UPDATE(result, r);
+	}
 	return result;
 }
 
+void distribution_forgetstatus(struct distribution *distributions) {
+	struct distribution *d;
+
+	for (d = distributions ; d != NULL ; d = d->next) {
+		struct target *t;
+		bool notexported = false;
+
+		for (t = d->targets ; t != NULL ; t = t->next) {
+			notexported |= t->wasmodified;
+			t->saved_wasmodified = false;
+		}
+		/* a distribution with errors is never exported (like in a
+		 * single run), one not yet exported as something else
+		 * failed still needs to be exported later */
+		if (RET_WAS_ERROR(d->status) || notexported)
+			continue;
+		d->status = RET_NOTHING;
+		d->lookedat = false;
+	}
+}
 
 /* get a pointer to the apropiate part of the linked list */
 struct distribution *distribution_find(struct distribution *distributions, const char *name) {
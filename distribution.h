@@ -155,6 +155,10 @@ struct distribution *distribution_find(struct distribution *, const char *);
 retvalue distribution_freelist(/*@only@*/struct distribution *distributions);
 enum exportwhen {EXPORT_NEVER, EXPORT_SILENT_NEVER, EXPORT_CHANGED, EXPORT_NORMAL, EXPORT_FORCE };
 retvalue distribution_exportlist(enum exportwhen when, /*@only@*/struct distribution *);
+/* forget which distributions were looked at and what was exported (unless
+ * they still need to be exported or had errors), to start over again in
+ * long running commands */
+void distribution_forgetstatus(struct distribution *);
 
 retvalue distribution_loadalloverrides(struct distribution *);
 void distribution_unloadoverrides(struct distribution *distribution);
@@ -16,17 +16,23 @@
 #include <config.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <dirent.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include "error.h"
+#include "mprintf.h"
 #include "strlist.h"
 #include "names.h"
 #include "dirs.h"
+#include "filecntl.h"
 #include "files.h"
 #include "freespace.h"
+#include "sharedcache.h"
 #include "downloadcache.h"
 
 
@@ -76,6 +82,96 @@ retvalue downloadcache_free(struct downloadcache *download) {
 	return RET_OK;
 }
 
+/* Files that could not be downloaded completely are kept in the lists
+ * directory as partial/<sha256>, so a later run can continue them. */
+static /*@null@*/char *calc_partialfilename(const struct checksums *checksums) {
+	const char *hash;
+	size_t len;
+
+	if (!checksums_getpart(checksums, cs_sha256sum, &hash, &len))
+		return NULL;
+	return mprintf("%s/partial/%.*s", global.listdir, (int)len, hash);
+}
+
+static void keeppartial(const char *filename, const struct checksums *checksums) {
+	struct stat s;
+	char *partialfilename;
+
+	if (lstat(filename, &s) != 0 || !S_ISREG(s.st_mode) ||
+			s.st_size <= 0 ||
+			s.st_size >= checksums_getfilesize(checksums))
+		return;
+	partialfilename = calc_partialfilename(checksums);
+	if (partialfilename == NULL)
+		return;
+	(void)dirs_make_parent(partialfilename);
+	if (rename(filename, partialfilename) != 0) {
+		/* no use in keeping it in the pool */
+		(void)unlink(filename);
+	} else if (verbose > 1)
+		fprintf(stderr,
+"Keeping %lld bytes of '%s' to continue next time.\n",
+				(long long)s.st_size, filename);
+	free(partialfilename);
+}
+
+/* put what an earlier run already got where the method can continue it */
+static void resumepartial(const char *filename, const struct checksums *checksums) {
+	char *partialfilename;
+
+	partialfilename = calc_partialfilename(checksums);
+	if (partialfilename == NULL)
+		return;
+	if (rename(partialfilename, filename) == 0) {
+		if (verbose > 1)
+			fprintf(stderr,
+"Continuing earlier partial download of '%s'.\n",
+					filename);
+	} else if (errno != ENOENT)
+		(void)unlink(partialfilename);
+	free(partialfilename);
+}
+
+retvalue downloadcache_cleanpartial(void) {
+	struct dirent *ent;
+	char *dirname, *filename;
+	DIR *dir;
+	retvalue r = RET_NOTHING;
+
+	dirname = calc_dirconcat(global.listdir, "partial");
+	if (FAILEDTOALLOC(dirname))
+		return RET_ERROR_OOM;
+	dir = opendir(dirname);
+	if (dir == NULL) {
+		int e = errno;
+		if (e == ENOENT) {
+			free(dirname);
+			return RET_NOTHING;
+		}
+		fprintf(stderr, "Error %d opening directory '%s': %s\n",
+				e, dirname, strerror(e));
+		free(dirname);
+		return RET_ERRNO(e);
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		filename = calc_dirconcat(dirname, ent->d_name);
+		if (FAILEDTOALLOC(filename)) {
+			r = RET_ERROR_OOM;
+			break;
+		}
+		if (verbose >= 0)
+			printf("deleting %s\n", filename);
+		deletefile(filename);
+		free(filename);
+		r = RET_OK;
+	}
+	(void)closedir(dir);
+	free(dirname);
+	return r;
+}
+
 static retvalue downloaditem_callback(enum queue_action action, void *privdata, void *privdata2, const char *uri, const char *gotfilename, const char *wantedfilename, /*@null@*/const struct checksums *checksums, const char *method) {
 	struct downloaditem *d = privdata;
 	struct downloadcache *cache = privdata2;
@@ -83,9 +179,12 @@ static retvalue downloaditem_callback(enum queue_action action, void *privdata,
 	retvalue r;
 	bool improves;
 
-	if (action != qa_got)
+	if (action != qa_got) {
+		if (action == qa_error)
+			keeppartial(wantedfilename, d->checksums);
 		// TODO: instead store in downloaditem?
 		return RET_ERROR;
+	}
 
 	/* if the file is somewhere else, copy it: */
 	if (strcmp(gotfilename, wantedfilename) != 0) {
@@ -190,6 +289,7 @@ static retvalue downloaditem_callback(enum queue_action action, void *privdata,
 	if (RET_WAS_ERROR(r))
 		return r;
 	d->done = true;
+	sharedcache_add(wantedfilename, d->checksums);
 	return RET_OK;
 }
 
@@ -226,7 +326,7 @@ retvalue downloadcache_add(struct downloadcache *cache, struct aptmethod *method
 
 	struct downloaditem *i;
 	struct downloaditem *item, **h, *parent;
-	char *fullfilename;
+	char *fullfilename, *localfile;
 	retvalue r;
 
 	assert (cache != NULL && method != NULL);
@@ -272,7 +372,33 @@ retvalue downloadcache_add(struct downloadcache *cache, struct aptmethod *method
 		return RET_ERROR_OOM;
 	}
 	(void)dirs_make_parent(fullfilename);
-	r = space_needed(cache->devices, fullfilename, checksums);
+	item->left = item->right = NULL;
+	item->parent = parent;
+
+	/* another rule or repository might already have downloaded it */
+	r = sharedcache_get(item->checksums, fullfilename);
+	if (RET_IS_OK(r)) {
+		free(fullfilename);
+		r = files_add_checksums(item->filekey, item->checksums);
+		if (RET_WAS_ERROR(r)) {
+			freeitem(item);
+			return r;
+		}
+		item->done = true;
+		*h = item;
+		return RET_OK;
+	}
+	if (RET_WAS_ERROR(r)) {
+		free(fullfilename);
+		freeitem(item);
+		return r;
+	}
+
+	resumepartial(fullfilename, item->checksums);
+
+	localfile = aptmethod_localfile(method, orig);
+	r = space_needed(cache->devices, fullfilename, checksums, localfile);
+	free(localfile);
 	if (RET_WAS_ERROR(r)) {
 		free(fullfilename);
 		freeitem(item);
@@ -284,9 +410,6 @@ retvalue downloadcache_add(struct downloadcache *cache, struct aptmethod *method
 		freeitem(item);
 		return r;
 	}
-	item->left = item->right = NULL;
-
-	item->parent = parent;
 	*h = item;
 
 	cache->size_todo += checksums_getfilesize(item->checksums);
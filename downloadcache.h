@@ -46,4 +46,7 @@ retvalue downloadcache_add(struct downloadcache *, struct aptmethod *, const cha
 
 /* some as above, only for more files... */
 retvalue downloadcache_addfiles(struct downloadcache *, struct aptmethod *, const struct checksumsarray * /*origfiles*/, const struct strlist * /*filekeys*/);
+
+/* delete all partially downloaded files kept for later runs */
+retvalue downloadcache_cleanpartial(void);
 #endif
@@ -15,30 +15,56 @@
  */
 #include <config.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "error.h"
+#include "mprintf.h"
+#include "md5.h"
 #include "database_p.h"
 #include "files.h"
 #include "debfile.h"
+#include "uncompression.h"
+#include "workers.h"
 #include "filelist.h"
 
-struct filelist_package {
-	struct filelist_package *next;
-	char name[];
+/* All nodes and names live in an arena, freed all at once at the end.
+ * Names of files are interned, as many (like copyright files)
+ * are the same in many directories, and packages are referenced
+ * by their index in the packages array. */
+
+#define ARENA_BLOCKSIZE (1024*1024)
+
+struct arenablock {
+	struct arenablock *next;
+	char data[];
+};
+
+struct arena {
+	/*@null@*/struct arenablock *blocks;
+	char *next;
+	size_t left;
+};
+
+/* packages of a file beyond the first one */
+#define MOREPACKAGES 6
+struct morepackages {
+	struct morepackages *next;
+	uint32_t count;
+	uint32_t packages[MOREPACKAGES];
 };
 
 struct dirlist;
 struct filelist {
 	struct filelist *nextl;
 	struct filelist *nextr;
+	/*@dependent@*/const char *name;
 	int balance;
-	char *name;
-	size_t count;
-	const char *packages[];
+	uint32_t package;
+	/*@null@*/struct morepackages *more;
 };
 struct dirlist {
 	struct dirlist *nextl;
@@ -54,71 +80,179 @@ struct dirlist {
 
 struct filelist_list {
 	struct dirlist *root;
-	struct filelist_package *packages;
+	struct arena arena;
+	/* "section/name" of all packages added */
+	const char **packages;
+	uint32_t packagecount, packagesize;
+	/* open addressing hash table of all file names */
+	const char **names;
+	size_t namecount, namesize;
 };
 
+static void *arena_alloc(struct arena *arena, size_t size) {
+	struct arenablock *b;
+	size_t blocksize;
+	void *p;
+
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if (size > arena->left) {
+		blocksize = ARENA_BLOCKSIZE;
+		if (size > blocksize / 4)
+			blocksize = size;
+		b = malloc(sizeof(struct arenablock) + blocksize);
+		if (FAILEDTOALLOC(b))
+			return NULL;
+		b->next = arena->blocks;
+		arena->blocks = b;
+		if (blocksize == size)
+			/* a large one, keep the rest of the current block */
+			return b->data;
+		arena->next = b->data;
+		arena->left = blocksize;
+	}
+	p = arena->next;
+	arena->next += size;
+	arena->left -= size;
+	return p;
+}
+
+static void arena_done(struct arena *arena) {
+	while (arena->blocks != NULL) {
+		struct arenablock *b = arena->blocks;
+		arena->blocks = b->next;
+		free(b);
+	}
+}
+
 retvalue filelist_init(struct filelist_list **list) {
 	struct filelist_list *filelist;
 
 	filelist = zNEW(struct filelist_list);
 	if (FAILEDTOALLOC(filelist))
 		return RET_ERROR_OOM;
-	filelist->root = zNEW(struct dirlist);
+	filelist->root = arena_alloc(&filelist->arena, sizeof(struct dirlist));
 	if (FAILEDTOALLOC(filelist->root)) {
 		free(filelist);
 		return RET_ERROR_OOM;
 	}
+	memset(filelist->root, 0, sizeof(struct dirlist));
 	*list = filelist;
 	return RET_OK;
 };
-static void files_free(/*@only@*/struct filelist *list) {
-	if (list == NULL)
-		return;
-	files_free(list->nextl);
-	files_free(list->nextr);
-	free(list->name);
-	free(list);
-}
-static void dirlist_free(/*@only@*/struct dirlist *list) {
-	if (list == NULL)
-		return;
-	files_free(list->files);
-	dirlist_free(list->subdirs);
-	dirlist_free(list->nextl);
-	dirlist_free(list->nextr);
-	free(list);
-}
+
 void filelist_free(struct filelist_list *list) {
 
 	if (list == NULL)
 		return;
-	dirlist_free(list->root);
-	while (list->packages != NULL) {
-		struct filelist_package *package = list->packages;
-		list->packages = package->next;
-		free(package);
-	}
+	arena_done(&list->arena);
+	free(list->packages);
+	free(list->names);
 	free(list);
 };
 
-static retvalue filelist_newpackage(struct filelist_list *filelist, const char *name, const char *section, const struct filelist_package **pkg) {
-	struct filelist_package *p;
+static retvalue filelist_newpackage(struct filelist_list *filelist, const char *name, const char *section, /*@out@*/uint32_t *id_p) {
+	char *p;
 	size_t name_len = strlen(name);
 	size_t section_len = strlen(section);
 
-	p = malloc(sizeof(struct filelist_package)+name_len+section_len+2);
+	if (filelist->packagecount >= filelist->packagesize) {
+		const char **n;
+		uint32_t newsize;
+
+		newsize = (filelist->packagesize == 0) ? 1024
+			: 2 * filelist->packagesize;
+		if (newsize <= filelist->packagesize)
+			return RET_ERROR_OOM;
+		n = realloc(filelist->packages, newsize * sizeof(const char *));
+		if (FAILEDTOALLOC(n))
+			return RET_ERROR_OOM;
+		filelist->packages = n;
+		filelist->packagesize = newsize;
+	}
+	p = arena_alloc(&filelist->arena, name_len + section_len + 2);
 	if (FAILEDTOALLOC(p))
 		return RET_ERROR_OOM;
-	p->next = filelist->packages;
-	memcpy(p->name, section, section_len);
-	p->name[section_len] = '/';
-	memcpy(p->name+section_len+1, name, name_len+1);
-	filelist->packages = p;
-	*pkg = p;
+	memcpy(p, section, section_len);
+	p[section_len] = '/';
+	memcpy(p + section_len + 1, name, name_len + 1);
+	*id_p = filelist->packagecount;
+	filelist->packages[filelist->packagecount++] = p;
 	return RET_OK;
 };
 
-static bool findfile(struct dirlist *parent, const char *packagename, const char *basefilename, size_t namelen) {
+static inline size_t name_hash(const char *name, size_t len) {
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+
+	while (len-- > 0) {
+		hash ^= (unsigned char)*(name++);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* return the one copy of this name */
+static /*@null@*/const char *internname(struct filelist_list *list, const char *name, size_t len) {
+	const char *n;
+	char *copy;
+	size_t i;
+
+	if (2 * (list->namecount + 1) > list->namesize) {
+		const char **t;
+		size_t newsize, j;
+
+		newsize = (list->namesize == 0) ? 4096 : 2 * list->namesize;
+		t = nzNEW(newsize, const char *);
+		if (FAILEDTOALLOC(t))
+			return NULL;
+		for (j = 0 ; j < list->namesize ; j++) {
+			n = list->names[j];
+			if (n == NULL)
+				continue;
+			i = name_hash(n, strlen(n)) & (newsize - 1);
+			while (t[i] != NULL)
+				i = (i + 1) & (newsize - 1);
+			t[i] = n;
+		}
+		free(list->names);
+		list->names = t;
+		list->namesize = newsize;
+	}
+	i = name_hash(name, len) & (list->namesize - 1);
+	while ((n = list->names[i]) != NULL) {
+		if (strncmp(n, name, len) == 0 && n[len] == '\0')
+			return n;
+		i = (i + 1) & (list->namesize - 1);
+	}
+	copy = arena_alloc(&list->arena, len + 1);
+	if (FAILEDTOALLOC(copy))
+		return NULL;
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	list->names[i] = copy;
+	list->namecount++;
+	return copy;
+}
+
+static bool addpackagetofile(struct filelist_list *list, struct filelist *file, uint32_t package) {
+	struct morepackages *m, **last_p;
+
+	last_p = &file->more;
+	while ((m = *last_p) != NULL && m->count >= MOREPACKAGES)
+		last_p = &m->next;
+	if (m == NULL) {
+		m = arena_alloc(&list->arena, sizeof(struct morepackages));
+		if (FAILEDTOALLOC(m))
+			return false;
+		m->next = NULL;
+		m->count = 0;
+		*last_p = m;
+	}
+	m->packages[m->count++] = package;
+	return true;
+}
+
+static bool findfile(struct filelist_list *list, struct dirlist *parent, uint32_t package, const char *basefilename, size_t namelen) {
 	struct filelist *file, *n, *last;
 	struct filelist **stack[128];
 	int stackpointer = 0;
@@ -129,13 +263,7 @@ static bool findfile(struct dirlist *parent, const char *packagename, const char
 	while (file != NULL) {
 		int c = strncmp(basefilename, file->name, namelen);
 		if (c == 0 && file->name[namelen] == '\0') {
-			n = realloc(file, sizeof(struct filelist)+
-					(file->count+1)*sizeof(const char*));
-			if (n == NULL)
-				return false;
-			n->packages[n->count++] = packagename;
-			*(stack[--stackpointer]) = n;
-			return true;
+			return addpackagetofile(list, file, package);
 		} else if (c > 0) {
 			stack[stackpointer++] = &file->nextr;
 			file = file->nextr;
@@ -144,19 +272,17 @@ static bool findfile(struct dirlist *parent, const char *packagename, const char
 			file = file->nextl;
 		}
 	}
-	n = malloc(sizeof(struct filelist)+sizeof(const char*));
+	n = arena_alloc(&list->arena, sizeof(struct filelist));
 	if (FAILEDTOALLOC(n))
 		return false;
-	n->name = strndup(basefilename, namelen);
+	n->name = internname(list, basefilename, namelen);
+	if (FAILEDTOALLOC(n->name))
+		return false;
 	n->nextl = NULL;
 	n->nextr = NULL;
 	n->balance = 0;
-	n->count = 1;
-	n->packages[0] = packagename;
-	if (FAILEDTOALLOC(n->name)) {
-		free(n);
-		return false;
-	}
+	n->package = package;
+	n->more = NULL;
 	*(stack[--stackpointer]) = n;
 	while (stackpointer > 0) {
 		file = *(stack[--stackpointer]);
@@ -237,7 +363,7 @@ static bool findfile(struct dirlist *parent, const char *packagename, const char
 
 typedef const unsigned char cuchar;
 
-static struct dirlist *finddir(struct dirlist *dir, cuchar *name, size_t namelen) {
+static struct dirlist *finddir(struct filelist_list *list, struct dirlist *dir, cuchar *name, size_t namelen) {
 	struct dirlist *d, *this, *parent, *h;
 	struct dirlist **stack[128];
 	int stackpointer = 0;
@@ -271,7 +397,7 @@ static struct dirlist *finddir(struct dirlist *dir, cuchar *name, size_t namelen
 		}
 	}
 	/* not found, create it and rebalance */
-	d = malloc(sizeof(struct dirlist) + namelen);
+	d = arena_alloc(&list->arena, sizeof(struct dirlist) + namelen);
 	if (FAILEDTOALLOC(d))
 		return d;
 	d->subdirs = NULL;
@@ -361,7 +487,7 @@ static struct dirlist *finddir(struct dirlist *dir, cuchar *name, size_t namelen
 	return d;
 }
 
-static retvalue filelist_addfiles(struct filelist_list *list, const struct filelist_package *package, const char *filekey, const char *datastart, size_t size) {
+static retvalue filelist_addfiles(struct filelist_list *list, uint32_t package, const char *filekey, const char *datastart, size_t size) {
 	struct dirlist *curdir = list->root;
 	const unsigned char *data = (const unsigned char *)datastart;
 
@@ -389,7 +515,8 @@ static retvalue filelist_addfiles(struct filelist_list *list, const struct filel
 				return RET_ERROR;
 			}
 			len += *(data++);
-			if (!findfile(curdir, package->name, (const char*)data, len))
+			if (!findfile(list, curdir, package,
+						(const char*)data, len))
 				return RET_ERROR_OOM;
 			 data += len;
 		} else if (d == 2) {
@@ -405,7 +532,7 @@ static retvalue filelist_addfiles(struct filelist_list *list, const struct filel
 				return RET_ERROR;
 			}
 			len += *(data++);
-			curdir = finddir(curdir, data, len);
+			curdir = finddir(list, curdir, data, len);
 			if (FAILEDTOALLOC(curdir))
 				return RET_ERROR_OOM;
 			data += len;
@@ -428,7 +555,7 @@ static retvalue filelist_addfiles(struct filelist_list *list, const struct filel
 }
 
 retvalue filelist_addpackage(struct filelist_list *list, const char *packagename, const char *section, const char *filekey) {
-	const struct filelist_package *package;
+	uint32_t package;
 	char *debfilename, *contents = NULL;
 	retvalue r;
 	const char *c;
@@ -466,43 +593,508 @@ retvalue fakefilelist(const char *filekey) {
 			"", 1, true, false);
 }
 
+/* Extracting file lists from many .deb files is mostly spent in
+ * decompressing, so with --jobs this is done by worker processes.
+ * Only the parent touches the database. */
+
+struct filelistextraction {
+	bool onlymissing;
+	struct workers *workers;
+};
+
+retvalue filelist_store(const char *filekey, const char *filelist, size_t size) {
+	if (verbose > 6) {
+		const char *p = filelist;
+		while (*p != '\0') {
+			(void)putchar(' ');
+			(void)puts(p);
+			p += strlen(p)+1;
+		}
+	}
+	return table_adduniqsizedstring(rdb_contents,
+			filekey, filelist, size, true, true);
+}
+
+static retvalue extractfilelist(UNUSED(void *privdata), const char *filekey, char **filelist_p, size_t *size_p) {
+	char *debfilename;
+	retvalue r;
+
+	debfilename = files_calcfullfilename(filekey);
+	if (FAILEDTOALLOC(debfilename))
+		return RET_ERROR_OOM;
+	r = getfilelist(filelist_p, size_p, debfilename);
+	free(debfilename);
+	return r;
+}
+
+static retvalue storeextracted(void *privdata, const char *filekey, retvalue r, const char *filelist, size_t size) {
+	const struct filelistextraction *x = privdata;
+
+	if (!RET_IS_OK(r))
+		return r;
+	/* rerunfilelists and generatefilelists list every file done */
+	if (!x->onlymissing && verbose > 0)
+		(void)puts(filekey);
+	return filelist_store(filekey, filelist, size);
+}
+
+retvalue filelist_extract_start(struct filelistextraction **x_p, bool onlymissing) {
+	struct filelistextraction *x;
+	retvalue r;
+
+	x = zNEW(struct filelistextraction);
+	if (FAILEDTOALLOC(x))
+		return RET_ERROR_OOM;
+	x->onlymissing = onlymissing;
+	r = workers_start(&x->workers, global.jobs,
+			extractfilelist, storeextracted, x);
+	if (RET_WAS_ERROR(r)) {
+		free(x);
+		return r;
+	}
+	*x_p = x;
+	return RET_OK;
+}
+
+retvalue filelist_extract_add(struct filelistextraction *x, const char *filekey) {
+	if (x->onlymissing) {
+		if (table_recordexists(rdb_contents, filekey))
+			return RET_NOTHING;
+		if (verbose > 3)
+			printf("Reading filelist for %s\n", filekey);
+	}
+	return workers_add(x->workers, filekey);
+}
+
+retvalue filelist_extract_finish(struct filelistextraction *x) {
+	retvalue r;
+
+	r = workers_finish(x->workers);
+	free(x);
+	return r;
+}
+
 static const char header[] = "FILE                                                    LOCATION\n";
 static const char separator_chars[] = "\t    ";
 
-static void filelist_writefiles(char *dir, size_t len,
-		struct filelist *files, struct filetorelease *file) {
-	unsigned int i;
-	bool first;
+/* the Contents file a new one is generated from */
+struct oldcontents {
+	struct compressedfile *f;
+	char *buffer;
+	size_t size, begin, end;
+	/* the current line (without newline), NULL when done */
+	/*@null@*/char *line;
+	size_t pathlen;
+	/* of everything read so far */
+	struct MD5Context context;
+	unsigned long long bytes;
+	filelist_obsoletefunction *isobsolete;
+	void *privdata;
+	/* RET_NOTHING if the file is not usable */
+	retvalue status;
+};
+
+struct contentswriter {
+	struct filetorelease *file;
+	/* to recognize the file again */
+	struct MD5Context context;
+	unsigned long long bytes;
+	/*@null@*/struct oldcontents *old;
+	/* full path of the current file, only used with old */
+	char *path;
+	size_t pathsize;
+	/* the packages of the current line, as they are written sorted
+	 * (so the result does not depend on how the list was built) */
+	struct linepackage {
+		const char *name;
+		size_t len;
+	} *packages;
+	size_t packagecount, packagesize;
+	retvalue status;
+};
+
+static void contents_write(struct contentswriter *w, const char *data, size_t len) {
+	MD5Update(&w->context, (const md5byte *)data, len);
+	w->bytes += len;
+	(void)release_writedata(w->file, data, len);
+}
+#define contents_writestring(w, s) contents_write(w, s, strlen(s))
+
+static void contents_start(struct contentswriter *w, struct filetorelease *file) {
+	memset(w, 0, sizeof(*w));
+	w->file = file;
+	w->status = RET_OK;
+	MD5Init(&w->context);
+	contents_write(w, header, sizeof(header) - 1);
+}
+
+static void line_add(struct contentswriter *w, const char *name, size_t len) {
+	if (w->packagecount >= w->packagesize) {
+		struct linepackage *n;
+		size_t newsize = (w->packagesize == 0) ? 64
+			: 2 * w->packagesize;
 
-	if (files == NULL)
+		n = realloc(w->packages, newsize * sizeof(struct linepackage));
+		if (FAILEDTOALLOC(n)) {
+			w->status = RET_ERROR_OOM;
+			return;
+		}
+		w->packages = n;
+		w->packagesize = newsize;
+	}
+	w->packages[w->packagecount].name = name;
+	w->packages[w->packagecount].len = len;
+	w->packagecount++;
+}
+
+static int linepackage_compare(const void *a, const void *b) {
+	const struct linepackage *p1 = a, *p2 = b;
+	int c;
+
+	c = memcmp(p1->name, p2->name,
+			(p1->len < p2->len) ? p1->len : p2->len);
+	if (c != 0)
+		return c;
+	return (p1->len > p2->len) - (p1->len < p2->len);
+}
+
+/* write a line with the packages collected by line_add,
+ * nothing if there are none */
+static void line_write(struct contentswriter *w, const char *dir, size_t len, const char *name) {
+	size_t i;
+
+	if (w->packagecount == 0)
 		return;
-	filelist_writefiles(dir, len, files->nextl, file);
-	(void)release_writedata(file, dir, len);
-	(void)release_writestring(file, files->name);
-	(void)release_writedata(file, separator_chars,
-			sizeof(separator_chars) - 1);
-	first = true;
-	for (i = 0 ; i < files->count ; i ++) {
-		if (!first)
-			(void)release_writestring(file, ",");
-		first = false;
-		(void)release_writestring(file, files->packages[i]);
-	}
-	(void)release_writestring(file, "\n");
-	filelist_writefiles(dir, len, files->nextr, file);
-}
-
-static retvalue filelist_writedirs(char **buffer_p, size_t *size_p, size_t ofs, struct dirlist *dir, struct filetorelease *file) {
-
-	if (dir->nextl != NULL) {
-		retvalue r;
-		r = filelist_writedirs(buffer_p, size_p, ofs, dir->nextl, file);
-		if (RET_WAS_ERROR(r))
-			return r;
+	qsort(w->packages, w->packagecount, sizeof(struct linepackage),
+			linepackage_compare);
+	contents_write(w, dir, len);
+	contents_writestring(w, name);
+	contents_write(w, separator_chars, sizeof(separator_chars) - 1);
+	for (i = 0 ; i < w->packagecount ; i++) {
+		if (i > 0)
+			contents_write(w, ",", 1);
+		contents_write(w, w->packages[i].name, w->packages[i].len);
+	}
+	contents_write(w, "\n", 1);
+	w->packagecount = 0;
+}
+
+static char *digeststring(struct MD5Context *context, unsigned long long bytes) {
+	unsigned char md5[MD5_DIGEST_SIZE];
+	char hex[2*MD5_DIGEST_SIZE + 1];
+	int i;
+
+	MD5Final(md5, context);
+	for (i = 0 ; i < MD5_DIGEST_SIZE ; i++)
+		sprintf(hex + 2*i, "%02x", (unsigned int)md5[i]);
+	return mprintf("%s %llu", hex, bytes);
+}
+
+/* get the next line of the old file, old->line is NULL at its end */
+static void oldcontents_getline(struct oldcontents *old) {
+	char *nl;
+	int bytes;
+
+	old->line = NULL;
+	while (RET_IS_OK(old->status)) {
+		nl = memchr(old->buffer + old->begin, '\n',
+				old->end - old->begin);
+		if (nl != NULL) {
+			*nl = '\0';
+			old->line = old->buffer + old->begin;
+			old->begin = (nl + 1) - old->buffer;
+			return;
+		}
+		if (old->begin > 0) {
+			memmove(old->buffer, old->buffer + old->begin,
+					old->end - old->begin);
+			old->end -= old->begin;
+			old->begin = 0;
+		}
+		if (old->end >= old->size) {
+			char *n = realloc(old->buffer, 2 * old->size);
+
+			if (FAILEDTOALLOC(n)) {
+				old->status = RET_ERROR_OOM;
+				return;
+			}
+			old->buffer = n;
+			old->size *= 2;
+		}
+		bytes = uncompress_read(old->f, old->buffer + old->end,
+				old->size - old->end);
+		if (bytes < 0) {
+			/* already reported, just do not use it */
+			old->status = RET_NOTHING;
+			return;
+		}
+		if (bytes == 0) {
+			/* files written here always end with a newline */
+			if (old->end > 0)
+				old->status = RET_NOTHING;
+			return;
+		}
+		MD5Update(&old->context,
+				(const md5byte *)old->buffer + old->end, bytes);
+		old->bytes += bytes;
+		old->end += bytes;
+	}
+}
+
+/* get the next line and look where its list of packages starts */
+static void oldcontents_next(struct oldcontents *old) {
+	const char *tab;
+
+	oldcontents_getline(old);
+	if (old->line == NULL)
+		return;
+	/* paths may contain anything, but packages no whitespace */
+	tab = strrchr(old->line, '\t');
+	if (tab == NULL || strncmp(tab, separator_chars,
+				sizeof(separator_chars) - 1) != 0) {
+		old->line = NULL;
+		old->status = RET_NOTHING;
+		return;
+	}
+	old->pathlen = tab - old->line;
+}
+
+/* the next package of the current line that is not obsolete */
+static bool oldcontents_nextpackage(const struct oldcontents *old, const char **p_p, /*@out@*/const char **package_p, /*@out@*/size_t *len_p) {
+	const char *p = *p_p, *e, *n;
+
+	while (*p != '\0') {
+		e = strchr(p, ',');
+		if (e == NULL)
+			e = p + strlen(p);
+		/* listed as section/name */
+		n = e;
+		while (n > p && n[-1] != '/')
+			n--;
+		*package_p = p;
+		*len_p = e - p;
+		p = (*e == ',') ? e + 1 : e;
+		if (!old->isobsolete(n, e - n, old->privdata)) {
+			*p_p = p;
+			return true;
+		}
+	}
+	*p_p = p;
+	return false;
+}
+
+static inline const char *oldcontents_packages(const struct oldcontents *old) {
+	return old->line + old->pathlen + sizeof(separator_chars) - 1;
+}
+
+/* add the packages of the current old line still there */
+static void addoldpackages(struct contentswriter *w) {
+	const char *p, *package;
+	size_t len;
+
+	p = oldcontents_packages(w->old);
+	while (oldcontents_nextpackage(w->old, &p, &package, &len))
+		line_add(w, package, len);
+}
+
+static void writeoldline(struct contentswriter *w) {
+	addoldpackages(w);
+	line_write(w, w->old->line, w->old->pathlen, "");
+}
+
+/* compare paths in the order of Contents files,
+ * i.e. in each directory first its files, then its subdirectories */
+static int contentspathcmp(const char *a, size_t alen, const char *b, size_t blen) {
+	size_t i, start = 0, ea, eb;
+	int c;
+
+	for (i = 0 ; i < alen && i < blen && a[i] == b[i] ; i++) {
+		if (a[i] == '/')
+			start = i + 1;
+	}
+	if (i == alen && i == blen)
+		return 0;
+	for (ea = i ; ea < alen && a[ea] != '/' ; ea++)
+		;
+	for (eb = i ; eb < blen && b[eb] != '/' ; eb++)
+		;
+	if ((ea < alen) != (eb < blen))
+		return (ea < alen) ? 1 : -1;
+	c = memcmp(a + start, b + start, ((ea < eb) ? ea : eb) - start);
+	if (c != 0)
+		return c;
+	return (ea > eb) - (ea < eb);
+}
+
+/* write all old lines before the given file,
+ * returns true if the next one is that file */
+static bool writeoldbefore(struct contentswriter *w, const char *dir, size_t len, const char *name) {
+	struct oldcontents *old = w->old;
+	size_t namelen = strlen(name);
+	int c;
+
+	if (len + namelen >= w->pathsize) {
+		char *n;
+
+		n = realloc(w->path, len + namelen + 1024);
+		if (FAILEDTOALLOC(n)) {
+			old->status = RET_ERROR_OOM;
+			old->line = NULL;
+			return false;
+		}
+		w->path = n;
+		w->pathsize = len + namelen + 1024;
+	}
+	memcpy(w->path, dir, len);
+	memcpy(w->path + len, name, namelen);
+	while (old->line != NULL) {
+		c = contentspathcmp(old->line, old->pathlen,
+				w->path, len + namelen);
+		if (c == 0)
+			return true;
+		if (c > 0)
+			return false;
+		writeoldline(w);
+		oldcontents_next(old);
+	}
+	return false;
+}
+
+/* to walk two trees in parallel, iterate over them in order: */
+
+struct fileiterator {
+	int depth;
+	const struct filelist *stack[128];
+};
+
+static void fileiterator_descend(struct fileiterator *it, /*@null@*/const struct filelist *f) {
+	while (f != NULL) {
+		assert (it->depth < 128);
+		it->stack[it->depth++] = f;
+		f = f->nextl;
+	}
+}
+
+static /*@null@*/const struct filelist *fileiterator_next(struct fileiterator *it) {
+	const struct filelist *f;
+
+	if (it->depth == 0)
+		return NULL;
+	f = it->stack[--it->depth];
+	fileiterator_descend(it, f->nextr);
+	return f;
+}
+
+struct diriterator {
+	int depth;
+	const struct dirlist *stack[128];
+};
+
+static void diriterator_descend(struct diriterator *it, /*@null@*/const struct dirlist *d) {
+	while (d != NULL) {
+		assert (it->depth < 128);
+		it->stack[it->depth++] = d;
+		d = d->nextl;
 	}
-	{	size_t len = dir->len;
-		register retvalue r;
+}
+
+static /*@null@*/const struct dirlist *diriterator_next(struct diriterator *it) {
+	const struct dirlist *d;
 
+	if (it->depth == 0)
+		return NULL;
+	d = it->stack[--it->depth];
+	diriterator_descend(it, d->nextr);
+	return d;
+}
+
+static int dircmp(const struct dirlist *a, const struct dirlist *b) {
+	int c;
+
+	c = memcmp(a->name, b->name, (a->len < b->len) ? a->len : b->len);
+	if (c != 0)
+		return c;
+	return (a->len > b->len) - (a->len < b->len);
+}
+
+static void addpackages(const struct filelist_list *list, const struct filelist *f, struct contentswriter *w) {
+	const struct morepackages *m;
+	const char *package;
+	unsigned int i;
+
+	package = list->packages[f->package];
+	line_add(w, package, strlen(package));
+	for (m = f->more ; m != NULL ; m = m->next) {
+		for (i = 0 ; i < m->count ; i++) {
+			package = list->packages[m->packages[i]];
+			line_add(w, package, strlen(package));
+		}
+	}
+}
+
+/* write the files of a directory in list and shared (either may be NULL) */
+static void filelist_writefiles(const struct filelist_list *list, const struct filelist_list *shared, const char *dir, size_t len, /*@null@*/const struct filelist *files, /*@null@*/const struct filelist *sharedfiles, struct contentswriter *w) {
+	struct fileiterator a, b;
+	const struct filelist *f, *g;
+	const char *name;
+	bool inold;
+	int c;
+
+	a.depth = 0;
+	fileiterator_descend(&a, files);
+	b.depth = 0;
+	fileiterator_descend(&b, sharedfiles);
+	f = fileiterator_next(&a);
+	g = fileiterator_next(&b);
+	while (f != NULL || g != NULL) {
+		if (f == NULL)
+			c = 1;
+		else if (g == NULL)
+			c = -1;
+		else
+			c = strcmp(f->name, g->name);
+		name = (c <= 0) ? f->name : g->name;
+		inold = w->old != NULL && writeoldbefore(w, dir, len, name);
+		if (inold)
+			addoldpackages(w);
+		if (c <= 0)
+			addpackages(list, f, w);
+		if (c >= 0)
+			addpackages(shared, g, w);
+		line_write(w, dir, len, name);
+		/* only now, as the old packages point into its buffer */
+		if (inold)
+			oldcontents_next(w->old);
+		if (c <= 0)
+			f = fileiterator_next(&a);
+		if (c >= 0)
+			g = fileiterator_next(&b);
+	}
+}
+
+static retvalue filelist_writedirs(const struct filelist_list *list, const struct filelist_list *shared, char **buffer_p, size_t *size_p, size_t ofs, /*@null@*/const struct dirlist *dirs, /*@null@*/const struct dirlist *shareddirs, struct contentswriter *w) {
+	struct diriterator a, b;
+	const struct dirlist *d, *e, *dir;
+	retvalue r;
+	int c;
+
+	a.depth = 0;
+	diriterator_descend(&a, dirs);
+	b.depth = 0;
+	diriterator_descend(&b, shareddirs);
+	d = diriterator_next(&a);
+	e = diriterator_next(&b);
+	while (d != NULL || e != NULL) {
+		size_t len;
+
+		if (d == NULL)
+			c = 1;
+		else if (e == NULL)
+			c = -1;
+		else
+			c = dircmp(d, e);
+		dir = (c <= 0) ? d : e;
+		len = dir->len;
 		if (ofs+len+2 >= *size_p) {
 			char *n;
 
@@ -518,21 +1110,24 @@ static retvalue filelist_writedirs(char **buffer_p, size_t *size_p, size_t ofs,
 		memcpy((*buffer_p) + ofs, dir->name, len);
 		(*buffer_p)[ofs + len] = '/';
 		// TODO: output files and directories sorted together instead
-		filelist_writefiles(*buffer_p, ofs+len+1, dir->files, file);
-		if (dir->subdirs == NULL)
-			r = RET_OK;
-		else
-			r = filelist_writedirs(buffer_p, size_p, ofs+len+1,
-					dir->subdirs, file);
-		if (dir->nextr == NULL)
-			return r;
+		filelist_writefiles(list, shared, *buffer_p, ofs+len+1,
+				(c <= 0) ? d->files : NULL,
+				(c >= 0) ? e->files : NULL, w);
+		r = filelist_writedirs(list, shared, buffer_p, size_p,
+				ofs+len+1,
+				(c <= 0) ? d->subdirs : NULL,
+				(c >= 0) ? e->subdirs : NULL, w);
 		if (RET_WAS_ERROR(r))
 			return r;
+		if (c <= 0)
+			d = diriterator_next(&a);
+		if (c >= 0)
+			e = diriterator_next(&b);
 	}
-	return filelist_writedirs(buffer_p, size_p, ofs, dir->nextr, file);
+	return RET_OK;
 }
 
-retvalue filelist_write(struct filelist_list *list, struct filetorelease *file) {
+static retvalue writetree(const struct filelist_list *list, /*@null@*/const struct filelist_list *shared, struct contentswriter *w) {
 	size_t size = 1024;
 	char *buffer = malloc(size);
 	retvalue r;
@@ -540,18 +1135,100 @@ retvalue filelist_write(struct filelist_list *list, struct filetorelease *file)
 	if (FAILEDTOALLOC(buffer))
 		return RET_ERROR_OOM;
 
-	(void)release_writedata(file, header, sizeof(header) - 1);
 	buffer[0] = '\0';
-	filelist_writefiles(buffer, 0, list->root->files, file);
-	if (list->root->subdirs != NULL)
-		r = filelist_writedirs(&buffer, &size, 0,
-				list->root->subdirs, file);
-	else
-		r = RET_OK;
+	filelist_writefiles(list, shared, buffer, 0, list->root->files,
+			(shared != NULL) ? shared->root->files : NULL, w);
+	r = filelist_writedirs(list, shared, &buffer, &size, 0,
+			list->root->subdirs,
+			(shared != NULL) ? shared->root->subdirs : NULL, w);
 	free(buffer);
 	return r;
 }
 
+retvalue filelist_write(const struct filelist_list *list, const struct filelist_list *shared, struct filetorelease *file, char **digest_p) {
+	struct contentswriter w;
+	char *digest;
+	retvalue r;
+
+	contents_start(&w, file);
+	r = writetree(list, shared, &w);
+	free(w.packages);
+	RET_UPDATE(r, w.status);
+	if (RET_WAS_ERROR(r))
+		return r;
+	digest = digeststring(&w.context, w.bytes);
+	if (FAILEDTOALLOC(digest))
+		return RET_ERROR_OOM;
+	*digest_p = digest;
+	return RET_OK;
+}
+
+retvalue filelist_writeupdated(const struct filelist_list *list, const char *oldfilename, enum compression compression, const char *olddigest, filelist_obsoletefunction *isobsolete, void *privdata, struct filetorelease *file, char **digest_p) {
+	struct oldcontents old;
+	struct contentswriter w;
+	char *digest;
+	retvalue r, r2;
+
+	memset(&old, 0, sizeof(old));
+	old.isobsolete = isobsolete;
+	old.privdata = privdata;
+	old.status = RET_OK;
+	old.size = 256*1024;
+	old.buffer = malloc(old.size);
+	if (FAILEDTOALLOC(old.buffer))
+		return RET_ERROR_OOM;
+	MD5Init(&old.context);
+	r = uncompress_open(&old.f, oldfilename, compression);
+	if (RET_WAS_ERROR(r)) {
+		free(old.buffer);
+		return r;
+	}
+	oldcontents_getline(&old);
+	if (old.line != NULL && strncmp(old.line, header,
+				sizeof(header) - 2) == 0 &&
+			old.line[sizeof(header) - 2] == '\0')
+		oldcontents_next(&old);
+	else {
+		old.line = NULL;
+		if (RET_IS_OK(old.status))
+			old.status = RET_NOTHING;
+	}
+
+	contents_start(&w, file);
+	w.old = &old;
+	r = writetree(list, NULL, &w);
+	while (old.line != NULL) {
+		writeoldline(&w);
+		oldcontents_next(&old);
+	}
+	free(w.path);
+	free(w.packages);
+	RET_UPDATE(r, w.status);
+	free(old.buffer);
+	r2 = uncompress_close(old.f);
+	if (RET_WAS_ERROR(r2) && RET_IS_OK(old.status))
+		old.status = RET_NOTHING;
+	RET_UPDATE(r, old.status);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (old.status == RET_NOTHING)
+		return RET_NOTHING;
+
+	digest = digeststring(&old.context, old.bytes);
+	if (FAILEDTOALLOC(digest))
+		return RET_ERROR_OOM;
+	if (strcmp(digest, olddigest) != 0) {
+		free(digest);
+		return RET_NOTHING;
+	}
+	free(digest);
+	digest = digeststring(&w.context, w.bytes);
+	if (FAILEDTOALLOC(digest))
+		return RET_ERROR_OOM;
+	*digest_p = digest;
+	return RET_OK;
+}
+
 /* helpers for filelist generators to get the preprocessed form */
 
 retvalue filelistcompressor_setup(/*@out@*/struct filelistcompressor *c) {
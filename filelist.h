@@ -11,11 +11,32 @@ retvalue filelist_init(struct filelist_list **list);
 
 retvalue filelist_addpackage(struct filelist_list *, const char *package, const char *section, const char *filekey);
 
-retvalue filelist_write(struct filelist_list *list, struct filetorelease *file);
+/* write the list, merged with the (optional) second one,
+ * digest describes the result to recognize it later */
+retvalue filelist_write(const struct filelist_list *, /*@null@*/const struct filelist_list * /*shared*/, struct filetorelease *, /*@out@*/char ** /*digest*/);
+
+/* called with the name of each package in the old file */
+typedef bool filelist_obsoletefunction(const char *, size_t, void *);
+
+/* write the old file (with the given digest) without the obsolete packages
+ * and with the ones in the list added. Returns RET_NOTHING if the old
+ * file is not the expected one, the new file is incomplete then. */
+retvalue filelist_writeupdated(const struct filelist_list *, const char * /*oldfilename*/, enum compression, const char * /*olddigest*/, filelist_obsoletefunction *, void *, struct filetorelease *, /*@out@*/char ** /*digest*/);
 
 void filelist_free(/*@only@*/struct filelist_list *);
 
 retvalue fakefilelist(const char *filekey);
+/* put a list as returned by getfilelist into the cache */
+retvalue filelist_store(const char * /*filekey*/, const char *, size_t);
+
+/* extract the file lists of .deb files into the cache, with up to
+ * global.jobs processes at a time. If onlymissing, files already in
+ * the cache are skipped, otherwise their lists are replaced and the
+ * filekeys printed. */
+struct filelistextraction;
+retvalue filelist_extract_start(/*@out@*/struct filelistextraction **, bool /*onlymissing*/);
+retvalue filelist_extract_add(struct filelistextraction *, const char * /*filekey*/);
+retvalue filelist_extract_finish(/*@only@*/struct filelistextraction *);
 retvalue filelists_translate(struct table *, struct table *);
 
 /* for use in routines reading the data: */
@@ -487,51 +487,36 @@ retvalue files_detect(const char *filekey) {
 	return r;
 }
 
-struct rfd { bool reread; };
+struct rfd {
+	bool reread;
+	struct filelistextraction *extraction;
+};
 
 static retvalue regenerate_filelist(void *data, const char *filekey) {
-	bool reread = ((struct rfd*)data)->reread;
+	struct rfd *d = data;
 	size_t l = strlen(filekey);
-	char *debfilename;
-	char *filelist;
-	size_t fls;
-	retvalue r;
 
 	if (l <= 4 || memcmp(filekey+l-4, ".deb", 4) != 0)
 		return RET_NOTHING;
 
-	if (!reread && !table_recordexists(rdb_contents, filekey))
+	if (!d->reread && !table_recordexists(rdb_contents, filekey))
 		return RET_NOTHING;
 
-	debfilename = files_calcfullfilename(filekey);
-	if (FAILEDTOALLOC(debfilename))
-		return RET_ERROR_OOM;
-
-	r = getfilelist(&filelist, &fls, debfilename);
-	free(debfilename);
-	if (RET_IS_OK(r)) {
-		if (verbose > 0)
-			(void)puts(filekey);
-		if (verbose > 6) {
-			const char *p = filelist;
-			while (*p != '\0') {
-				(void)putchar(' ');
-				(void)puts(p);
-				p += strlen(p)+1;
-			}
-		}
-		r = table_adduniqsizedstring(rdb_contents,
-				filekey, filelist, fls, true, true);
-		free(filelist);
-	}
-	return r;
+	return filelist_extract_add(d->extraction, filekey);
 }
 
 retvalue files_regenerate_filelist(bool reread) {
 	struct rfd d;
+	retvalue result, r;
 
+	r = filelist_extract_start(&d.extraction, false);
+	if (RET_WAS_ERROR(r))
+		return r;
 	d.reread = reread;
-	return files_foreach(regenerate_filelist, &d);
+	result = files_foreach(regenerate_filelist, &d);
+	r = filelist_extract_finish(d.extraction);
+	RET_ENDUPDATE(result, r);
+	return result;
 }
 
 /* Include a yet unknown file into the pool */
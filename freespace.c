@@ -148,7 +148,7 @@ retvalue space_prepare(struct devices **devices, enum spacecheckmode mode, off_t
 	return RET_OK;
 }
 
-retvalue space_needed(struct devices *devices, const char *filename, const struct checksums *checksums) {
+retvalue space_needed(struct devices *devices, const char *filename, const struct checksums *checksums, const char *linkfrom) {
 	size_t l = strlen(filename);
 	char buffer[l+1];
 	struct stat s;
@@ -177,7 +177,17 @@ retvalue space_needed(struct devices *devices, const char *filename, const struc
 	r = device_find_or_create(devices, s.st_dev, buffer, &device);
 	if (RET_WAS_ERROR(r))
 		return r;
+
+	/* a hardlink needs no new blocks */
+	if (linkfrom != NULL && stat(linkfrom, &s) == 0 &&
+			s.st_dev == device->id)
+		return RET_NOTHING;
+
 	filesize = checksums_getfilesize(checksums);
+	/* an earlier partial download to be continued */
+	if (lstat(filename, &s) == 0 && S_ISREG(s.st_mode) &&
+			s.st_size < filesize)
+		filesize -= s.st_size;
 	blocks = (filesize + device->blocksize - 1) / device->blocksize;
 	device->needed += 1 + blocks;
 
@@ -241,3 +251,14 @@ retvalue space_check(struct devices *devices) {
 	}
 	return result;
 }
+
+retvalue space_checkmargins(struct devices *devices) {
+	struct device *device;
+
+	if (devices == NULL)
+		return RET_NOTHING;
+	/* what statvfs(2) says now already includes the files */
+	for (device = devices->root ; device != NULL ; device = device->next)
+		device->needed = 0;
+	return space_check(devices);
+}
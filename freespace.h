@@ -11,9 +11,13 @@ enum spacecheckmode { scm_NONE, /* scm_ASSUMESINGLEFS, */ scm_FULL };
 retvalue space_prepare(/*@out@*/struct devices **, enum spacecheckmode, off_t /*reservedfordb*/, off_t /*reservedforothers*/);
 
 struct checksums;
-retvalue space_needed(/*@null@*/struct devices *, const char * /*filename*/, const struct checksums *);
+/* count the space a file will need, none if it can be hardlinked from
+ * the given file instead */
+retvalue space_needed(/*@null@*/struct devices *, const char * /*filename*/, const struct checksums *, /*@null@*/const char * /*linkfrom*/);
 
 retvalue space_check(/*@null@*/struct devices *);
+/* all needed files are there now, check only the safety margins are left */
+retvalue space_checkmargins(/*@null@*/struct devices *);
 
 void space_free(/*@only@*//*@null@*/struct devices *);
 
@@ -74,12 +74,15 @@ extern struct global_config {
 	const char *logdir;
 	const char *listdir;
 	const char *morguedir;
+	const char *sharedcachedir;
 	/* flags: */
 	bool keepdirectories;
 	bool keeptemporaries;
 	bool onlysmalldeletes;
 	/* verbosity of downloading statistics */
 	int showdownloadpercent;
+	/* number of processes to extract file lists with */
+	long jobs;
 } global;
 
 enum compression { c_none, c_gzip, c_bzip2, c_lzma, c_xz, c_lunzip, c_COUNT };
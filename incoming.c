@@ -28,6 +28,10 @@
 #include <dirent.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/select.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include "error.h"
 #include "ignore.h"
 #include "mprintf.h"
@@ -52,6 +56,10 @@
 #include "configparser.h"
 #include "byhandhook.h"
 #include "changes.h"
+#include "contents.h"
+#include "filelist.h"
+#include "debfile.h"
+#include "workers.h"
 
 enum permitflags {
 	/* do not error out on unused files */
@@ -85,6 +93,27 @@ enum optionsflags {
 	iof_COUNT /* must be last */
 };
 
+/* a file copied to the tempdir by a worker process, before the candidate
+ * using it is looked at */
+struct preparedfile {
+	/* if copying failed, the message was already printed */
+	retvalue result;
+	/* NULL once used */
+	/*@null@*/struct checksums *checksums;
+	/*@null@*/const struct candidate_file *usedby;
+	/* only for .deb and .udeb files: */
+	retvalue controlresult;
+	/*@null@*/char *control, *filelist;
+	size_t filelistsize;
+};
+
+static void preparedfile_free(/*@only@*/struct preparedfile *p) {
+	checksums_free(p->checksums);
+	free(p->control);
+	free(p->filelist);
+	free(p);
+}
+
 struct incoming {
 	/* by incoming_parse: */
 	char *name;
@@ -99,6 +128,10 @@ struct incoming {
 	struct strlist files;
 	bool *processed;
 	bool *delete;
+	/* with --jobs: files already copied by worker processes */
+	/*@null@*/struct preparedfile **prepared;
+	/* leave .changes files alone until all their files are there */
+	bool onlycomplete;
 	bool permit[pmf_COUNT];
 	bool cleanup[cuf_COUNT];
 	bool options[iof_COUNT];
@@ -123,6 +156,7 @@ static void incoming_free(/*@only@*/ struct incoming *i) {
 	strlist_done(&i->files);
 	free(i->processed);
 	free(i->delete);
+	free(i->prepared);
 	free(i);
 }
 
@@ -874,6 +908,7 @@ static retvalue candidate_usefile(const struct incoming *i, const struct candida
 	const char *basefilename;
 	char *origfile, *tempfilename;
 	struct checksums *readchecksums;
+	struct preparedfile *prepared;
 	retvalue r;
 	bool improves;
 	const char *p;
@@ -893,16 +928,29 @@ static retvalue candidate_usefile(const struct incoming *i, const struct candida
 	tempfilename = calc_dirconcat(i->tempdir, basefilename);
 	if (FAILEDTOALLOC(tempfilename))
 		return RET_ERROR_OOM;
-	origfile = calc_dirconcat(i->directory, basefilename);
-	if (FAILEDTOALLOC(origfile)) {
+	prepared = (i->prepared != NULL) ? i->prepared[file->ofs] : NULL;
+	if (prepared != NULL && RET_WAS_ERROR(prepared->result)) {
 		free(tempfilename);
-		return RET_ERROR_OOM;
+		return prepared->result;
 	}
-	r = checksums_copyfile(tempfilename, origfile, true, &readchecksums);
-	free(origfile);
-	if (RET_WAS_ERROR(r)) {
-		free(tempfilename);
-		return r;
+	if (prepared != NULL && prepared->checksums != NULL) {
+		/* already copied to the tempdir by a worker */
+		readchecksums = prepared->checksums;
+		prepared->checksums = NULL;
+		prepared->usedby = file;
+	} else {
+		origfile = calc_dirconcat(i->directory, basefilename);
+		if (FAILEDTOALLOC(origfile)) {
+			free(tempfilename);
+			return RET_ERROR_OOM;
+		}
+		r = checksums_copyfile(tempfilename, origfile, true,
+				&readchecksums);
+		free(origfile);
+		if (RET_WAS_ERROR(r)) {
+			free(tempfilename);
+			return r;
+		}
 	}
 	if (file->checksums == NULL) {
 		file->checksums = readchecksums;
@@ -988,13 +1036,46 @@ static inline retvalue getsectionprioritycomponent(const struct incoming *i, con
 	return RET_OK;
 }
 
+/* if any distribution this might go into generates Contents files
+ * with this type of packages */
+static bool incoming_needsfilelists(const struct incoming *i, packagetype_t packagetype) {
+	int j;
+
+	if (i->default_into != NULL &&
+			contents_needsfilelists(i->default_into, packagetype))
+		return true;
+	for (j = 0 ; j < i->allow.count ; j++) {
+		if (contents_needsfilelists(i->allow_into[j], packagetype))
+			return true;
+	}
+	return false;
+}
+
 static retvalue candidate_read_deb(struct incoming *i, struct candidate *c, struct candidate_file *file) {
 	retvalue r;
 	size_t l;
 	char *base;
 	const char *packagenametocheck;
 
-	r = binaries_readdeb(&file->deb, file->tempfilename, true);
+	if (i->prepared != NULL && i->prepared[file->ofs] != NULL &&
+			i->prepared[file->ofs]->usedby == file) {
+		/* the worker copying it also read the control data */
+		struct preparedfile *prepared = i->prepared[file->ofs];
+
+		i->prepared[file->ofs] = NULL;
+		r = prepared->controlresult;
+		file->deb.control = prepared->control;
+		file->deb.filelist = prepared->filelist;
+		file->deb.filelistsize = prepared->filelistsize;
+		prepared->control = NULL;
+		prepared->filelist = NULL;
+		preparedfile_free(prepared);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	r = binaries_readdeb(&file->deb, file->tempfilename, true,
+			incoming_needsfilelists(i,
+				(file->type == fe_UDEB) ? pt_udeb : pt_deb));
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (strcmp(file->name, file->deb.name) != 0) {
@@ -1093,6 +1174,20 @@ static retvalue candidate_read_files(struct incoming *i, struct candidate *c) {
 	struct candidate_file *file;
 	retvalue r;
 
+	/* let the kernel already read the later files while
+	 * the first ones are copied */
+	for (file = c->files ; file != NULL ; file = file->next) {
+		char *origfile;
+
+		if (file->tempfilename != NULL)
+			continue;
+		origfile = calc_dirconcat(i->directory, BASENAME(i, file->ofs));
+		if (FAILEDTOALLOC(origfile))
+			return RET_ERROR_OOM;
+		checksums_prefetch(origfile);
+		free(origfile);
+	}
+
 	for (file = c->files ; file != NULL ; file = file->next) {
 
 		if (!FE_PACKAGE(file->type))
@@ -1644,6 +1739,16 @@ static retvalue candidate_addfiles(struct candidate *c) {
 						f->checksums);
 				if (RET_WAS_ERROR(r))
 					return r;
+				/* read together with the control data */
+				if (FE_BINARY(f->type) &&
+						f->deb.filelist != NULL) {
+					r = filelist_store(
+						p->filekeys.values[j],
+						f->deb.filelist,
+						f->deb.filelistsize);
+					if (RET_WAS_ERROR(r))
+						return r;
+				}
 			}
 		}
 	}
@@ -2264,21 +2369,96 @@ static retvalue candidate_add(struct incoming *i, struct candidate *c) {
 	return r;
 }
 
-static retvalue process_changes(struct incoming *i, int ofs) {
+/* RET_NOTHING if some file listed is missing or not yet fully there */
+static retvalue candidate_complete(struct incoming *i, const struct candidate *c) {
+	struct strlist filelines;
+	struct stat s;
+	retvalue r;
+	int j;
+
+	r = chunk_getextralinelist(c->control,
+			changes_checksum_names[cs_md5sum], &filelines);
+	if (!RET_IS_OK(r))
+		/* RET_NOTHING is complained about when parsing it */
+		return (r == RET_NOTHING) ? RET_OK : r;
+	for (j = 0 ; j < filelines.count ; j++) {
+		filetype type;
+		char *basefilename, *section, *priority, *name, *fullfilename;
+		architecture_t architecture;
+		struct hash_data md5sum, size;
+		unsigned long long expected = 0;
+		size_t k;
+
+		r = changes_parsefileline(filelines.values[j], &type,
+				&basefilename, &md5sum, &size,
+				&section, &priority, &architecture, &name);
+		if (RET_WAS_ERROR(r)) {
+			strlist_done(&filelines);
+			/* other errors are complained about when parsing it */
+			return (r == RET_ERROR_OOM) ? r : RET_OK;
+		}
+		free(section);
+		free(priority);
+		free(name);
+		for (k = 0 ; k < size.len ; k++)
+			expected = 10 * expected + (size.start[k] - '0');
+		if (strlist_ofs(&i->files, basefilename) < 0)
+			r = RET_NOTHING;
+		else {
+			fullfilename = calc_dirconcat(i->directory,
+					basefilename);
+			if (FAILEDTOALLOC(fullfilename))
+				r = RET_ERROR_OOM;
+			else if (stat(fullfilename, &s) != 0 ||
+					(unsigned long long)s.st_size < expected)
+				r = RET_NOTHING;
+			free(fullfilename);
+		}
+		if (r == RET_NOTHING && verbose > 0)
+			printf("Leaving '%s' alone for now, as '%s' is not "
+					"yet completely there.\n",
+					BASENAME(i, c->ofs), basefilename);
+		free(basefilename);
+		if (!RET_IS_OK(r)) {
+			strlist_done(&filelines);
+			return r;
+		}
+	}
+	strlist_done(&filelines);
+	return RET_OK;
+}
+
+static retvalue candidate_open(struct incoming *i, int ofs, /*@out@*/struct candidate **candidate_p, /*@out@*/bool *broken_p) {
 	struct candidate *c;
 	retvalue r;
-	int j, k;
-	bool broken = false, tried = false;
 
-	r = candidate_read(i, ofs, &c, &broken);
+	*broken_p = false;
+	r = candidate_read(i, ofs, &c, broken_p);
 	if (RET_WAS_ERROR(r))
 		return r;
 	assert (RET_IS_OK(r));
+	if (i->onlycomplete) {
+		r = candidate_complete(i, c);
+		if (!RET_IS_OK(r)) {
+			candidate_free(c);
+			return r;
+		}
+	}
 	r = candidate_parse(i, c);
 	if (RET_WAS_ERROR(r)) {
 		candidate_free(c);
 		return r;
 	}
+	*candidate_p = c;
+	return RET_OK;
+}
+
+static retvalue candidate_process(struct incoming *i, /*@only@*/struct candidate *c, bool broken) {
+	int ofs = c->ofs;
+	retvalue r;
+	int j, k;
+	bool tried = false;
+
 	r = candidate_earlychecks(i, c);
 	if (RET_WAS_ERROR(r)) {
 		if (i->cleanup[cuf_on_error]) {
@@ -2370,6 +2550,270 @@ static retvalue process_changes(struct incoming *i, int ofs) {
 	return r;
 }
 
+static retvalue process_changes(struct incoming *i, int ofs) {
+	struct candidate *c;
+	retvalue r;
+	bool broken;
+
+	r = candidate_open(i, ofs, &c, &broken);
+	if (!RET_IS_OK(r))
+		return r;
+	return candidate_process(i, c, broken);
+}
+
+/* With --jobs the files of some .changes files are copied into the tempdir
+ * (and the control data of .debs read) by worker processes, before each
+ * of them is looked at and added one after the other as usual.
+ * A job is the number of the file and what else to read, the reply
+ * a struct preparedreply followed by the data. */
+
+struct preparedreply {
+	int controlresult;
+	size_t checksumslen, controllen, filelistlen;
+};
+
+static retvalue preparefile(void *data, const char *job, char **reply_p, size_t *size_p) {
+	struct incoming *i = data;
+	struct preparedreply reply;
+	struct checksums *checksums;
+	char *tempfilename, *origfile, *control = NULL, *filelist = NULL;
+	const char *combined;
+	char what, *p;
+	int ofs;
+	retvalue r;
+
+	if (sscanf(job, "%d %c", &ofs, &what) != 2 ||
+			ofs < 0 || ofs >= i->files.count)
+		return RET_ERROR_INTERNAL;
+	tempfilename = calc_dirconcat(i->tempdir, BASENAME(i, ofs));
+	if (FAILEDTOALLOC(tempfilename))
+		return RET_ERROR_OOM;
+	origfile = calc_dirconcat(i->directory, BASENAME(i, ofs));
+	if (FAILEDTOALLOC(origfile)) {
+		free(tempfilename);
+		return RET_ERROR_OOM;
+	}
+	r = checksums_copyfile(tempfilename, origfile, true, &checksums);
+	free(origfile);
+	if (RET_WAS_ERROR(r)) {
+		free(tempfilename);
+		return r;
+	}
+	setzero(struct preparedreply, &reply);
+	reply.controlresult = RET_NOTHING;
+	if (what == 'l')
+		reply.controlresult = extractcontrolandfilelist(&control,
+				&filelist, &reply.filelistlen, tempfilename);
+	else if (what == 'c')
+		reply.controlresult = extractcontrol(&control, tempfilename);
+	free(tempfilename);
+	if (!RET_IS_OK(reply.controlresult)) {
+		control = NULL;
+		filelist = NULL;
+	}
+	if (control != NULL)
+		reply.controllen = strlen(control) + 1;
+	if (filelist == NULL)
+		reply.filelistlen = 0;
+	r = checksums_getcombined(checksums, &combined, &reply.checksumslen);
+	if (RET_IS_OK(r)) {
+		*size_p = sizeof(reply) + reply.checksumslen +
+			reply.controllen + reply.filelistlen;
+		p = malloc(*size_p);
+		if (FAILEDTOALLOC(p))
+			r = RET_ERROR_OOM;
+		else {
+			*reply_p = p;
+			memcpy(p, &reply, sizeof(reply));
+			p += sizeof(reply);
+			memcpy(p, combined, reply.checksumslen);
+			p += reply.checksumslen;
+			if (control != NULL)
+				memcpy(p, control, reply.controllen);
+			p += reply.controllen;
+			if (filelist != NULL)
+				memcpy(p, filelist, reply.filelistlen);
+		}
+	}
+	checksums_free(checksums);
+	free(control);
+	free(filelist);
+	return r;
+}
+
+static retvalue preparedfile(void *data, const char *job, retvalue r, const char *reply, size_t size) {
+	struct incoming *i = data;
+	struct preparedfile *prepared;
+	struct preparedreply header;
+	int ofs;
+
+	if (sscanf(job, "%d", &ofs) != 1 || ofs < 0 || ofs >= i->files.count)
+		return RET_ERROR_INTERNAL;
+	assert (i->prepared[ofs] == NULL);
+	prepared = zNEW(struct preparedfile);
+	if (FAILEDTOALLOC(prepared))
+		return RET_ERROR_OOM;
+	prepared->result = r;
+	if (RET_IS_OK(r) && size < sizeof(header))
+		prepared->result = RET_ERROR_INTERNAL;
+	if (!RET_IS_OK(prepared->result)) {
+		i->prepared[ofs] = prepared;
+		/* this is reported when the file is used */
+		return RET_NOTHING;
+	}
+	memcpy(&header, reply, sizeof(header));
+	assert (size == sizeof(header) + header.checksumslen +
+			header.controllen + header.filelistlen);
+	reply += sizeof(header);
+	r = checksums_setall(&prepared->checksums, reply, header.checksumslen);
+	reply += header.checksumslen;
+	prepared->controlresult = header.controlresult;
+	if (RET_IS_OK(r) && header.controllen > 0) {
+		prepared->control = strndup(reply, header.controllen - 1);
+		if (FAILEDTOALLOC(prepared->control))
+			r = RET_ERROR_OOM;
+	}
+	reply += header.controllen;
+	if (RET_IS_OK(r) && header.filelistlen > 0) {
+		prepared->filelist = malloc(header.filelistlen);
+		if (FAILEDTOALLOC(prepared->filelist))
+			r = RET_ERROR_OOM;
+		else
+			memcpy(prepared->filelist, reply, header.filelistlen);
+		prepared->filelistsize = header.filelistlen;
+	}
+	if (RET_WAS_ERROR(r)) {
+		/* let the file be copied again later */
+		preparedfile_free(prepared);
+		return r;
+	}
+	i->prepared[ofs] = prepared;
+	return RET_OK;
+}
+
+static retvalue prepare_files(struct incoming *i, struct candidate **candidates, int count) {
+	struct candidate_file *file;
+	struct workers *workers;
+	bool *queued;
+	char job[30];
+	retvalue result, r;
+	int k;
+
+	queued = nzNEW(i->files.count, bool);
+	if (FAILEDTOALLOC(queued))
+		return RET_ERROR_OOM;
+	/* those are already in the tempdir */
+	for (k = 0 ; k < count ; k++) {
+		if (candidates[k] != NULL)
+			queued[candidates[k]->ofs] = true;
+	}
+	r = workers_start(&workers, global.jobs,
+			preparefile, preparedfile, i);
+	if (RET_WAS_ERROR(r)) {
+		free(queued);
+		return r;
+	}
+	result = RET_NOTHING;
+	for (k = 0 ; k < count ; k++) {
+		if (candidates[k] == NULL)
+			continue;
+		for (file = candidates[k]->files ; file != NULL ;
+		                                   file = file->next) {
+			const char *p;
+			char what = '-';
+
+			if (queued[file->ofs] || file->tempfilename != NULL)
+				continue;
+			queued[file->ofs] = true;
+			for (p = BASENAME(i, file->ofs) ; *p != '\0' ; p++) {
+				if ((0x80 & *(const unsigned char *)p) != 0)
+					break;
+			}
+			if (*p != '\0')
+				/* will be rejected when looking at it */
+				continue;
+			if (FE_BINARY(file->type))
+				what = incoming_needsfilelists(i,
+					(file->type == fe_UDEB) ?
+					pt_udeb : pt_deb) ? 'l' : 'c';
+			snprintf(job, sizeof(job), "%d %c", file->ofs, what);
+			r = workers_add(workers, job);
+			RET_UPDATE(result, r);
+			if (r == RET_ERROR_OOM || r == RET_ERROR_INTERRUPTED)
+				break;
+		}
+	}
+	r = workers_finish(workers);
+	RET_UPDATE(result, r);
+	free(queued);
+	return result;
+}
+
+/* remove what was copied but not used */
+static void preparedfiles_done(struct incoming *i) {
+	int j;
+
+	for (j = 0 ; j < i->files.count ; j++) {
+		struct preparedfile *prepared = i->prepared[j];
+
+		if (prepared == NULL)
+			continue;
+		i->prepared[j] = NULL;
+		if (RET_IS_OK(prepared->result) && prepared->usedby == NULL) {
+			char *tempfilename;
+
+			tempfilename = calc_dirconcat(i->tempdir,
+					BASENAME(i, j));
+			if (!FAILEDTOALLOC(tempfilename))
+				(void)unlink(tempfilename);
+			free(tempfilename);
+		}
+		preparedfile_free(prepared);
+	}
+}
+
+static retvalue process_changesbatch(struct incoming *i, const int *ofs, int count) {
+	struct candidate **candidates;
+	bool *broken;
+	retvalue result, r;
+	int k;
+
+	candidates = nzNEW(count, struct candidate *);
+	if (FAILEDTOALLOC(candidates))
+		return RET_ERROR_OOM;
+	broken = nzNEW(count, bool);
+	if (FAILEDTOALLOC(broken)) {
+		free(candidates);
+		return RET_ERROR_OOM;
+	}
+	result = RET_NOTHING;
+	for (k = 0 ; k < count ; k++) {
+		r = candidate_open(i, ofs[k], &candidates[k], &broken[k]);
+		RET_UPDATE(result, r);
+		if (!RET_IS_OK(r))
+			candidates[k] = NULL;
+	}
+	/* if that fails, the files are just copied the normal way */
+	r = prepare_files(i, candidates, count);
+	if (r == RET_ERROR_OOM || r == RET_ERROR_INTERRUPTED)
+		RET_UPDATE(result, r);
+	for (k = 0 ; k < count ; k++) {
+		if (candidates[k] == NULL)
+			continue;
+		if (interrupted()) {
+			RET_UPDATE(result, RET_ERROR_INTERRUPTED);
+			candidate_free(candidates[k]);
+			continue;
+		}
+		r = candidate_process(i, candidates[k], broken[k]);
+		RET_UPDATE(result, r);
+	}
+	preparedfiles_done(i);
+	free(broken);
+	free(candidates);
+	return result;
+}
+
 static inline /*@null@*/char *create_uniq_subdir(const char *basedir) {
 	char date[16], *dir;
 	unsigned long number = 0;
@@ -2410,10 +2854,10 @@ static inline /*@null@*/char *create_uniq_subdir(const char *basedir) {
 }
 
 /* tempdir should ideally be on the same partition like the pooldir */
-retvalue process_incoming(struct distribution *distributions, const char *name, const char *changesfilename) {
+retvalue process_incoming(struct distribution *distributions, const char *name, const char *changesfilename, bool onlycomplete) {
 	struct incoming *i;
 	retvalue result, r;
-	int j;
+	int j, *batch = NULL, batchsize = 0;
 	char *morguedir;
 
 	result = RET_NOTHING;
@@ -2421,7 +2865,17 @@ retvalue process_incoming(struct distribution *distributions, const char *name,
 	r = incoming_init(distributions, name, &i);
 	if (RET_WAS_ERROR(r))
 		return r;
+	i->onlycomplete = onlycomplete;
 
+	if (global.jobs > 1) {
+		batch = nNEW(global.jobs, int);
+		i->prepared = nzNEW(i->files.count, struct preparedfile *);
+		if (FAILEDTOALLOC(batch) || FAILEDTOALLOC(i->prepared)) {
+			free(batch);
+			incoming_free(i);
+			return RET_ERROR_OOM;
+		}
+	}
 	for (j = 0 ; j < i->files.count ; j ++) {
 		const char *basefilename = i->files.values[j];
 		size_t l = strlen(basefilename);
@@ -2433,9 +2887,23 @@ retvalue process_incoming(struct distribution *distributions, const char *name,
 		if (changesfilename != NULL && strcmp(basefilename, changesfilename) != 0)
 			continue;
 		/* a .changes file, check it */
-		r = process_changes(i, j);
+		if (batch == NULL) {
+			r = process_changes(i, j);
+			RET_UPDATE(result, r);
+			continue;
+		}
+		batch[batchsize++] = j;
+		if (batchsize < global.jobs)
+			continue;
+		r = process_changesbatch(i, batch, batchsize);
 		RET_UPDATE(result, r);
+		batchsize = 0;
 	}
+	if (batchsize > 0) {
+		r = process_changesbatch(i, batch, batchsize);
+		RET_UPDATE(result, r);
+	}
+	free(batch);
 
 	logger_wait();
 	if (i->morguedir == NULL)
@@ -2489,3 +2957,188 @@ retvalue process_incoming(struct distribution *distributions, const char *name,
 	incoming_free(i);
 	return result;
 }
+
+/* for incomingd: wait till something was put into the IncomingDir,
+ * then till nothing more arrived for some seconds (but not too long),
+ * so that a whole upload is looked at at once: */
+
+#define INCOMINGD_QUIET 5
+#define INCOMINGD_MAXDELAY 60
+
+struct incomingwatch {
+	char *directory;
+#ifdef HAVE_SYS_INOTIFY_H
+	int fd;
+#else
+	time_t mtime;
+#endif
+};
+
+void incomingwatch_free(struct incomingwatch *w) {
+	if (w == NULL)
+		return;
+#ifdef HAVE_SYS_INOTIFY_H
+	if (w->fd >= 0)
+		(void)close(w->fd);
+#endif
+	free(w->directory);
+	free(w);
+}
+
+retvalue incomingwatch_start(struct distribution *distributions, const char *name, struct incomingwatch **watch_p) {
+	struct incomingwatch *w;
+	struct incoming *i;
+	retvalue r;
+#ifndef HAVE_SYS_INOTIFY_H
+	struct stat s;
+#endif
+
+	r = incoming_init(distributions, name, &i);
+	if (RET_WAS_ERROR(r))
+		return r;
+	w = zNEW(struct incomingwatch);
+	if (FAILEDTOALLOC(w)) {
+		incoming_free(i);
+		return RET_ERROR_OOM;
+	}
+	w->directory = i->directory;
+	i->directory = NULL;
+	incoming_free(i);
+#ifdef HAVE_SYS_INOTIFY_H
+	w->fd = inotify_init1(IN_CLOEXEC);
+	if (w->fd < 0 || inotify_add_watch(w->fd, w->directory,
+				IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVE_SELF|
+				IN_ONLYDIR) < 0) {
+		int e = errno;
+
+		fprintf(stderr, "Error %d watching '%s': %s\n",
+				e, w->directory, strerror(e));
+		incomingwatch_free(w);
+		return RET_ERRNO(e);
+	}
+#else
+	if (stat(w->directory, &s) != 0) {
+		int e = errno;
+
+		fprintf(stderr, "Error %d looking at '%s': %s\n",
+				e, w->directory, strerror(e));
+		incomingwatch_free(w);
+		return RET_ERRNO(e);
+	}
+	w->mtime = s.st_mtime;
+	if (verbose > 1)
+		printf(
+"No inotify support compiled in, looking at '%s' every %d seconds.\n",
+				w->directory, INCOMINGD_QUIET);
+#endif
+	*watch_p = w;
+	return RET_OK;
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* RET_OK if some file arrived */
+static retvalue readevents(struct incomingwatch *w) {
+	char buffer[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	retvalue result = RET_NOTHING;
+	ssize_t got;
+	char *p;
+
+	got = read(w->fd, buffer, sizeof(buffer));
+	if (got < 0) {
+		int e = errno;
+
+		if (e == EINTR || e == EAGAIN)
+			return RET_NOTHING;
+		fprintf(stderr, "Error %d watching '%s': %s\n",
+				e, w->directory, strerror(e));
+		return RET_ERRNO(e);
+	}
+	for (p = buffer ; p < buffer + got ;
+			p += sizeof(struct inotify_event) + event->len) {
+		event = (const struct inotify_event *)p;
+
+		if ((event->mask & (IN_IGNORED|IN_MOVE_SELF)) != 0) {
+			fprintf(stderr,
+"'%s' was moved or deleted, no longer watching it!\n", w->directory);
+			return RET_ERROR;
+		}
+		/* files starting with a dot are ignored anyway */
+		if ((event->mask & IN_Q_OVERFLOW) != 0 ||
+				(event->len > 0 && event->name[0] != '.'))
+			result = RET_OK;
+	}
+	return result;
+}
+
+retvalue incomingwatch_wait(struct incomingwatch *w) {
+	time_t first = 0, now;
+	struct timeval timeout;
+	fd_set readfds;
+	retvalue r;
+	int n;
+
+	while (!interrupted()) {
+		FD_ZERO(&readfds);
+		FD_SET(w->fd, &readfds);
+		if (first != 0) {
+			now = time(NULL);
+			if (now - first >= INCOMINGD_MAXDELAY)
+				return RET_OK;
+			timeout.tv_sec = first + INCOMINGD_MAXDELAY - now;
+			if (timeout.tv_sec > INCOMINGD_QUIET)
+				timeout.tv_sec = INCOMINGD_QUIET;
+			timeout.tv_usec = 0;
+		}
+		n = select(w->fd + 1, &readfds, NULL, NULL,
+				(first == 0) ? NULL : &timeout);
+		if (n < 0) {
+			int e = errno;
+
+			if (e == EINTR)
+				continue;
+			fprintf(stderr, "Error %d from select: %s\n",
+					e, strerror(e));
+			return RET_ERRNO(e);
+		}
+		if (n == 0)
+			/* nothing new for some time */
+			return RET_OK;
+		r = readevents(w);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (RET_IS_OK(r) && first == 0)
+			first = time(NULL);
+	}
+	return RET_ERROR_INTERRUPTED;
+}
+#else
+retvalue incomingwatch_wait(struct incomingwatch *w) {
+	time_t first = 0;
+	struct stat s;
+	unsigned int timetosleep;
+
+	while (!interrupted()) {
+		timetosleep = INCOMINGD_QUIET;
+		while (timetosleep > 0 && !interrupted())
+			timetosleep = sleep(timetosleep);
+		if (stat(w->directory, &s) != 0) {
+			int e = errno;
+
+			fprintf(stderr, "Error %d looking at '%s': %s\n",
+					e, w->directory, strerror(e));
+			return RET_ERRNO(e);
+		}
+		if (s.st_mtime != w->mtime) {
+			w->mtime = s.st_mtime;
+			if (first == 0)
+				first = time(NULL);
+			else if (time(NULL) - first >= INCOMINGD_MAXDELAY)
+				return RET_OK;
+		} else if (first != 0)
+			return RET_OK;
+	}
+	return RET_ERROR_INTERRUPTED;
+}
+#endif
@@ -6,5 +6,12 @@
 #warning "What's hapening here?"
 #endif
 
-retvalue process_incoming(struct distribution *distributions, const char *name, /*@null@*/const char *onlychangesfilename);
+retvalue process_incoming(struct distribution *distributions, const char *name, /*@null@*/const char *onlychangesfilename, bool /*onlycomplete*/);
+
+/* waiting for new files in the IncomingDir of a rule */
+struct incomingwatch;
+retvalue incomingwatch_start(struct distribution *, const char * /*name*/, /*@out@*/struct incomingwatch **);
+/* RET_OK once some files arrived and nothing more for some seconds */
+retvalue incomingwatch_wait(struct incomingwatch *);
+void incomingwatch_free(/*@only@*/struct incomingwatch *);
 #endif
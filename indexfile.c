@@ -184,6 +184,17 @@ static retvalue indexfile_get(struct indexfile *f) {
 	return RET_OK;
 }
 
+/* the next chunk as it is, without parsing or checking anything */
+retvalue indexfile_getnextchunk(struct indexfile *f, const char **control_p) {
+	retvalue r;
+
+	f->startlinenumber = f->linenumber + 1;
+	r = indexfile_get(f);
+	if (RET_IS_OK(r))
+		*control_p = f->buffer;
+	return r;
+}
+
 bool indexfile_getnext(struct indexfile *f, char **name_p, char **version_p, const char **control_p, architecture_t *architecture_p, const struct target *target, bool allowwrongarchitecture) {
 	retvalue r;
 	bool ignorecruft = false; // TODO
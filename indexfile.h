@@ -13,6 +13,7 @@ struct indexfile;
 
 retvalue indexfile_open(/*@out@*/struct indexfile **, const char *, enum compression);
 retvalue indexfile_close(/*@only@*/struct indexfile *);
+retvalue indexfile_getnextchunk(struct indexfile *, /*@out@*/const char **);
 bool indexfile_getnext(struct indexfile *, /*@out@*/char **, /*@out@*/char **, /*@out@*/const char **, /*@out@*/ architecture_t *, const struct target *, bool allowwrongarchitecture);
 
 #endif
@@ -74,6 +74,8 @@
 #include "filterlist.h"
 #include "descriptions.h"
 #include "outhook.h"
+#include "morgue.h"
+#include "sharedcache.h"
 #include "packagedata.h"
 
 #ifndef STD_BASE_DIR
@@ -100,6 +102,7 @@ static char /*@only@*/ /*@notnull@*/ // *g*
 	*x_confdir = NULL,
 	*x_logdir = NULL,
 	*x_morguedir = NULL,
+	*x_sharedcachedir = NULL,
 	*x_methoddir = NULL;
 static char /*@only@*/ /*@null@*/
 	*x_section = NULL,
@@ -137,12 +140,17 @@ static enum spacecheckmode spacecheckmode = scm_FULL;
 static off_t reserveddbspace = 1024*1024*100
 /* 1MB safety margin for other filesystems */;
 static off_t reservedotherspace = 1024*1024;
+/* limits for the morgue, 0 means none */
+static off_t morguemaxsize = 0;
+static time_t morguemaxage = 0;
+/* limit for the shared cache, 0 means none */
+static off_t sharedcachemaxsize = 0;
 
 /* define for each config value an owner, and only higher owners are allowed
  * to change something owned by lower owners. */
 enum config_option_owner config_state,
 #define O(x) owner_ ## x = CONFIG_OWNER_DEFAULT
-O(fast), O(x_morguedir), O(x_outdir), O(x_basedir), O(x_distdir), O(x_dbdir), O(x_listdir), O(x_confdir), O(x_logdir), O(x_methoddir), O(x_section), O(x_priority), O(x_component), O(x_architecture), O(x_packagetype), O(nothingiserror), O(nolistsdownload), O(keepunusednew), O(keepunreferenced), O(keeptemporaries), O(keepdirectories), O(askforpassphrase), O(skipold), O(export), O(waitforlock), O(spacecheckmode), O(reserveddbspace), O(reservedotherspace), O(guessgpgtty), O(verbosedatabase), O(gunzip), O(bunzip2), O(unlzma), O(unxz), O(lunzip), O(gnupghome), O(listformat), O(listmax), O(listskip), O(onlysmalldeletes), O(endhook), O(outhook);
+O(fast), O(x_morguedir), O(x_outdir), O(x_basedir), O(x_distdir), O(x_dbdir), O(x_listdir), O(x_confdir), O(x_logdir), O(x_methoddir), O(x_section), O(x_priority), O(x_component), O(x_architecture), O(x_packagetype), O(nothingiserror), O(nolistsdownload), O(keepunusednew), O(keepunreferenced), O(keeptemporaries), O(keepdirectories), O(askforpassphrase), O(skipold), O(export), O(waitforlock), O(spacecheckmode), O(reserveddbspace), O(reservedotherspace), O(guessgpgtty), O(verbosedatabase), O(gunzip), O(bunzip2), O(unlzma), O(unxz), O(lunzip), O(gnupghome), O(listformat), O(listmax), O(listskip), O(onlysmalldeletes), O(endhook), O(outhook), O(morguemaxsize), O(morguemaxage), O(x_sharedcachedir), O(sharedcachemaxsize), O(jobs);
 #undef O
 
 #define CONFIGSET(variable, value) if (owner_ ## variable <= config_state) { \
@@ -564,8 +572,6 @@ static retvalue deleteifunreferenced(UNUSED(void *data), const char *filekey) {
 }
 
 ACTION_RF(n, n, n, n, deleteunreferenced) {
-	retvalue result;
-
 	if (keepunreferenced) {
 		if (owner_keepunreferenced == CONFIG_OWNER_CMDLINE)
 			fprintf(stderr,
@@ -578,8 +584,7 @@ ACTION_RF(n, n, n, n, deleteunreferenced) {
 "if you are sure you want to delete those files.\n");
 		return RET_ERROR;
 	}
-	result = files_foreach(deleteifunreferenced, NULL);
-	return result;
+	return pool_deleteunreferenced();
 }
 
 ACTION_RF(n, n, n, y, deleteifunreferenced) {
@@ -613,6 +618,20 @@ ACTION_RF(n, n, n, y, deleteifunreferenced) {
 	return ret;
 }
 
+ACTION_T(n, n, gcmorgue) {
+	if (global.morguedir == NULL) {
+		fprintf(stderr,
+"Error: gcmorgue needs a morgue directory set with --morguedir!\n");
+		return RET_ERROR;
+	}
+	if (morguemaxsize == 0 && morguemaxage == 0) {
+		fprintf(stderr,
+"Error: gcmorgue needs --morguemaxsize or --morguemaxage to know what to delete!\n");
+		return RET_ERROR;
+	}
+	return morgue_gc(morguemaxsize, morguemaxage);
+}
+
 ACTION_R(n, n, n, y, addreference) {
 	assert (argc == 2 || argc == 3);
 	return references_increment(argv[1], argv[2]);
@@ -3647,7 +3666,57 @@ ACTION_D(n, n, y, processincoming) {
 		d->selected = true;
 
 	return process_incoming(alldistributions, argv[1],
-			(argc==3) ? argv[2] : NULL);
+			(argc==3) ? argv[2] : NULL, false);
+}
+/***********************incomingd********************************/
+static retvalue action_finish(struct distribution *, retvalue, bool, bool);
+
+ACTION_D(n, n, y, incomingd) {
+	struct distribution *d;
+	struct incomingwatch *watch;
+	retvalue result, r;
+
+	for (d = alldistributions ; d != NULL ; d = d->next)
+		d->selected = true;
+
+	result = incomingwatch_start(alldistributions, argv[1], &watch);
+	if (RET_WAS_ERROR(result))
+		return result;
+	/* first look at what arrived while not running */
+	while (!RET_WAS_ERROR(result)) {
+		r = process_incoming(alldistributions, argv[1], NULL, true);
+		if (r == RET_ERROR_OOM || interrupted()) {
+			result = r;
+			break;
+		}
+		if (r != RET_NOTHING) {
+			/* the same as if processincoming had been called */
+			r = action_finish(alldistributions, r,
+					!keepunreferenced, !keepunusednew);
+			if (RET_WAS_ERROR(r) && verbose >= 0)
+				fprintf(stderr,
+"There have been errors, continuing to wait for new files...\n");
+			/* the morgue and shared cache were cleaned up,
+			 * only look at them again after new additions */
+			morgue_haveadded = false;
+			sharedcache_haveadded = false;
+			r = database_sync();
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+			distribution_forgetstatus(alldistributions);
+			pool_free();
+			if (outhook != NULL) {
+				result = outhook_start();
+				if (RET_WAS_ERROR(result))
+					break;
+			}
+		}
+		result = incomingwatch_wait(watch);
+	}
+	incomingwatch_free(watch);
+	return result;
 }
 /***********************gensnapshot********************************/
 ACTION_R(n, n, y, y, gensnapshot) {
@@ -3951,6 +4020,8 @@ static const struct action {
 		0, -1, "deleteifunreferenced"},
 	{"deleteunreferenced", 	A_RF(deleteunreferenced),
 		0, 0, "deleteunreferenced", },
+	{"gcmorgue",	 	A__T(gcmorgue),
+		0, 0, "[--morguemaxsize <bytes>] [--morguemaxage <days>] gcmorgue", },
 	{"retrack",	 	A_D(retrack),
 		0, -1, "retrack [<distributions>]"},
 	{"dumptracks",	 	A_ROB(dumptracks)|MAY_UNUSED,
@@ -4013,6 +4084,8 @@ static const struct action {
 		0, 0, "[--delete] clearvanished"},
 	{"processincoming",	A_D(processincoming)|NEED_DELNEW,
 		1, 2, "processincoming <rule-name> [<.changes file>]"},
+	{"incomingd",		A_D(incomingd)|NEED_DELNEW,
+		1, 1, "incomingd <rule-name>"},
 	{"gensnapshot",		A_R(gensnapshot),
 		2, 2, "gensnapshot <distribution> <date or other name>"},
 	{"rerunnotifiers",	A_Bact(rerunnotifiers),
@@ -4041,6 +4114,65 @@ static const struct action {
 #undef A_F
 #undef A__T
 
+/* everything to do after an action changed the repository */
+static retvalue action_finish(struct distribution *alldistributions, retvalue result, bool deletederef, bool deletenew) {
+	retvalue r;
+
+	/* wait for package specific loggers */
+	logger_wait();
+
+	/* remove files added but not used */
+	pool_tidyadded(deletenew);
+
+	/* tell an outhook about added files */
+	if (outhook != NULL)
+		pool_sendnewfiles();
+	/* export changed/lookedat distributions */
+	if (!RET_WAS_ERROR(result)) {
+		r = distribution_exportlist(export, alldistributions);
+		RET_ENDUPDATE(result, r);
+	}
+
+	/* delete files losing references, or
+	 * tell how many lost their references */
+
+	// TODO: instead check if any distribution that
+	// was not exported lost files
+	// (and in a far future do not remove references
+	// before the index is written)
+	if (deletederef && RET_WAS_ERROR(result)) {
+		deletederef = false;
+		if (pool_havedereferenced) {
+			fprintf(stderr,
+"Not deleting possibly left over files due to previous errors.\n"
+"(To keep the files in the still existing index files from vanishing)\n"
+"Use dumpunreferenced/deleteunreferenced to show/delete files without references.\n");
+		}
+	}
+	r = pool_removeunreferenced(deletederef);
+	RET_ENDUPDATE(result, r);
+
+	/* keep the morgue within its limits */
+	if (morgue_haveadded && (morguemaxsize > 0 || morguemaxage > 0)) {
+		r = morgue_gc(morguemaxsize, morguemaxage);
+		RET_ENDUPDATE(result, r);
+	}
+	/* and the shared cache */
+	if (sharedcache_haveadded && sharedcachemaxsize > 0) {
+		r = sharedcache_gc(sharedcachemaxsize);
+		RET_ENDUPDATE(result, r);
+	}
+
+	if (outhook != NULL) {
+		if (interrupted())
+			r = RET_ERROR_INTERRUPTED;
+		else
+			r = outhook_call(outhook);
+		RET_ENDUPDATE(result, r);
+	}
+	return result;
+}
+
 static retvalue callaction(command_t command, const struct action *action, int argc, const char *argv[]) {
 	retvalue result, r;
 	struct distribution *alldistributions = NULL;
@@ -4254,48 +4386,8 @@ static retvalue callaction(command_t command, const struct action *action, int a
 					x_section, x_priority,
 					architectures, components, packagetypes,
 					argc, argv);
-				/* wait for package specific loggers */
-				logger_wait();
-
-				/* remove files added but not used */
-				pool_tidyadded(deletenew);
-
-				/* tell an outhook about added files */
-				if (outhook != NULL)
-					pool_sendnewfiles();
-				/* export changed/lookedat distributions */
-				if (!RET_WAS_ERROR(result)) {
-					r = distribution_exportlist(export,
-							alldistributions);
-					RET_ENDUPDATE(result, r);
-				}
-
-				/* delete files losing references, or
-				 * tell how many lost their references */
-
-				// TODO: instead check if any distribution that
-				// was not exported lost files
-				// (and in a far future do not remove references
-				// before the index is written)
-				if (deletederef && RET_WAS_ERROR(result)) {
-					deletederef = false;
-					if (pool_havedereferenced) {
-						fprintf(stderr,
-"Not deleting possibly left over files due to previous errors.\n"
-"(To keep the files in the still existing index files from vanishing)\n"
-"Use dumpunreferenced/deleteunreferenced to show/delete files without references.\n");
-					}
-				}
-				r = pool_removeunreferenced(deletederef);
-				RET_ENDUPDATE(result, r);
-
-				if (outhook != NULL) {
-					if (interrupted())
-						r = RET_ERROR_INTERRUPTED;
-					else
-						r = outhook_call(outhook);
-					RET_ENDUPDATE(result, r);
-				}
+				result = action_finish(alldistributions, result,
+						deletederef, deletenew);
 			}
 		}
 	}
@@ -4308,6 +4400,8 @@ static retvalue callaction(command_t command, const struct action *action, int a
 		atomlist_done(&ps);
 	}
 	logger_warn_waiting();
+	r = morgue_closeindex();
+	RET_ENDUPDATE(result, r);
 	r = database_close();
 	RET_ENDUPDATE(result, r);
 	r = distribution_freelist(alldistributions);
@@ -4367,7 +4461,12 @@ LO_LISTFORMAT,
 LO_LISTSKIP,
 LO_LISTMAX,
 LO_MORGUEDIR,
+LO_MORGUEMAXSIZE,
+LO_MORGUEMAXAGE,
+LO_SHAREDCACHEDIR,
+LO_SHAREDCACHEMAXSIZE,
 LO_SHOWPERCENT,
+LO_JOBS,
 LO_RESTRICT_BIN,
 LO_RESTRICT_SRC,
 LO_RESTRICT_FILE_BIN,
@@ -4492,6 +4591,10 @@ static void handle_option(int c, const char *argument) {
 				case LO_SHOWPERCENT:
 					global.showdownloadpercent++;
 					break;
+				case LO_JOBS:
+					CONFIGGSET(jobs, parse_number("--jobs",
+							argument, 1024));
+					break;
 				case LO_DELETE:
 					delete++;
 					break;
@@ -4606,6 +4709,25 @@ static void handle_option(int c, const char *argument) {
 				case LO_MORGUEDIR:
 					CONFIGDUP(x_morguedir, argument);
 					break;
+				case LO_MORGUEMAXSIZE:
+					CONFIGSET(morguemaxsize, parse_number(
+							"--morguemaxsize",
+							argument, LONG_MAX));
+					break;
+				case LO_MORGUEMAXAGE:
+					CONFIGSET(morguemaxage, 24*60*60*
+						parse_number("--morguemaxage",
+							argument,
+							LONG_MAX/(24*60*60)));
+					break;
+				case LO_SHAREDCACHEDIR:
+					CONFIGDUP(x_sharedcachedir, argument);
+					break;
+				case LO_SHAREDCACHEMAXSIZE:
+					CONFIGSET(sharedcachemaxsize, parse_number(
+							"--sharedcachemaxsize",
+							argument, LONG_MAX));
+					break;
 				case LO_VERSION:
 					fprintf(stderr,
 "%s: This is " PACKAGE " version " VERSION "\n",
@@ -4822,6 +4944,7 @@ static void myexit(int status) {
 	free(x_section);
 	free(x_priority);
 	free(x_morguedir);
+	free(x_sharedcachedir);
 	free(gnupghome);
 	free(endhook);
 	free(outhook);
@@ -4973,7 +5096,12 @@ int main(int argc, char *argv[]) {
 		{"list-skip", required_argument, &longoption, LO_LISTSKIP},
 		{"list-max", required_argument, &longoption, LO_LISTMAX},
 		{"morguedir", required_argument, &longoption, LO_MORGUEDIR},
+		{"morguemaxsize", required_argument, &longoption, LO_MORGUEMAXSIZE},
+		{"morguemaxage", required_argument, &longoption, LO_MORGUEMAXAGE},
+		{"sharedcachedir", required_argument, &longoption, LO_SHAREDCACHEDIR},
+		{"sharedcachemaxsize", required_argument, &longoption, LO_SHAREDCACHEMAXSIZE},
 		{"show-percent", no_argument, &longoption, LO_SHOWPERCENT},
+		{"jobs", required_argument, &longoption, LO_JOBS},
 		{"restrict", required_argument, &longoption, LO_RESTRICT_SRC},
 		{"restrict-source", required_argument, &longoption, LO_RESTRICT_SRC},
 		{"restrict-src", required_argument, &longoption, LO_RESTRICT_SRC},
@@ -5064,6 +5192,9 @@ int main(int argc, char *argv[]) {
 	if (x_morguedir != NULL)
 		x_morguedir = expand_plus_prefix(x_morguedir, "morguedir",
 				"boc", true);
+	if (x_sharedcachedir != NULL)
+		x_sharedcachedir = expand_plus_prefix(x_sharedcachedir,
+				"sharedcachedir", "boc", true);
 	if (endhook != NULL) {
 		if (endhook[0] == '+' || endhook[0] == '/' ||
 				(endhook[0] == '.' && endhook[1] == '/')) {
@@ -5123,6 +5254,7 @@ int main(int argc, char *argv[]) {
 	global.methoddir = x_methoddir;
 	global.listdir = x_listdir;
 	global.morguedir = x_morguedir;
+	global.sharedcachedir = x_sharedcachedir;
 
 	if (gunzip != NULL && gunzip[0] == '+')
 		gunzip = expand_plus_prefix(gunzip, "gunzip", "boc", true);
@@ -5171,6 +5303,9 @@ int main(int argc, char *argv[]) {
 	while (a->name != NULL) {
 		if (strcasecmp(a->name, argv[optind]) == 0) {
 			signature_init(askforpassphrase);
+			r = signature_cacheresults(global.dbdir);
+			if (RET_WAS_ERROR(r))
+				myexit(EXIT_RET(r));
 			r = callaction(1 + (a - all_actions), a,
 					argc-optind, (const char**)argv+optind);
 			/* yeah, freeing all this stuff before exiting is
@@ -0,0 +1,363 @@
+/*  This file is part of "reprepro"
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "error.h"
+#include "names.h"
+#include "dirs.h"
+#include "morgue.h"
+
+/* The morgue index is a text file in the morgue directory, with one line
+ * per file moved there:
+ *   <time of deletion> <size> <name within the morgue> <filekey>
+ * New lines are only appended, so it is only rewritten when
+ * files are evicted from the morgue. */
+
+#define MORGUEINDEX ".index"
+
+bool morgue_haveadded = false;
+static /*@null@*/ FILE *indexfile = NULL;
+
+static inline char *indexfilename(void) {
+	return calc_dirconcat(global.morguedir, MORGUEINDEX);
+}
+
+retvalue morgue_remember(const char *filekey, const char *morguefilename, off_t size) {
+	const char *name;
+
+	assert (global.morguedir != NULL);
+
+	morgue_haveadded = true;
+	if (indexfile == NULL) {
+		char *filename = indexfilename();
+
+		if (FAILEDTOALLOC(filename))
+			return RET_ERROR_OOM;
+		indexfile = fopen(filename, "a");
+		if (indexfile == NULL) {
+			int e = errno;
+			fprintf(stderr, "Error %d opening '%s': %s\n",
+					e, filename, strerror(e));
+			free(filename);
+			return RET_ERRNO(e);
+		}
+		free(filename);
+	}
+	name = dirs_basename(morguefilename);
+	if (fprintf(indexfile, "%lld %lld %s %s\n",
+				(long long)time(NULL), (long long)size,
+				name, filekey) < 0) {
+		int e = errno;
+		fprintf(stderr, "Error %d writing to the morgue index: %s\n",
+				e, strerror(e));
+		return RET_ERRNO(e);
+	}
+	return RET_OK;
+}
+
+retvalue morgue_closeindex(void) {
+	int e;
+
+	if (indexfile == NULL)
+		return RET_NOTHING;
+	if (ferror(indexfile) != 0) {
+		fprintf(stderr,
+"An error occurred writing to the morgue index!\n");
+		(void)fclose(indexfile);
+		indexfile = NULL;
+		return RET_ERROR;
+	}
+	if (fclose(indexfile) != 0) {
+		e = errno;
+		indexfile = NULL;
+		fprintf(stderr,
+"Error %d occurred writing to the morgue index: %s!\n",
+				e, strerror(e));
+		return RET_ERRNO(e);
+	}
+	indexfile = NULL;
+	return RET_OK;
+}
+
+struct morguefile {
+	time_t deleted;
+	off_t size;
+	/* line number, to keep the order of entries of the same time */
+	size_t number;
+	/* points into the line: */
+	char *name, *filekey;
+	/*@only@*/char *line;
+	bool gone;
+};
+
+static int morguefile_compare_name(const void *a, const void *b) {
+	const struct morguefile *m1 = a, *m2 = b;
+	int c;
+
+	c = strcmp(m1->name, m2->name);
+	if (c != 0)
+		return c;
+	/* newest first */
+	return (m1->number < m2->number) - (m1->number > m2->number);
+}
+
+static int morguefile_compare_age(const void *a, const void *b) {
+	const struct morguefile *m1 = a, *m2 = b;
+
+	if (m1->deleted != m2->deleted)
+		return (m1->deleted > m2->deleted) - (m1->deleted < m2->deleted);
+	return (m1->number > m2->number) - (m1->number < m2->number);
+}
+
+static retvalue parseindexline(char *line, size_t number, struct morguefile *m) {
+	char *p, *e;
+	long long l;
+
+	m->line = line;
+	m->number = number;
+	m->gone = false;
+	l = strtoll(line, &e, 10);
+	if (e == line || *e != ' ')
+		return RET_NOTHING;
+	m->deleted = l;
+	p = e + 1;
+	l = strtoll(p, &e, 10);
+	if (e == p || *e != ' ' || l < 0)
+		return RET_NOTHING;
+	m->size = l;
+	m->name = e + 1;
+	p = strchr(m->name, ' ');
+	if (p == NULL || p == m->name || strchr(m->name, '/') < p)
+		return RET_NOTHING;
+	*p = '\0';
+	m->filekey = p + 1;
+	p = strchr(m->filekey, '\n');
+	if (p != NULL)
+		*p = '\0';
+	return RET_OK;
+}
+
+static retvalue readindex(const char *filename, /*@out@*/struct morguefile **files_p, /*@out@*/size_t *count_p) {
+	FILE *f;
+	struct morguefile *files = NULL;
+	size_t count = 0, size = 0, linenr = 0;
+	char *line = NULL;
+	size_t linesize = 0;
+	ssize_t got;
+	retvalue r = RET_OK;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		int e = errno;
+		if (e == ENOENT) {
+			*files_p = NULL;
+			*count_p = 0;
+			return RET_NOTHING;
+		}
+		fprintf(stderr, "Error %d opening '%s': %s\n",
+				e, filename, strerror(e));
+		return RET_ERRNO(e);
+	}
+	while ((got = getline(&line, &linesize, f)) > 0) {
+		linenr++;
+		if (count >= size) {
+			struct morguefile *n;
+
+			size = (size == 0) ? 256 : 2 * size;
+			n = realloc(files, size * sizeof(struct morguefile));
+			if (FAILEDTOALLOC(n)) {
+				r = RET_ERROR_OOM;
+				break;
+			}
+			files = n;
+		}
+		r = parseindexline(line, linenr, &files[count]);
+		if (r == RET_NOTHING) {
+			fprintf(stderr,
+"Ignoring malformed line %lu in '%s'\n",
+					(unsigned long)linenr, filename);
+			continue;
+		}
+		count++;
+		line = NULL;
+		linesize = 0;
+	}
+	free(line);
+	if (!RET_WAS_ERROR(r) && ferror(f) != 0) {
+		fprintf(stderr, "Error reading '%s'!\n", filename);
+		r = RET_ERROR;
+	}
+	if (RET_WAS_ERROR(r)) {
+		(void)fclose(f);
+		while (count > 0)
+			free(files[--count].line);
+		free(files);
+		return r;
+	}
+	(void)fclose(f);
+	*files_p = files;
+	*count_p = count;
+	return RET_OK;
+}
+
+static retvalue writeindex(const char *filename, const struct morguefile *files, size_t count) {
+	char *tempfilename;
+	FILE *f;
+	size_t i;
+	int e;
+
+	tempfilename = calc_addsuffix(filename, "new");
+	if (FAILEDTOALLOC(tempfilename))
+		return RET_ERROR_OOM;
+	f = fopen(tempfilename, "w");
+	if (f == NULL) {
+		e = errno;
+		fprintf(stderr, "Error %d creating '%s': %s\n",
+				e, tempfilename, strerror(e));
+		free(tempfilename);
+		return RET_ERRNO(e);
+	}
+	for (i = 0 ; i < count ; i++) {
+		if (files[i].gone)
+			continue;
+		fprintf(f, "%lld %lld %s %s\n",
+				(long long)files[i].deleted,
+				(long long)files[i].size,
+				files[i].name, files[i].filekey);
+	}
+	if (ferror(f) != 0 || fclose(f) != 0) {
+		fprintf(stderr, "Error writing '%s'!\n", tempfilename);
+		(void)unlink(tempfilename);
+		free(tempfilename);
+		return RET_ERROR;
+	}
+	if (rename(tempfilename, filename) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
+				e, tempfilename, filename, strerror(e));
+		(void)unlink(tempfilename);
+		free(tempfilename);
+		return RET_ERRNO(e);
+	}
+	free(tempfilename);
+	return RET_OK;
+}
+
+retvalue morgue_gc(off_t maxsize, time_t maxage) {
+	struct morguefile *files;
+	size_t count, i;
+	char *filename, *morguefilename;
+	off_t total = 0;
+	time_t now;
+	long evicted = 0;
+	retvalue result, r;
+
+	if (global.morguedir == NULL)
+		return RET_NOTHING;
+	r = morgue_closeindex();
+	if (RET_WAS_ERROR(r))
+		return r;
+	filename = indexfilename();
+	if (FAILEDTOALLOC(filename))
+		return RET_ERROR_OOM;
+	r = readindex(filename, &files, &count);
+	if (!RET_IS_OK(r)) {
+		free(filename);
+		return r;
+	}
+
+	/* only the newest entry of a name is about the file still there */
+	qsort(files, count, sizeof(struct morguefile), morguefile_compare_name);
+	for (i = 1 ; i < count ; i++) {
+		if (strcmp(files[i-1].name, files[i].name) == 0)
+			files[i].gone = true;
+	}
+	qsort(files, count, sizeof(struct morguefile), morguefile_compare_age);
+	for (i = 0 ; i < count ; i++) {
+		struct stat s;
+
+		if (files[i].gone)
+			continue;
+		morguefilename = calc_dirconcat(global.morguedir,
+				files[i].name);
+		if (FAILEDTOALLOC(morguefilename)) {
+			r = RET_ERROR_OOM;
+			break;
+		}
+		/* forget about files already removed by hand */
+		if (lstat(morguefilename, &s) != 0 || !S_ISREG(s.st_mode))
+			files[i].gone = true;
+		else
+			total += files[i].size = s.st_size;
+		free(morguefilename);
+	}
+
+	result = RET_NOTHING;
+	now = time(NULL);
+	for (i = 0 ; RET_WAS_NO_ERROR(r) && i < count ; i++) {
+		if (files[i].gone)
+			continue;
+		if (!(maxage > 0 && files[i].deleted + maxage < now) &&
+				!(maxsize > 0 && total > maxsize))
+			continue;
+		if (interrupted()) {
+			r = RET_ERROR_INTERRUPTED;
+			break;
+		}
+		morguefilename = calc_dirconcat(global.morguedir,
+				files[i].name);
+		if (FAILEDTOALLOC(morguefilename)) {
+			r = RET_ERROR_OOM;
+			break;
+		}
+		if (verbose >= 1)
+			printf("removing %s (was %s) from the morgue\n",
+					morguefilename, files[i].filekey);
+		if (unlink(morguefilename) != 0 && errno != ENOENT) {
+			int e = errno;
+			fprintf(stderr, "Error %d deleting '%s': %s\n",
+					e, morguefilename, strerror(e));
+			RET_UPDATE(result, RET_ERRNO(e));
+		} else {
+			files[i].gone = true;
+			total -= files[i].size;
+			evicted++;
+			RET_UPDATE(result, RET_OK);
+		}
+		free(morguefilename);
+	}
+	RET_ENDUPDATE(result, r);
+	/* write the index even when interrupted, as some files might
+	 * already be gone */
+	r = writeindex(filename, files, count);
+	RET_ENDUPDATE(result, r);
+	if (verbose >= 0 && evicted > 0)
+		printf("Removed %ld files from the morgue, %lld bytes left.\n",
+				evicted, (long long)total);
+	for (i = 0 ; i < count ; i++)
+		free(files[i].line);
+	free(files);
+	free(filename);
+	return result;
+}
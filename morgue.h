@@ -0,0 +1,20 @@
+#ifndef REPREPRO_MORGUE_H
+#define REPREPRO_MORGUE_H
+
+#ifndef REPREPRO_ERROR_H
+#include "error.h"
+#endif
+
+/* set if files were moved into the morgue in this run */
+extern bool morgue_haveadded;
+
+/* note that a file from the pool was moved into the morgue */
+retvalue morgue_remember(const char * /*filekey*/, const char * /*morguefilename*/, off_t /*size*/);
+
+/* finish writing the morgue index */
+retvalue morgue_closeindex(void);
+
+/* delete the oldest files in the morgue, until it is not larger than
+ * maxsize and contains no file older than maxage seconds (0 = no limit) */
+retvalue morgue_gc(off_t /*maxsize*/, time_t /*maxage*/);
+#endif
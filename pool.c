@@ -18,13 +18,13 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <search.h>
 #include <unistd.h>
 #include "error.h"
 #include "ignore.h"
@@ -37,13 +37,11 @@
 #include "files.h"
 #include "sources.h"
 #include "outhook.h"
+#include "morgue.h"
 
 /* for now save them only in memory. In later times some way to store
  * them on disk would be nice */
 
-static component_t reserved_components = 0;
-static void **file_changes_per_component = NULL;
-static void *legacy_file_changes = NULL;
 bool pool_havedereferenced = false;
 bool pool_havedeleted = false;
 
@@ -51,26 +49,155 @@ bool pool_havedeleted = false;
 #define pl_UNREFERENCED 2
 #define pl_DELETED 4
 
-static int legacy_compare(const void *a, const void *b) {
-	const char *v1 = a, *v2 = b;
-	v1++;
-	v2++;
-	return strcmp(v1, v2);
+/* All names are only freed together at the end, so they are allocated
+ * from a simple arena instead of one malloc per name: */
+
+#define ARENA_BLOCKSIZE (64*1024)
+
+struct arenablock {
+	/*@null@*/struct arenablock *next;
+	size_t used, size;
+	char data[];
+};
+static /*@null@*/ struct arenablock *arena = NULL;
+
+static void *arena_alloc(size_t len) {
+	struct arenablock *b = arena;
+	void *p;
+
+	/* keep it aligned for struct sourcename */
+	len = (len + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if (b == NULL || b->size - b->used < len) {
+		size_t size = (len > ARENA_BLOCKSIZE) ? len : ARENA_BLOCKSIZE;
+
+		b = malloc(sizeof(struct arenablock) + size);
+		if (FAILEDTOALLOC(b))
+			return NULL;
+		b->used = 0;
+		b->size = size;
+		if (arena != NULL && len > ARENA_BLOCKSIZE) {
+			/* do not waste the rest of the current block */
+			b->next = arena->next;
+			arena->next = b;
+		} else {
+			b->next = arena;
+			arena = b;
+		}
+	}
+	p = b->data + b->used;
+	b->used += len;
+	return p;
+}
+
+static inline uint32_t hash_string(uint32_t hash, const char *s, size_t len) {
+	/* FNV-1a */
+	while (len-- > 0) {
+		hash ^= (unsigned char)*(s++);
+		hash *= 16777619U;
+	}
+	return hash;
 }
+#define HASH_INIT 2166136261U
+
+/* every source name is only stored once, so they can be compared by
+ * pointer and their hash needs only be computed once: */
 
-struct source_node {
-	void *file_changes;
-	char sourcename[];
+struct sourcename {
+	uint32_t hash;
+	char name[];
 };
+static /*@null@*/ const struct sourcename **sourcenames = NULL;
+static size_t sourcenames_size = 0, sourcenames_count = 0;
+
+static bool sourcenames_grow(void) {
+	const struct sourcename **n;
+	size_t newsize, i, j;
+
+	newsize = (sourcenames_size == 0) ? 256 : 2 * sourcenames_size;
+	n = nzNEW(newsize, const struct sourcename *);
+	if (FAILEDTOALLOC(n))
+		return false;
+	for (i = 0 ; i < sourcenames_size ; i++) {
+		if (sourcenames[i] == NULL)
+			continue;
+		j = sourcenames[i]->hash & (newsize - 1);
+		while (n[j] != NULL)
+			j = (j + 1) & (newsize - 1);
+		n[j] = sourcenames[i];
+	}
+	free(sourcenames);
+	sourcenames = n;
+	sourcenames_size = newsize;
+	return true;
+}
+
+static /*@null@*/ const struct sourcename *sourcename_intern(const char *name, size_t len) {
+	struct sourcename *s;
+	uint32_t hash;
+	size_t i;
 
-static int source_node_compare(const void *a, const void *b) {
-	const struct source_node *v1 = a, *v2 = b;
-	return strcmp(v1->sourcename, v2->sourcename);
+	if (2 * (sourcenames_count + 1) > sourcenames_size) {
+		if (!sourcenames_grow())
+			return NULL;
+	}
+	hash = hash_string(HASH_INIT, name, len);
+	i = hash & (sourcenames_size - 1);
+	while (sourcenames[i] != NULL) {
+		if (sourcenames[i]->hash == hash &&
+				strncmp(sourcenames[i]->name, name, len) == 0 &&
+				sourcenames[i]->name[len] == '\0')
+			return sourcenames[i];
+		i = (i + 1) & (sourcenames_size - 1);
+	}
+	s = arena_alloc(sizeof(struct sourcename) + len + 1);
+	if (FAILEDTOALLOC(s))
+		return NULL;
+	s->hash = hash;
+	memcpy(s->name, name, len);
+	s->name[len] = '\0';
+	sourcenames[i] = s;
+	sourcenames_count++;
+	return s;
 }
 
-static retvalue split_filekey(const char *filekey, /*@out@*/component_t *component_p, /*@out@*/struct source_node **node_p, /*@out@*/const char **basename_p) {
+/* the files added or deleted, in an open addressing hash table: */
+
+struct filechange {
+	uint32_t hash;
+	component_t component;
+	/* NULL (and name the full filekey) for strange filekeys */
+	/*@null@*/ const struct sourcename *source;
+	/* the first char are the pl_ flags, followed by the name
+	 * (NULL for an empty slot) */
+	/*@null@*/ char *node;
+};
+static /*@null@*/ struct filechange *file_changes = NULL;
+static size_t file_changes_size = 0, file_changes_count = 0;
+
+static bool file_changes_grow(void) {
+	struct filechange *n;
+	size_t newsize, i, j;
+
+	newsize = (file_changes_size == 0) ? 1024 : 2 * file_changes_size;
+	n = nzNEW(newsize, struct filechange);
+	if (FAILEDTOALLOC(n))
+		return false;
+	for (i = 0 ; i < file_changes_size ; i++) {
+		if (file_changes[i].node == NULL)
+			continue;
+		j = file_changes[i].hash & (newsize - 1);
+		while (n[j].node != NULL)
+			j = (j + 1) & (newsize - 1);
+		n[j] = file_changes[i];
+	}
+	free(file_changes);
+	file_changes = n;
+	file_changes_size = newsize;
+	return true;
+}
+
+static retvalue split_filekey(const char *filekey, /*@out@*/component_t *component_p, /*@out@*/const char **source_p, /*@out@*/size_t *sourcelen_p, /*@out@*/const char **basename_p) {
 	const char *p, *lastp, *source;
-	struct source_node *node;
 	component_t c;
 
 	if (unlikely(memcmp(filekey, "pool/", 5) != 0))
@@ -108,80 +235,77 @@ static retvalue split_filekey(const char *filekey, /*@out@*/component_t *compone
 	p = strchr(source, '/');
 	if (unlikely(p == NULL))
 		return RET_NOTHING;
-	node = malloc(sizeof(struct source_node) + (p - source) + 1);
-	if (FAILEDTOALLOC(node))
-		return RET_ERROR_OOM;
-	node->file_changes = NULL;
-	memcpy(node->sourcename, source, p - source);
-	node->sourcename[p - source] = '\0';
-	p++;
-	*basename_p = p;
-	*node_p = node;
+	*source_p = source;
+	*sourcelen_p = p - source;
+	*basename_p = p + 1;
 	*component_p = c;
 	return RET_OK;
 }
 
 /* name can be either basename (in a source directory) or a full
  * filekey (in legacy fallback mode) */
-static retvalue remember_name(void **root_p, const char *name, char mode, char mode_and) {
-	char **p;
+static retvalue remember_name(component_t component, /*@null@*/const struct sourcename *source, const char *name, char mode, char mode_and) {
+	struct filechange *f;
+	uint32_t hash;
+	size_t i, l;
 
-	p = tsearch(name - 1, root_p, legacy_compare);
-	if (FAILEDTOALLOC(p))
-		return RET_ERROR_OOM;
-	if (*p == name - 1) {
-		size_t l = strlen(name);
-		*p = malloc(l + 2);
-		if (FAILEDTOALLOC(*p))
+	if (2 * (file_changes_count + 1) > file_changes_size) {
+		if (!file_changes_grow())
 			return RET_ERROR_OOM;
-		**p = mode;
-		memcpy((*p) + 1, name, l + 1);
-	} else {
-		**p &= mode_and;
-		**p |= mode;
 	}
+	l = strlen(name);
+	hash = (source == NULL) ? HASH_INIT :
+		(source->hash * 31U + (uint32_t)component);
+	hash = hash_string(hash, name, l);
+	i = hash & (file_changes_size - 1);
+	while ((f = &file_changes[i])->node != NULL) {
+		if (f->hash == hash && f->source == source &&
+				f->component == component &&
+				strcmp(f->node + 1, name) == 0) {
+			*f->node &= mode_and;
+			*f->node |= mode;
+			return RET_OK;
+		}
+		i = (i + 1) & (file_changes_size - 1);
+	}
+	f->node = arena_alloc(l + 2);
+	if (FAILEDTOALLOC(f->node))
+		return RET_ERROR_OOM;
+	f->node[0] = mode;
+	memcpy(f->node + 1, name, l + 1);
+	f->hash = hash;
+	f->component = component;
+	f->source = source;
+	file_changes_count++;
 	return RET_OK;
 }
 
 static retvalue remember_filekey(const char *filekey, char mode, char mode_and) {
 	retvalue r;
 	component_t c;
-	struct source_node *node, **found;
-	const char *basefilename;
+	const char *source, *basefilename;
+	const struct sourcename *s;
+	size_t sourcelen;
 
-	r = split_filekey(filekey, &c, &node, &basefilename);
+	r = split_filekey(filekey, &c, &source, &sourcelen, &basefilename);
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (r == RET_OK) {
 		assert (atom_defined(c));
-		if (c > reserved_components) {
-			void ** h;
-
-			assert (c <= components_count());
-
-			h = realloc(file_changes_per_component,
-					sizeof(void*) * (c + 1));
-			if (FAILEDTOALLOC(h))
-				return RET_ERROR_OOM;
-			file_changes_per_component = h;
-			while (reserved_components < c) {
-				h[++reserved_components] = NULL;
-			}
-		}
-		assert (file_changes_per_component != NULL);
-		found = tsearch(node, &file_changes_per_component[c],
-				source_node_compare);
-		if (FAILEDTOALLOC(found))
+		s = sourcename_intern(source, sourcelen);
+		if (FAILEDTOALLOC(s))
 			return RET_ERROR_OOM;
-		if (*found != node) {
-			free(node);
-			node = *found;
-		}
-		return remember_name(&node->file_changes, basefilename,
-				mode, mode_and);
+		return remember_name(c, s, basefilename, mode, mode_and);
 	}
 	fprintf(stderr, "Warning: strange filekey '%s'!\n", filekey);
-	return remember_name(&legacy_file_changes, filekey, mode, mode_and);
+	return remember_name(atom_unknown, NULL, filekey, mode, mode_and);
+}
+
+static inline char *filechange_filekey(const struct filechange *f) {
+	if (f->source == NULL)
+		return strdup(f->node + 1);
+	else
+		return calc_filekey(f->component, f->source->name, f->node + 1);
 }
 
 retvalue pool_dereferenced(const char *filekey) {
@@ -354,6 +478,7 @@ static inline retvalue morgue_name(const char *filekey, char **name_p, int *fd_p
 /* if file not there, return RET_NOTHING */
 static inline retvalue movefiletomorgue(const char *filekey, const char *filename, bool new) {
 	char *morguefilename = NULL;
+	off_t size = 0;
 	int err;
 	retvalue r;
 
@@ -389,9 +514,12 @@ static inline retvalue movefiletomorgue(const char *filekey, const char *filenam
 			free(morguefilename);
 			morguefilename = NULL;
 		} else if (S_ISREG(s.st_mode)) {
+			size = s.st_size;
 			err = rename(filename, morguefilename);
 			if (err == 0) {
 				(void)close(morguefd);
+				(void)morgue_remember(filekey, morguefilename,
+						size);
 				free(morguefilename);
 				return RET_OK;
 			}
@@ -425,15 +553,60 @@ static inline retvalue movefiletomorgue(const char *filekey, const char *filenam
 		}
 		return RET_ERRNO(en);
 	} else {
+		if (morguefilename != NULL)
+			(void)morgue_remember(filekey, morguefilename, size);
 		free(morguefilename);
 		return RET_OK;
 	}
 }
 
+/* try to delete a directory and its parent directories, until one gives
+ * errors (hopefully because it still contains files) */
+static void removeemptydirectories(char *dirname) {
+	size_t fixedpartlen = strlen(global.outdir);
+	char *p;
+	int err, en;
+
+	do {
+		/* do not try to remove parts of the mirrordir */
+		if (strlen(dirname) <= fixedpartlen+1)
+			break;
+		/* try to rmdir the directory, this will
+		 * fail if there are still other files or directories
+		 * in it: */
+		err = rmdir(dirname);
+		if (err == 0) {
+			if (verbose > 1) {
+				printf("removed now empty directory %s\n",
+						dirname);
+			}
+		} else {
+			en = errno;
+			/* ENOENT: already removed together with an
+			 * other directory deleted before */
+			if (en != ENOTEMPTY && en != ENOENT) {
+				//TODO: check here if only some
+				//other error was first and it
+				//is not empty so we do not have
+				//to remove it anyway...
+				fprintf(stderr,
+"ignoring error %d trying to rmdir %s: %s\n", en, dirname, strerror(en));
+			}
+			/* parent directories will contain this one
+			 * thus not be empty, in other words:
+			 * everything's done */
+			break;
+		}
+		p = strrchr(dirname, '/');
+		if (p != NULL)
+			*p = '\0';
+	} while (p != NULL);
+}
+
 /* delete the file and possible parent directories,
  * if not new and morguedir set, first move/copy there */
 static retvalue deletepoolfile(const char *filekey, bool new) {
-	char *filename;
+	char *filename, *p;
 	retvalue r;
 
 	if (interrupted())
@@ -453,44 +626,11 @@ static retvalue deletepoolfile(const char *filekey, bool new) {
 		return r;
 	}
 	if (!global.keepdirectories) {
-		/* try to delete parent directories, until one gives
-		 * errors (hopefully because it still contains files) */
-		size_t fixedpartlen = strlen(global.outdir);
-		char *p;
-		int err, en;
-
-		while ((p = strrchr(filename, '/')) != NULL) {
-			/* do not try to remove parts of the mirrordir */
-			if ((size_t)(p-filename) <= fixedpartlen+1)
-				break;
-			*p ='\0';
-			/* try to rmdir the directory, this will
-			 * fail if there are still other files or directories
-			 * in it: */
-			err = rmdir(filename);
-			if (err == 0) {
-				if (verbose > 1) {
-					printf(
-"removed now empty directory %s\n",
-							filename);
-				}
-			} else {
-				en = errno;
-				if (en != ENOTEMPTY) {
-					//TODO: check here if only some
-					//other error was first and it
-					//is not empty so we do not have
-					//to remove it anyway...
-					fprintf(stderr,
-"ignoring error %d trying to rmdir %s: %s\n", en, filename, strerror(en));
-				}
-				/* parent directories will contain this one
-				 * thus not be empty, in other words:
-				 * everything's done */
-				break;
-			}
+		p = strrchr(filename, '/');
+		if (p != NULL) {
+			*p = '\0';
+			removeemptydirectories(filename);
 		}
-
 	}
 	free(filename);
 	return RET_OK;
@@ -516,354 +656,485 @@ retvalue pool_markdeleted(const char *filekey) {
 	return remember_filekey(filekey, pl_DELETED, ~pl_UNREFERENCED);
 };
 
-/* libc's twalk misses a callback_data pointer, so we need some temporary
- * global variables: */
-static retvalue result;
-static bool first, onlycount;
-static long woulddelete_count;
-static component_t current_component;
-static const char *sourcename = NULL;
+/* Files to be deleted are processed in batches:
+ * All candidates are collected first and sorted by filekey.
+ * Thus the references can be checked in a single pass over the
+ * references database, all files of a directory are next to each
+ * other (so each directory only needs to be opened once) and
+ * directories that might have become empty are only looked at once
+ * after all files are deleted. */
+
+/* with less candidates look them up one by one instead of reading
+ * all of the references database */
+#define BATCH_MERGEREFERENCES 1000
+
+struct deletecandidate {
+	/*@only@*/char *filekey;
+	/* the flags in the file_changes tree, NULL if the file is not
+	 * yet known there (then files_remove tells pool_markdeleted) */
+	/*@null@*/char *mode;
+	bool new;
+	bool used;
+};
 
-static void removeifunreferenced(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	char *node; const char *filekey;
-	retvalue r;
+struct deletebatch {
+	struct deletecandidate *candidates;
+	size_t count, size;
+	/* directory of the last file deleted and a file descriptor
+	 * of it, to not having to look it up again for every file */
+	/*@null@*/char *dirname;
+	int dirfd;
+	/* the errno of opening it, if that failed */
+	int direrrno;
+	/* candidates already compared with the references */
+	size_t merged;
+	/* all directories files were deleted from */
+	struct strlist directories;
+};
 
-	if (which != leaf && which != postorder)
-		return;
+static void deletebatch_init(/*@out@*/struct deletebatch *batch) {
+	setzero(struct deletebatch, batch);
+	batch->dirfd = -1;
+	strlist_init(&batch->directories);
+}
 
-	if (interrupted())
-		return;
+static void deletebatch_done(struct deletebatch *batch) {
+	size_t i;
 
-	node = *(char **)nodep;
-	filekey = node + 1;
-	if ((*node & pl_UNREFERENCED) == 0)
-		return;
-	r = references_isused(filekey);
-	if (r != RET_NOTHING)
-		return;
+	for (i = 0 ; i < batch->count ; i++)
+		free(batch->candidates[i].filekey);
+	free(batch->candidates);
+	if (batch->dirfd >= 0)
+		(void)close(batch->dirfd);
+	free(batch->dirname);
+	strlist_done(&batch->directories);
+}
 
-	if (onlycount) {
-		woulddelete_count++;
-		return;
-	}
+static retvalue deletebatch_add(struct deletebatch *batch, /*@only@*/char *filekey, /*@null@*/char *mode, bool new) {
+	struct deletecandidate *c;
 
-	if (verbose >= 0 && first) {
-		printf("Deleting files no longer referenced...\n");
-		first = false;
-	}
-	if (verbose >= 1)
-		printf("deleting and forgetting %s\n", filekey);
-	r = deletepoolfile(filekey, (*node & pl_ADDED) != 0);
-	RET_UPDATE(result, r);
-	if (!RET_WAS_ERROR(r)) {
-		r = files_removesilent(filekey);
-		RET_UPDATE(result, r);
-		if (!RET_WAS_ERROR(r))
-			*node &= ~pl_UNREFERENCED;
-		if (RET_IS_OK(r))
-			*node |= pl_DELETED;
+	if (FAILEDTOALLOC(filekey))
+		return RET_ERROR_OOM;
+	if (batch->count >= batch->size) {
+		size_t newsize = (batch->size == 0) ? 256 : 2 * batch->size;
+
+		c = realloc(batch->candidates,
+				newsize * sizeof(struct deletecandidate));
+		if (FAILEDTOALLOC(c)) {
+			free(filekey);
+			return RET_ERROR_OOM;
+		}
+		batch->candidates = c;
+		batch->size = newsize;
 	}
+	c = &batch->candidates[batch->count++];
+	c->filekey = filekey;
+	c->mode = mode;
+	c->new = new;
+	c->used = false;
+	return RET_OK;
 }
 
+static int candidate_compare(const void *a, const void *b) {
+	const struct deletecandidate *c1 = a, *c2 = b;
 
-static void removeifunreferenced2(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	char *node;
-	char *filekey;
-	retvalue r;
-
-	if (which != leaf && which != postorder)
-		return;
+	return strcmp(c1->filekey, c2->filekey);
+}
 
-	if (interrupted())
-		return;
+static retvalue markused(void *data, const char *filekey) {
+	struct deletebatch *batch = data;
+	struct deletecandidate *c;
+	int cmp;
 
-	node = *(char **)nodep;
-	if ((*node & pl_UNREFERENCED) == 0)
-		return;
-	filekey = calc_filekey(current_component, sourcename, node + 1);
-	r = references_isused(filekey);
-	if (r != RET_NOTHING) {
-		free(filekey);
-		return;
-	}
-	if (onlycount) {
-		woulddelete_count++;
-		free(filekey);
-		return;
-	}
-	if (verbose >= 0 && first) {
-		printf("Deleting files no longer referenced...\n");
-		first = false;
-	}
-	if (verbose >= 1)
-		printf("deleting and forgetting %s\n", filekey);
-	r = deletepoolfile(filekey, (*node & pl_ADDED) != 0);
-	RET_UPDATE(result, r);
-	if (!RET_WAS_ERROR(r)) {
-		r = files_removesilent(filekey);
-		RET_UPDATE(result, r);
-		if (!RET_WAS_ERROR(r))
-			*node &= ~pl_UNREFERENCED;
-		if (RET_IS_OK(r))
-			*node |= pl_DELETED;
+	while (batch->merged < batch->count) {
+		c = &batch->candidates[batch->merged];
+		cmp = strcmp(c->filekey, filekey);
+		if (cmp > 0)
+			break;
+		if (cmp == 0)
+			c->used = true;
+		batch->merged++;
 	}
-	RET_UPDATE(result, r);
-	free(filekey);
+	return RET_OK;
 }
 
-static void removeunreferenced_from_component(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	struct source_node *node;
-
-	if (which != leaf && which != postorder)
-		return;
+/* mark all candidates still having references as used */
+static retvalue deletebatch_checkreferences(struct deletebatch *batch) {
+	size_t i;
+	retvalue r;
 
-	if (interrupted())
-		return;
+	if (batch->count == 0)
+		return RET_NOTHING;
+	qsort(batch->candidates, batch->count,
+			sizeof(struct deletecandidate), candidate_compare);
+
+	if (batch->count < BATCH_MERGEREFERENCES) {
+		for (i = 0 ; i < batch->count ; i++) {
+			if (interrupted())
+				return RET_ERROR_INTERRUPTED;
+			r = references_isused(batch->candidates[i].filekey);
+			if (RET_WAS_ERROR(r))
+				return r;
+			batch->candidates[i].used = (r != RET_NOTHING);
+		}
+		return RET_OK;
+	}
 
-	node = *(struct source_node **)nodep;
-	sourcename = node->sourcename;
-	twalk(node->file_changes, removeifunreferenced2);
+	/* the database is sorted the same way,
+	 * so look at every key only once: */
+	batch->merged = 0;
+	r = references_foreachused(markused, batch);
+	if (RET_WAS_ERROR(r))
+		return r;
+	return RET_OK;
 }
 
-retvalue pool_removeunreferenced(bool delete) {
-	component_t c;
-
-	if (!delete && verbose <= 0)
-		return RET_NOTHING;
+static long deletebatch_countunused(const struct deletebatch *batch) {
+	size_t i;
+	long count = 0;
 
-	result = RET_NOTHING;
-	first = true;
-	onlycount = !delete;
-	woulddelete_count = 0;
-	for (c = 1 ; c <= reserved_components ; c++) {
-		assert (file_changes_per_component != NULL);
-		current_component = c;
-		twalk(file_changes_per_component[c],
-				removeunreferenced_from_component);
-	}
-	twalk(legacy_file_changes, removeifunreferenced);
-	if (interrupted())
-		result = RET_ERROR_INTERRUPTED;
-	if (!delete && woulddelete_count > 0) {
-		printf(
-"%lu files lost their last reference.\n"
-"(dumpunreferenced lists such files, use deleteunreferenced to delete them.)\n",
-			woulddelete_count);
+	for (i = 0 ; i < batch->count ; i++) {
+		if (!batch->candidates[i].used)
+			count++;
 	}
-	return result;
+	return count;
 }
 
-static void removeunusednew(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	char *node; const char *filekey;
+/* remove a file from the pool, using a cached descriptor of its
+ * directory, if not new and morguedir set move/copy it there */
+static retvalue deletebatch_deletefile(struct deletebatch *batch, const struct deletecandidate *c) {
+	const char *basefilename;
+	char *filename;
+	size_t dirlen;
+	int err, en;
 	retvalue r;
 
-	if (which != leaf && which != postorder)
-		return;
-
-	if (interrupted())
-		return;
-
-	node = *(char **)nodep;
-	filekey = node + 1;
-	/* only look at newly added and not already deleted */
-	if ((*node & (pl_ADDED|pl_DELETED)) != pl_ADDED)
-		return;
-	r = references_isused(filekey);
-	if (r != RET_NOTHING)
-		return;
+	if (!c->new)
+		outhook_send("POOLDELETE", c->filekey, NULL, NULL);
+	filename = files_calcfullfilename(c->filekey);
+	if (FAILEDTOALLOC(filename))
+		return RET_ERROR_OOM;
+	basefilename = strrchr(filename, '/');
+	assert (basefilename != NULL);
+	dirlen = basefilename - filename;
+	basefilename++;
 
-	if (onlycount) {
-		woulddelete_count++;
-		return;
+	if (!c->new && global.morguedir != NULL) {
+		r = movefiletomorgue(c->filekey, filename, false);
+	} else {
+		if (batch->dirname == NULL ||
+				strncmp(batch->dirname, filename, dirlen) != 0 ||
+				batch->dirname[dirlen] != '\0') {
+			if (batch->dirfd >= 0)
+				(void)close(batch->dirfd);
+			free(batch->dirname);
+			batch->dirname = strndup(filename, dirlen);
+			if (FAILEDTOALLOC(batch->dirname)) {
+				batch->dirfd = -1;
+				free(filename);
+				return RET_ERROR_OOM;
+			}
+			batch->dirfd = open(batch->dirname,
+				O_RDONLY|O_DIRECTORY|O_NOCTTY|O_CLOEXEC);
+			batch->direrrno = (batch->dirfd < 0) ? errno : 0;
+		}
+		if (batch->dirfd < 0) {
+			en = batch->direrrno;
+			if (en == ENOENT)
+				r = RET_NOTHING;
+			else {
+				fprintf(stderr,
+"error %d opening directory %s: %s\n",
+					en, batch->dirname, strerror(en));
+				r = RET_ERRNO(en);
+			}
+		} else {
+			err = unlinkat(batch->dirfd, basefilename, 0);
+			if (err == 0)
+				r = RET_OK;
+			else if (errno == ENOENT)
+				r = RET_NOTHING;
+			else {
+				en = errno;
+				fprintf(stderr,
+"error %d while unlinking %s: %s\n",
+					en, filename, strerror(en));
+				r = RET_ERRNO(en);
+			}
+		}
 	}
-
-	if (verbose >= 0 && first) {
-		printf(
-"Deleting files just added to the pool but not used.\n"
-"(to avoid use --keepunusednewfiles next time)\n");
-		first = false;
+	if (r == RET_NOTHING) {
+		fprintf(stderr, "%s not found, forgetting anyway\n", filename);
 	}
-	if (verbose >= 1)
-		printf("deleting and forgetting %s\n", filekey);
-	r = deletepoolfile(filekey, true);
-	RET_UPDATE(result, r);
-	if (!RET_WAS_ERROR(r)) {
-		r = files_removesilent(filekey);
-		RET_UPDATE(result, r);
-		/* don't remove pl_ADDED here, otherwise the hook
-		 * script will be told to remove something not added */
-		if (!RET_WAS_ERROR(r))
-			*node &= ~pl_UNREFERENCED;
-		if (RET_IS_OK(r))
-			*node |= pl_DELETED;
+	if (RET_IS_OK(r) && !global.keepdirectories) {
+		int last = batch->directories.count - 1;
+
+		if (last < 0 || strncmp(batch->directories.values[last],
+					filename, dirlen) != 0 ||
+				batch->directories.values[last][dirlen]
+				!= '\0') {
+			retvalue r2;
+
+			r2 = strlist_add(&batch->directories,
+					strndup(filename, dirlen));
+			if (RET_WAS_ERROR(r2))
+				r = r2;
+		}
 	}
+	free(filename);
+	return r;
 }
 
+static int directory_compare(const void *a, const void *b) {
+	const char * const *d1 = a, * const *d2 = b;
 
-static void removeunusednew2(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	char *node;
-	char *filekey;
-	retvalue r;
-
-	if (which != leaf && which != postorder)
-		return;
+	/* reverse order, so subdirectories are before their parents */
+	return strcmp(*d2, *d1);
+}
 
-	if (interrupted())
-		return;
+static void deletebatch_removedirectories(struct deletebatch *batch) {
+	int i, count;
 
-	node = *(char **)nodep;
-	/* only look at newly added and not already deleted */
-	if ((*node & (pl_ADDED|pl_DELETED)) != pl_ADDED)
-		return;
-	filekey = calc_filekey(current_component, sourcename, node + 1);
-	r = references_isused(filekey);
-	if (r != RET_NOTHING) {
-		free(filekey);
-		return;
-	}
-	if (onlycount) {
-		woulddelete_count++;
-		free(filekey);
-		return;
+	if (batch->dirfd >= 0) {
+		(void)close(batch->dirfd);
+		batch->dirfd = -1;
 	}
-	if (verbose >= 0 && first) {
-		printf(
-"Deleting files just added to the pool but not used.\n"
-"(to avoid use --keepunusednewfiles next time)\n");
-		first = false;
+	qsort(batch->directories.values, batch->directories.count,
+			sizeof(char *), directory_compare);
+	/* remove duplicates */
+	count = 0;
+	for (i = 0 ; i < batch->directories.count ; i++) {
+		char *dir = batch->directories.values[i];
+
+		if (count > 0 && strcmp(batch->directories.values[count-1],
+					dir) == 0) {
+			free(dir);
+			continue;
+		}
+		batch->directories.values[count++] = dir;
 	}
-	if (verbose >= 1)
-		printf("deleting and forgetting %s\n", filekey);
-	r = deletepoolfile(filekey, true);
-	RET_UPDATE(result, r);
-	if (!RET_WAS_ERROR(r)) {
-		r = files_removesilent(filekey);
+	batch->directories.count = count;
+	for (i = 0 ; i < count ; i++)
+		removeemptydirectories(batch->directories.values[i]);
+}
+
+/* delete and forget all candidates no longer used */
+static retvalue deletebatch_execute(struct deletebatch *batch, const char *header) {
+	retvalue result, r;
+	size_t i;
+
+	result = RET_NOTHING;
+	for (i = 0 ; i < batch->count ; i++) {
+		struct deletecandidate *c = &batch->candidates[i];
+
+		if (c->used)
+			continue;
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
+		}
+		if (verbose >= 0 && header != NULL) {
+			fputs(header, stdout);
+			header = NULL;
+		}
+		if (verbose >= 1)
+			printf("deleting and forgetting %s\n", c->filekey);
+		r = deletebatch_deletefile(batch, c);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			continue;
+		if (c->mode == NULL) {
+			r = files_remove(c->filekey);
+			RET_UPDATE(result, r);
+			continue;
+		}
+		r = files_removesilent(c->filekey);
 		RET_UPDATE(result, r);
 		/* don't remove pl_ADDED here, otherwise the hook
 		 * script will be told to remove something not added */
 		if (!RET_WAS_ERROR(r))
-			*node &= ~pl_UNREFERENCED;
+			*c->mode &= ~pl_UNREFERENCED;
 		if (RET_IS_OK(r))
-			*node |= pl_DELETED;
+			*c->mode |= pl_DELETED;
 	}
-	RET_UPDATE(result, r);
-	free(filekey);
+	if (!global.keepdirectories)
+		deletebatch_removedirectories(batch);
+	return result;
 }
 
-static void removeunusednew_from_component(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	struct source_node *node;
-
-	if (which != leaf && which != postorder)
-		return;
+static retvalue collectchanges(struct deletebatch *batch, char mask, char value) {
+	retvalue result = RET_NOTHING, r;
+	size_t i;
 
-	if (interrupted())
-		return;
+	for (i = 0 ; i < file_changes_size ; i++) {
+		struct filechange *f = &file_changes[i];
 
-	node = *(struct source_node **)nodep;
-	sourcename = node->sourcename;
-	twalk(node->file_changes, removeunusednew2);
+		if (f->node == NULL || (*f->node & mask) != value)
+			continue;
+		r = deletebatch_add(batch, filechange_filekey(f), f->node,
+				(*f->node & pl_ADDED) != 0);
+		RET_UPDATE(result, r);
+	}
+	return result;
 }
 
-void pool_tidyadded(bool delete) {
-	component_t c;
+retvalue pool_removeunreferenced(bool delete) {
+	struct deletebatch batch;
+	long woulddelete_count;
+	retvalue r;
 
-	if (!delete && verbose < 0)
-		return;
+	if (!delete && verbose <= 0)
+		return RET_NOTHING;
 
-	result = RET_NOTHING;
-	first = true;
-	onlycount = !delete;
-	woulddelete_count = 0;
-	for (c = 1 ; c <= reserved_components ; c++) {
-		assert (file_changes_per_component != NULL);
-		current_component = c;
-		twalk(file_changes_per_component[c],
-				removeunusednew_from_component);
-	}
-	// this should not really happen at all, but better safe then sorry:
-	twalk(legacy_file_changes, removeunusednew);
-	if (!delete && woulddelete_count > 0) {
-		printf(
-"%lu files were added but not used.\n"
-"The next deleteunreferenced call will delete them.\n",
-			woulddelete_count);
+	deletebatch_init(&batch);
+	r = collectchanges(&batch, pl_UNREFERENCED, pl_UNREFERENCED);
+	if (!RET_WAS_ERROR(r))
+		r = deletebatch_checkreferences(&batch);
+	if (RET_WAS_ERROR(r)) {
+		deletebatch_done(&batch);
+		return r;
 	}
-	return;
-
+	if (delete)
+		r = deletebatch_execute(&batch,
+				"Deleting files no longer referenced...\n");
+	else {
+		r = RET_NOTHING;
+		woulddelete_count = deletebatch_countunused(&batch);
+		if (woulddelete_count > 0)
+			printf(
+"%lu files lost their last reference.\n"
+"(dumpunreferenced lists such files, use deleteunreferenced to delete them.)\n",
+				woulddelete_count);
+	}
+	deletebatch_done(&batch);
+	if (interrupted())
+		r = RET_ERROR_INTERRUPTED;
+	return r;
 }
 
-static void reportnewlegacyfiles(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	char *node;
+static retvalue collectfile(void *data, const char *filekey) {
+	return deletebatch_add(data, strdup(filekey), NULL, false);
+}
 
-	if (which != leaf && which != postorder)
-		return;
+retvalue pool_deleteunreferenced(void) {
+	struct deletebatch batch;
+	retvalue r;
 
-	node = *(char **)nodep;
-	/* only look at newly added and not already deleted */
-	if ((*node & (pl_ADDED|pl_DELETED)) != pl_ADDED)
-		return;
-	outhook_sendpool(atom_unknown, NULL, node + 1);
+	deletebatch_init(&batch);
+	r = files_foreach(collectfile, &batch);
+	if (!RET_WAS_ERROR(r))
+		r = deletebatch_checkreferences(&batch);
+	if (RET_IS_OK(r))
+		r = deletebatch_execute(&batch, NULL);
+	deletebatch_done(&batch);
+	return r;
 }
 
+void pool_tidyadded(bool delete) {
+	struct deletebatch batch;
+	long woulddelete_count;
+	retvalue r;
 
-static void reportnewproperfiles(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	char *node;
-
-	if (which != leaf && which != postorder)
+	if (!delete && verbose < 0)
 		return;
 
-	node = *(char **)nodep;
+	deletebatch_init(&batch);
 	/* only look at newly added and not already deleted */
-	if ((*node & (pl_ADDED|pl_DELETED)) != pl_ADDED)
+	r = collectchanges(&batch, pl_ADDED|pl_DELETED, pl_ADDED);
+	if (!RET_WAS_ERROR(r))
+		r = deletebatch_checkreferences(&batch);
+	if (RET_WAS_ERROR(r)) {
+		deletebatch_done(&batch);
 		return;
-	outhook_sendpool(current_component, sourcename, node + 1);
-}
+	}
+	if (delete)
+		(void)deletebatch_execute(&batch,
+"Deleting files just added to the pool but not used.\n"
+"(to avoid use --keepunusednewfiles next time)\n");
+	else {
+		woulddelete_count = deletebatch_countunused(&batch);
+		if (woulddelete_count > 0)
+			printf(
+"%lu files were added but not used.\n"
+"The next deleteunreferenced call will delete them.\n",
+				woulddelete_count);
+	}
+	deletebatch_done(&batch);
+	return;
 
-static void reportnewfiles(const void *nodep, const VISIT which, UNUSED(const int depth)) {
-	struct source_node *node;
+}
 
-	if (which != leaf && which != postorder)
-		return;
+/* sort by component and source name (strange filekeys last), so that
+ * the order does not depend on the hash table: */
+static int filechange_compare(const void *a, const void *b) {
+	const struct filechange *f1 = *(const struct filechange * const *)a;
+	const struct filechange *f2 = *(const struct filechange * const *)b;
+	int c;
 
-	node = *(struct source_node **)nodep;
-	sourcename = node->sourcename;
-	twalk(node->file_changes, reportnewproperfiles);
+	if (f1->source == NULL || f2->source == NULL) {
+		if (f1->source != f2->source)
+			return (f1->source == NULL) ? 1 : -1;
+	} else {
+		if (f1->component != f2->component)
+			return (f1->component < f2->component) ? -1 : 1;
+		if (f1->source != f2->source) {
+			c = strcmp(f1->source->name, f2->source->name);
+			if (c != 0)
+				return c;
+		}
+	}
+	return strcmp(f1->node + 1, f2->node + 1);
 }
 
 void pool_sendnewfiles(void) {
-	component_t c;
+	const struct filechange **newfiles;
+	size_t i, count = 0;
 
-	for (c = 1 ; c <= reserved_components ; c++) {
-		assert (file_changes_per_component != NULL);
-		current_component = c;
-		twalk(file_changes_per_component[c],
-				reportnewfiles);
+	if (file_changes_count == 0)
+		return;
+	newfiles = nNEW(file_changes_count, const struct filechange *);
+	if (FAILEDTOALLOC(newfiles))
+		return;
+	for (i = 0 ; i < file_changes_size ; i++) {
+		const struct filechange *f = &file_changes[i];
+
+		/* only look at newly added and not already deleted */
+		if (f->node == NULL ||
+				(*f->node & (pl_ADDED|pl_DELETED)) != pl_ADDED)
+			continue;
+		newfiles[count++] = f;
 	}
-	twalk(legacy_file_changes, reportnewlegacyfiles);
+	qsort(newfiles, count, sizeof(const struct filechange *),
+			filechange_compare);
+	for (i = 0 ; i < count ; i++) {
+		const struct filechange *f = newfiles[i];
+
+		if (f->source == NULL)
+			outhook_sendpool(atom_unknown, NULL, f->node + 1);
+		else
+			outhook_sendpool(f->component, f->source->name,
+					f->node + 1);
+	}
+	free(newfiles);
 	return;
 
 }
 
-#ifdef HAVE_TDESTROY
-static void sourcename_free(void *n) {
-	struct source_node *node = n;
-
-	tdestroy(node->file_changes, free);
-	free(node);
-}
-#endif
-
 void pool_free(void) {
-#ifdef HAVE_TDESTROY
-	component_t c;
+	while (arena != NULL) {
+		struct arenablock *b = arena;
 
-	for (c = 1 ; c <= reserved_components ; c++) {
-		tdestroy(file_changes_per_component[c], sourcename_free);
+		arena = b->next;
+		free(b);
 	}
-	reserved_components = 0;
-	free(file_changes_per_component);
-	file_changes_per_component = NULL;
-	tdestroy(legacy_file_changes, free);
-	legacy_file_changes = NULL;
-#endif
+	free(file_changes);
+	file_changes = NULL;
+	file_changes_size = 0;
+	file_changes_count = 0;
+	free(sourcenames);
+	sourcenames = NULL;
+	sourcenames_size = 0;
+	sourcenames_count = 0;
+	pool_havedereferenced = false;
+	pool_havedeleted = false;
 }
@@ -19,6 +19,9 @@ retvalue pool_markdeleted(const char *);
 /* Remove all files that lost their last reference, or only count them */
 retvalue pool_removeunreferenced(bool /*delete*/);
 
+/* Delete all files in the pool without references */
+retvalue pool_deleteunreferenced(void);
+
 /* Delete all added files that are not used, or only count them */
 void pool_tidyadded(bool deletenew);
 
@@ -28,6 +31,7 @@ retvalue pool_delete(const char *);
 /* notify outhook of new files */
 void pool_sendnewfiles(void);
 
-/* free all memory, to make valgrind happier */
+/* forget about all changes and free all memory
+ * (to start over in long running commands and to make valgrind happier) */
 void pool_free(void);
 #endif
@@ -803,7 +803,7 @@ static inline retvalue pull_searchformissing(/*@null@*/FILE *out, struct pull_ta
 	if (verbose > 2 && out != NULL)
 		fprintf(out, "  pulling into '%s'\n", p->target->identifier);
 	assert(p->upgradelist == NULL);
-	r = upgradelist_initialize(&p->upgradelist, p->target);
+	r = upgradelist_initialize(&p->upgradelist, p->target, NULL);
 	if (RET_WAS_ERROR(r))
 		return r;
 
@@ -182,6 +182,35 @@ retvalue references_remove(const char *neededby) {
 	return result;
 }
 
+/* call action for every file having references, sorted by filekey */
+retvalue references_foreachused(retvalue action(void *, const char *), void *privdata) {
+	struct cursor *cursor;
+	retvalue result, r;
+	const char *filekey;
+	void *data;
+	size_t len;
+
+	r = table_newglobaluniqcursor(rdb_references, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+
+	result = RET_NOTHING;
+	while (cursor_nexttempdata(rdb_references, cursor,
+				&filekey, &data, &len)) {
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
+		}
+		r = action(privdata, filekey);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	r = cursor_close(rdb_references, cursor);
+	RET_ENDUPDATE(result, r);
+	return result;
+}
+
 /* dump all references to stdout */
 retvalue references_dump(void) {
 	struct cursor *cursor;
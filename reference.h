@@ -41,6 +41,9 @@ retvalue references_decrement(const char * /*needed*/, const char * /*needey*/);
 /* check if an item is needed, returns RET_NOTHING if not */
 retvalue references_isused(const char *);
 
+/* call a function for each file with references, sorted by filekey */
+retvalue references_foreachused(retvalue (void *, const char *), void *);
+
 /* check if a reference is found as expected */
 retvalue references_check(const char * /*referee*/, const struct strlist */*what*/);
 
@@ -85,6 +85,8 @@ struct release {
 	/* the Release file in preperation
 	 * (only valid between _prepare and _finish) */
 	struct signedfile *signedfile;
+	/* the InRelease and Release.gpg entries until signed */
+	/*@dependent@*/struct release_entry *signedentry, *detachedentry;
 	/* the cache database for old files */
 	struct table *cachedb;
 };
@@ -1559,7 +1561,7 @@ static void omitunusedspecialreleaseentry(struct release *release, struct releas
 }
 
 /* Generate a main "Release" file for a distribution */
-retvalue release_prepare(struct release *release, struct distribution *distribution, bool onlyifneeded) {
+retvalue release_prepareunsigned(struct release *release, struct distribution *distribution, bool onlyifneeded) {
 	size_t s;
 	retvalue r;
 	char buffer[100], untilbuffer[100];
@@ -1704,7 +1706,7 @@ retvalue release_prepare(struct release *release, struct distribution *distribut
 			writechar('\n');
 		}
 	}
-	r = signedfile_create(release->signedfile,
+	r = signedfile_prepare(release->signedfile,
 			plainentry->fulltemporaryfilename,
 			&signedentry->fulltemporaryfilename,
 			&detachedentry->fulltemporaryfilename,
@@ -1714,11 +1716,50 @@ retvalue release_prepare(struct release *release, struct distribution *distribut
 		release->signedfile = NULL;
 		return r;
 	}
-	omitunusedspecialreleaseentry(release, signedentry);
-	omitunusedspecialreleaseentry(release, detachedentry);
+	release->signedentry = signedentry;
+	release->detachedentry = detachedentry;
 	return RET_OK;
 }
 
+void release_sign(struct release * const *releases, retvalue *results, int count) {
+	struct signedfile **files;
+	struct release *release;
+	int i;
+
+	files = nzNEW(count, struct signedfile *);
+	if (FAILEDTOALLOC(files)) {
+		for (i = 0 ; i < count ; i++)
+			results[i] = RET_ERROR_OOM;
+	} else {
+		for (i = 0 ; i < count ; i++)
+			files[i] = releases[i]->signedfile;
+		signedfiles_sign(files, results, count, global.jobs);
+		free(files);
+	}
+	for (i = 0 ; i < count ; i++) {
+		release = releases[i];
+		if (RET_WAS_ERROR(results[i])) {
+			signedfile_free(release->signedfile);
+			release->signedfile = NULL;
+			continue;
+		}
+		omitunusedspecialreleaseentry(release, release->signedentry);
+		omitunusedspecialreleaseentry(release, release->detachedentry);
+		release->signedentry = NULL;
+		release->detachedentry = NULL;
+	}
+}
+
+retvalue release_prepare(struct release *release, struct distribution *distribution, bool onlyifneeded) {
+	retvalue r;
+
+	r = release_prepareunsigned(release, distribution, onlyifneeded);
+	if (!RET_IS_OK(r))
+		return r;
+	release_sign(&release, &r, 1);
+	return r;
+}
+
 static inline void release_toouthook(struct release *release, struct distribution *distribution) {
 	struct release_entry *file;
 	char *reldir;
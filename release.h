@@ -63,6 +63,10 @@ retvalue release_directorydescription(struct release *, const struct distributio
 
 void release_free(/*@only@*/struct release *);
 retvalue release_prepare(struct release *, struct distribution *, bool /*onlyneeded*/);
+/* like release_prepare, but the Release file is signed by release_sign,
+ * which can sign those of multiple releases at the same time */
+retvalue release_prepareunsigned(struct release *, struct distribution *, bool /*onlyneeded*/);
+void release_sign(struct release * const *, /*@out@*/retvalue * /*results*/, int /*count*/);
 retvalue release_finish(/*@only@*/struct release *, struct distribution *);
 
 #endif
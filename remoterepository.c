@@ -24,6 +24,7 @@
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
+#include <time.h>
 
 #include "globals.h"
 #include "error.h"
@@ -40,6 +41,7 @@
 #include "uncompression.h"
 #include "diffindex.h"
 #include "rredpatch.h"
+#include "sharedcache.h"
 #include "remoterepository.h"
 
 /* This is code to handle lists from remote repositories.
@@ -67,6 +69,10 @@ struct remote_repository {
 	const char *method;
 	const char *fallback;
 	const struct strlist *config;
+	/* how many instances of the method to run in parallel */
+	unsigned int downloadworkers;
+	/* how many transient download failures to retry per run */
+	unsigned int downloadretries;
 
 	struct aptmethod *download;
 
@@ -97,6 +103,8 @@ struct remote_distribution {
 
 	/* linked list of key descriptions to check against, each must match */
 	struct signature_requirement *verify;
+	/* the same in textual form, to know if they changed */
+	struct strlist verifyrelease;
 
 	/* local copy of InRelease, Release and Release.gpg file,
 	 * only set if available */
@@ -104,6 +112,8 @@ struct remote_distribution {
 	char *releasefile;
 	char *releasegpgfile;
 	const char *usedreleasefile;
+	/* what was found in the last Release file that was checked */
+	char *seenfile;
 
 	/* filenames and checksums from the Release file */
 	struct checksumsarray remotefiles;
@@ -147,16 +157,25 @@ struct remote_index {
 
 	/* if using pdiffs, the content of the Packages.diff/Index: */
 	struct diffindex *diffindex;
-	/* the last patch queued to be applied */
-	char *patchfilename;
-	/*@dependant@*/const struct diffindex_patch *selectedpatch;
-	bool deletecompressedpatch;
+	/* the patches queued to be applied (all at once) */
+	struct pendingpatch *pendingpatches;
+	int pendingcount, patchesmissing;
+	bool patchesfailed;
 
 	bool queued;
 	bool needed;
 	bool got;
 };
 
+struct pendingpatch {
+	/*@dependant@*/struct remote_index *ri;
+	/*@dependant@*/const struct diffindex_patch *patch;
+	char *filename;
+	/* the patch, once downloaded and unpacked */
+	/*@null@*/struct rred_patch *loaded;
+	bool deletecompressed;
+};
+
 #define MAXPARTS 5
 struct cachedlistfile {
 	struct cachedlistfile *next;
@@ -169,11 +188,27 @@ struct cachedlistfile {
 };
 
 
+static void pendingpatches_free(struct remote_index *ri) {
+	int i;
+
+	for (i = 0 ; i < ri->pendingcount ; i++) {
+		struct pendingpatch *pp = &ri->pendingpatches[i];
+
+		if (pp->loaded != NULL)
+			patch_free(pp->loaded);
+		free(pp->filename);
+	}
+	free(ri->pendingpatches);
+	ri->pendingpatches = NULL;
+	ri->pendingcount = 0;
+	ri->patchesmissing = 0;
+}
+
 static void remote_index_free(/*@only@*/struct remote_index *i) {
 	if (i == NULL)
 		return;
 	free(i->cachefilename);
-	free(i->patchfilename);
+	pendingpatches_free(i);
 	free(i->filename_in_release);
 	diffindex_free(i->diffindex);
 	checksums_free(i->oldchecksums);
@@ -188,6 +223,8 @@ static void remote_distribution_free(/*@only@*/struct remote_distribution *d) {
 	free(d->inreleasefile);
 	free(d->releasefile);
 	free(d->releasegpgfile);
+	free(d->seenfile);
+	strlist_done(&d->verifyrelease);
 	free(d->suite_base_dir);
 	checksumsarray_done(&d->remotefiles);
 	while (d->indices != NULL) {
@@ -277,6 +314,8 @@ static /*@null@*/ struct cachedlistfile *cachedlistfile_new(const char *basefile
 				*p = (first - '0') << 4;
 			else if (first >= 'a' && first <= 'f')
 				*p = (first - 'a' + 10) << 4;
+			else if (first >= 'A' && first <= 'F')
+				*p = (first - 'A' + 10) << 4;
 			else {
 				c->partcount = 0;
 				return c;
@@ -285,6 +324,8 @@ static /*@null@*/ struct cachedlistfile *cachedlistfile_new(const char *basefile
 				*p |= (second - '0');
 			else if (second >= 'a' && second <= 'f')
 				*p |= (second - 'a' + 10);
+			else if (second >= 'A' && second <= 'F')
+				*p |= (second - 'A' + 10);
 			else {
 				c->partcount = 0;
 				return c;
@@ -337,6 +378,9 @@ retvalue cachedlists_scandir(/*@out@*/struct cachedlistfile **cachedfiles_p) {
 			continue;
 		if (namelen == 2 && r->d_name[0] == '.' && r->d_name[1] == '.')
 			continue;
+		/* partially downloaded pool files, see downloadcache.c */
+		if (namelen == 7 && memcmp(r->d_name, "partial", 7) == 0)
+			continue;
 		*next_p = cachedlistfile_new(r->d_name, namelen, listdirlen);
 		if (FAILEDTOALLOC(*next_p)) {
 			(void)closedir(dir);
@@ -367,7 +411,7 @@ static retvalue cachedlistfile_delete(struct cachedlistfile *old) {
 	return RET_OK;
 }
 
-struct remote_repository *remote_repository_prepare(const char *name, const char *method, const char *fallback, const struct strlist *config) {
+struct remote_repository *remote_repository_prepare(const char *name, const char *method, const char *fallback, const struct strlist *config, unsigned int downloadworkers, unsigned int downloadretries) {
 	struct remote_repository *n;
 
 	/* calling code ensures no two with the same name are created,
@@ -380,6 +424,8 @@ struct remote_repository *remote_repository_prepare(const char *name, const char
 	n->method = method;
 	n->fallback = fallback;
 	n->config = config;
+	n->downloadworkers = downloadworkers;
+	n->downloadretries = downloadretries;
 
 	n->next = repositories;
 	if (n->next != NULL)
@@ -572,6 +618,9 @@ retvalue remote_distribution_prepare(struct remote_repository *repository, const
 					verifyrelease);
 			if (RET_WAS_ERROR(r))
 				return r;
+			r = strlist_add_dup(&n->verifyrelease, verifyrelease);
+			if (RET_WAS_ERROR(r))
+				return r;
 		}
 		*out_p = n;
 		return RET_OK;
@@ -584,10 +633,13 @@ retvalue remote_distribution_prepare(struct remote_repository *repository, const
 	n->suite = strdup(suite);
 	n->ignorerelease = ignorerelease;
 	n->noinrelease = !getinrelease;
+	strlist_init(&n->verifyrelease);
 	if (verifyrelease != NULL) {
 		retvalue r;
 
 		r = signature_requirement_add(&n->verify, verifyrelease);
+		if (!RET_WAS_ERROR(r))
+			r = strlist_add_dup(&n->verifyrelease, verifyrelease);
 		if (RET_WAS_ERROR(r)) {
 			remote_distribution_free(n);
 			return r;
@@ -628,7 +680,12 @@ retvalue remote_distribution_prepare(struct remote_repository *repository, const
 		return RET_ERROR_OOM;
 	}
 	n->releasegpgfile = calc_addsuffix(n->releasefile, "gpg");
-	if (FAILEDTOALLOC(n->releasefile)) {
+	if (FAILEDTOALLOC(n->releasegpgfile)) {
+		remote_distribution_free(n);
+		return RET_ERROR_OOM;
+	}
+	n->seenfile = calc_addsuffix(n->releasefile, "seen");
+	if (FAILEDTOALLOC(n->seenfile)) {
 		remote_distribution_free(n);
 		return RET_ERROR_OOM;
 	}
@@ -752,7 +809,9 @@ retvalue remote_startup(struct aptmethodrun *run) {
 
 		r = aptmethod_newmethod(run,
 				rr->method, rr->fallback,
-				rr->config, &rr->download);
+				rr->config, rr->downloadworkers,
+				rr->downloadretries,
+				&rr->download);
 		if (RET_WAS_ERROR(r))
 			return r;
 	}
@@ -831,14 +890,149 @@ static inline retvalue release_getchecksums(const char *releasefile, const char
 	return r;
 }
 
+/* To not have to check the signatures of the same Release file again
+ * and again, the seen file stores the checksums of the (In)Release file
+ * (and Release.gpg) that was last processed successfully, what it was
+ * checked against (the conditions, the keyring and ignored problems),
+ * until when the signatures and keys are valid and the content of the
+ * Release file found.
+ * calc_releaseidentity generates the first part, that must match: */
+static retvalue calc_releaseidentity(const struct remote_distribution *rd, /*@out@*/char **identity_p) {
+	struct checksums *release, *gpg = NULL;
+	const char *rc, *gc = "-";
+	size_t rlen, glen = 1;
+	char *verify, *identity, *state = NULL;
+	retvalue r;
+
+	if (rd->verify != NULL) {
+		r = signature_checkstate(&state);
+		/* if unknown, checking them again is the only option */
+		if (!RET_IS_OK(r))
+			return r;
+	}
+	r = checksums_read(rd->noinrelease ? rd->releasefile :
+			rd->inreleasefile, &release);
+	if (!RET_IS_OK(r)) {
+		free(state);
+		return r;
+	}
+	if (rd->noinrelease && rd->verify != NULL) {
+		r = checksums_read(rd->releasegpgfile, &gpg);
+		if (!RET_IS_OK(r)) {
+			checksums_free(release);
+			free(state);
+			return r;
+		}
+		r = checksums_getcombined(gpg, &gc, &glen);
+		assert (r != RET_NOTHING);
+	}
+	if (!RET_WAS_ERROR(r))
+		r = checksums_getcombined(release, &rc, &rlen);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		checksums_free(gpg);
+		checksums_free(release);
+		free(state);
+		return r;
+	}
+	verify = strlist_concat(&rd->verifyrelease, "", "|", "");
+	if (FAILEDTOALLOC(verify)) {
+		checksums_free(gpg);
+		checksums_free(release);
+		free(state);
+		return RET_ERROR_OOM;
+	}
+	identity = mprintf("%.*s %.*s\n%s\n%s\n", (int)rlen, rc,
+			(int)glen, gc, verify,
+			(state != NULL) ? state : "-");
+	free(verify);
+	free(state);
+	checksums_free(gpg);
+	checksums_free(release);
+	if (FAILEDTOALLOC(identity))
+		return RET_ERROR_OOM;
+	*identity_p = identity;
+	return RET_OK;
+}
+
+/* if that Release file was already checked, return what was found */
+static retvalue read_seenfile(const struct remote_distribution *rd, const char *identity, /*@out@*/char **releasedata_p) {
+	char *seen;
+	size_t seenlen, l = strlen(identity);
+	long long until;
+	int ofs;
+	retvalue r;
+
+	if (!isregularfile(rd->seenfile))
+		return RET_NOTHING;
+	r = readtextfile(rd->seenfile, rd->seenfile, &seen, &seenlen);
+	if (!RET_IS_OK(r))
+		return r;
+	if (seenlen <= l || memcmp(seen, identity, l) != 0) {
+		free(seen);
+		return RET_NOTHING;
+	}
+	ofs = 0;
+	if (sscanf(seen + l, "Valid-Until: %lld\n%n", &until, &ofs) < 1 ||
+			ofs == 0 ||
+			(until != 0 && until <= (long long)time(NULL))) {
+		free(seen);
+		return RET_NOTHING;
+	}
+	l += ofs;
+	memmove(seen, seen + l, seenlen - l + 1);
+	*releasedata_p = seen;
+	return RET_OK;
+}
+
+static retvalue write_seenfile(const struct remote_distribution *rd, const char *identity, time_t validuntil, const char *releasedata) {
+	char *seen;
+	retvalue r;
+
+	seen = mprintf("%sValid-Until: %lld\n%s", identity,
+			(long long)validuntil, releasedata);
+	if (FAILEDTOALLOC(seen))
+		return RET_ERROR_OOM;
+	(void)unlink(rd->seenfile);
+	r = checksums_replace(rd->seenfile, seen, strlen(seen), NULL);
+	free(seen);
+	return r;
+}
+
 static retvalue process_remoterelease(struct remote_distribution *rd) {
 	struct remote_repository *rr = rd->repository;
 	struct remote_index *ri;
 	retvalue r;
-	char *releasedata;
+	char *releasedata, *identity = NULL;
 	size_t releaselen;
+	time_t validuntil = 0;
 
-	if (!rd->noinrelease) {
+	r = calc_releaseidentity(rd, &identity);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (RET_IS_OK(r)) {
+		r = read_seenfile(rd, identity, &releasedata);
+		if (RET_WAS_ERROR(r)) {
+			free(identity);
+			return r;
+		}
+	}
+	if (RET_IS_OK(r)) {
+		/* unchanged since the last time, no need to check again */
+		free(identity);
+		identity = NULL;
+		rd->usedreleasefile = rd->noinrelease ?
+			rd->releasefile : rd->inreleasefile;
+		if (verbose > 1) {
+			char *date = NULL;
+
+			(void)chunk_getvalue(releasedata, "Date", &date);
+			printf("'%s' unchanged since last time (Date: %s).\n",
+					rd->usedreleasefile,
+					(date != NULL) ? date : "unknown");
+			free(date);
+		}
+	} else if (!rd->noinrelease) {
 		r = signature_check_inline(rd->verify,
 				rd->inreleasefile, &releasedata);
 		assert (r != RET_NOTHING);
@@ -850,15 +1044,20 @@ static retvalue process_remoterelease(struct remote_distribution *rd) {
 					rr->name, rr->method, rd->suite);
 			r = RET_ERROR_BADSIG;
 		}
-		if (RET_WAS_ERROR(r))
+		if (RET_WAS_ERROR(r)) {
+			free(identity);
 			return r;
+		}
+		validuntil = signature_lastvaliduntil();
 		rd->usedreleasefile = rd->inreleasefile;
 	} else {
 		r = readtextfile(rd->releasefile, rd->releasefile,
 				&releasedata, &releaselen);
 		assert (r != RET_NOTHING);
-		if (RET_WAS_ERROR(r))
+		if (RET_WAS_ERROR(r)) {
+			free(identity);
 			return r;
+		}
 		rd->usedreleasefile = rd->releasefile;
 
 		if (rd->verify != NULL) {
@@ -875,13 +1074,20 @@ static retvalue process_remoterelease(struct remote_distribution *rd) {
 				r = RET_ERROR_BADSIG;
 			}
 			if (RET_WAS_ERROR(r)) {
+				free(identity);
 				free(releasedata);
 				return r;
 			}
+			validuntil = signature_lastvaliduntil();
 		}
 	}
 	r = release_getchecksums(rd->usedreleasefile, releasedata,
 			rd->ignorehashes, &rd->remotefiles);
+	/* only remember what could be used, failing to remember
+	 * only costs time the next time */
+	if (identity != NULL && !RET_WAS_ERROR(r))
+		(void)write_seenfile(rd, identity, validuntil, releasedata);
+	free(identity);
 	free(releasedata);
 	if (RET_WAS_ERROR(r))
 		return r;
@@ -1232,6 +1438,7 @@ static inline retvalue remove_old_uncompressed(struct remote_index *ri) {
 }
 
 static retvalue queue_next_encoding(struct remote_distribution *rd, struct remote_index *ri);
+static retvalue indexfile_mark_got(struct remote_distribution *, struct remote_index *, /*@null@*/const struct checksums *);
 
 // TODO: check if this still makes sense.
 // (might be left over to support switching from older versions
@@ -1411,6 +1618,33 @@ static retvalue queue_next_encoding(struct remote_distribution *rd, struct remot
 		if (RET_WAS_ERROR(r))
 			return r;
 	}
+
+	/* some other rule might already have downloaded the same file */
+	if (ri->ofs[ri->compression] >= 0) {
+		char *filename;
+
+		filename = mprintf("%s%s", ri->cachefilename,
+				uncompression_suffix[ri->compression]);
+		if (FAILEDTOALLOC(filename))
+			return RET_ERROR_OOM;
+		r = sharedcache_get(
+			rd->remotefiles.checksums[ri->ofs[ri->compression]],
+			filename);
+		if (RET_IS_OK(r)) {
+			ri->queued = true;
+			if (ri->compression == c_none)
+				r = indexfile_mark_got(rd, ri, NULL);
+			else {
+				r = remove_old_uncompressed(ri);
+				if (!RET_WAS_ERROR(r))
+					r = reuse_old_compressed_index(rd, ri,
+						ri->compression, filename);
+			}
+		}
+		free(filename);
+		if (r != RET_NOTHING)
+			return r;
+	}
 /* as those checksums might be overwritten with completed data,
  * this assumes that the uncompressed checksums for one index is never
  * the compressed checksum for another... */
@@ -1805,6 +2039,9 @@ static retvalue index_callback(enum queue_action action, void *privdata, UNUSED(
 		}
 		if (readchecksums != NULL)
 			gotchecksums = readchecksums;
+		/* verified, so other rules can use it, too */
+		sharedcache_add(gotfilename, (gotchecksums != NULL)
+				? gotchecksums : wantedchecksums);
 	}
 
 	if (ri->compression == c_none) {
@@ -1833,13 +2070,13 @@ static queue_callback diff_got_callback;
 static retvalue queue_next_diff(struct remote_index *ri) {
 	struct remote_distribution *rd = ri->from;
 	struct remote_repository *rr = rd->repository;
-	int i;
+	int i, first, count;
 	retvalue r;
 
-	for (i = 0 ; i < ri->diffindex->patchcount ; i++) {
+	for (first = 0 ; first < ri->diffindex->patchcount ; first++) {
 		bool improves;
-		struct diffindex_patch *p = &ri->diffindex->patches[i];
-		char *patchsuffix, *c;
+		const struct diffindex_patch *p =
+			&ri->diffindex->patches[first];
 
 		if (p->done || p->frompackages == NULL)
 			continue;
@@ -1850,15 +2087,44 @@ static retvalue queue_next_diff(struct remote_index *ri) {
 		/* p->frompackages should only have sha1 and oldchecksums
 		 * should definitly list a sha1 hash */
 		assert (!improves);
+		break;
+	}
+	if (first >= ri->diffindex->patchcount) {
+		/* no patch matches, try next possibility... */
+		fprintf(stderr,
+"Error: available '%s' not listed in '%s.diffindex'.\n",
+				ri->cachefilename, ri->cachefilename);
+		return queue_next_encoding(rd, ri);
+	}
 
-		p->done = true;
+	/* all the following patches are needed, too, so request them
+	 * all now and apply them at once when all are there: */
+	count = 0;
+	while (first + count < ri->diffindex->patchcount &&
+			!ri->diffindex->patches[first + count].done)
+		count++;
 
-		free(ri->patchfilename);
-		ri->patchfilename = mprintf("%s.diff-%s", ri->cachefilename,
+	pendingpatches_free(ri);
+	ri->pendingpatches = nzNEW(count, struct pendingpatch);
+	if (FAILEDTOALLOC(ri->pendingpatches))
+		return RET_ERROR_OOM;
+	ri->pendingcount = count;
+	ri->patchesmissing = count;
+	ri->patchesfailed = false;
+
+	for (i = 0 ; i < count ; i++) {
+		struct diffindex_patch *p = &ri->diffindex->patches[first + i];
+		struct pendingpatch *pp = &ri->pendingpatches[i];
+		char *patchsuffix, *c;
+
+		p->done = true;
+		pp->ri = ri;
+		pp->patch = p;
+		pp->filename = mprintf("%s.diff-%s", ri->cachefilename,
 				p->name);
-		if (FAILEDTOALLOC(ri->patchfilename))
+		if (FAILEDTOALLOC(pp->filename))
 			return RET_ERROR_OOM;
-		c = ri->patchfilename + strlen(ri->cachefilename);
+		c = pp->filename + strlen(ri->cachefilename);
 		while (*c != '\0') {
 			if ((*c < '0' || *c > '9')
 					&& (*c < 'A' || *c > 'Z')
@@ -1867,63 +2133,54 @@ static retvalue queue_next_diff(struct remote_index *ri) {
 				*c = '_';
 			c++;
 		}
-		ri->selectedpatch = p;
 		patchsuffix = mprintf(".diff/%s.gz", p->name);
 		if (FAILEDTOALLOC(patchsuffix))
 			return RET_ERROR_OOM;
 
-		/* found a matching patch, tell the downloader we want it */
+		/* tell the downloader we want it */
 		r = aptmethod_enqueueindex(rr->download, rd->suite_base_dir,
 				ri->filename_in_release,
 				patchsuffix,
-				ri->patchfilename, ".gz",
-				diff_got_callback, ri, p);
+				pp->filename, ".gz",
+				diff_got_callback, pp, NULL);
 		free(patchsuffix);
-		return r;
+		if (RET_WAS_ERROR(r))
+			return r;
 	}
-	/* no patch matches, try next possibility... */
-	fprintf(stderr, "Error: available '%s' not listed in '%s.diffindex'.\n",
-			ri->cachefilename, ri->cachefilename);
-	return queue_next_encoding(rd, ri);
+	return RET_OK;
 }
 
-static retvalue diff_uncompressed(void *privdata, const char *compressed, bool failed) {
-	struct remote_index *ri = privdata;
+/* combine all patches (in order) into one and apply it to the old file */
+static retvalue apply_patches(struct remote_index *ri) {
 	struct remote_distribution *rd = ri->from;
-	const struct diffindex_patch *p = ri->selectedpatch;
+	struct modification *combined = NULL, *m;
 	char *tempfilename;
-	struct rred_patch *rp;
 	FILE *f;
 	int i;
 	retvalue r;
 	bool dummy;
 
-	if (ri->deletecompressedpatch)
-		(void)unlink(compressed);
-	if (failed)
-		return RET_ERROR;
+	for (i = 0 ; i < ri->pendingcount ; i++) {
+		assert (ri->pendingpatches[i].loaded != NULL);
 
-	r = checksums_test(ri->patchfilename, p->checksums, NULL);
-	if (r == RET_NOTHING) {
-		fprintf(stderr, "Mysteriously vanished file '%s'!\n",
-				ri->patchfilename);
-		r = RET_ERROR_MISSING;
+		m = patch_getmodifications(ri->pendingpatches[i].loaded);
+		if (m == NULL)
+			continue;
+		if (combined == NULL) {
+			combined = m;
+			continue;
+		}
+		r = combine_patches(&combined, combined, m);
+		if (RET_WAS_ERROR(r)) {
+			pendingpatches_free(ri);
+			return r;
+		}
 	}
-	if (r == RET_ERROR_WRONG_MD5)
-		fprintf(stderr, "Corrupted package diff '%s'!\n",
-				ri->patchfilename);
-	if (RET_WAS_ERROR(r))
-		return r;
-
-	r = patch_load(ri->patchfilename,
-			checksums_getfilesize(p->checksums), &rp);
-	ASSERT_NOT_NOTHING(r);
-	if (RET_WAS_ERROR(r))
-		return r;
 
 	tempfilename = calc_addsuffix(ri->cachefilename, "tmp");
 	if (FAILEDTOALLOC(tempfilename)) {
-		patch_free(rp);
+		modification_freelist(combined);
+		pendingpatches_free(ri);
 		return RET_ERROR_OOM;
 	}
 	(void)unlink(tempfilename);
@@ -1934,7 +2191,8 @@ static retvalue diff_uncompressed(void *privdata, const char *compressed, bool f
 				e, ri->cachefilename, tempfilename,
 				strerror(e));
 		free(tempfilename);
-		patch_free(rp);
+		modification_freelist(combined);
+		pendingpatches_free(ri);
 		return RET_ERRNO(e);
 	}
 	f = fopen(ri->cachefilename, "w");
@@ -1946,16 +2204,16 @@ static retvalue diff_uncompressed(void *privdata, const char *compressed, bool f
 		ri->olduncompressed->deleted = true;
 		ri->olduncompressed = NULL;
 		free(tempfilename);
-		patch_free(rp);
+		modification_freelist(combined);
+		pendingpatches_free(ri);
 		return RET_ERRNO(e);
 	}
-	r = patch_file(f, tempfilename, patch_getconstmodifications(rp));
+	r = patch_file(f, tempfilename, combined);
 	(void)unlink(tempfilename);
-	(void)unlink(ri->patchfilename);
-	free(ri->patchfilename);
-	ri->patchfilename = NULL;
 	free(tempfilename);
-	patch_free(rp);
+	modification_freelist(combined);
+	/* the modifications point into the patches, so only now: */
+	pendingpatches_free(ri);
 	if (RET_WAS_ERROR(r)) {
 		(void)fclose(f);
 		remove_old_uncompressed(ri);
@@ -1997,24 +2255,84 @@ static retvalue diff_uncompressed(void *privdata, const char *compressed, bool f
 		/* we have a winner */
 		return indexfile_mark_got(rd, ri, ri->oldchecksums);
 	}
-	/* let's see what patch we need next */
+	/* let's see if there is some other patch to apply */
 	return queue_next_diff(ri);
 }
 
+static retvalue diff_uncompressed(void *privdata, const char *compressed, bool failed) {
+	struct pendingpatch *pp = privdata;
+	struct remote_index *ri = pp->ri;
+	const struct diffindex_patch *p = pp->patch;
+	retvalue r;
+
+	if (pp->deletecompressed)
+		(void)unlink(compressed);
+	if (ri->patchesfailed) {
+		/* some other patch failed, so this one is not needed */
+		(void)unlink(pp->filename);
+		return RET_NOTHING;
+	}
+	if (failed) {
+		ri->patchesfailed = true;
+		(void)unlink(pp->filename);
+		return RET_ERROR;
+	}
+
+	r = checksums_test(pp->filename, p->checksums, NULL);
+	if (r == RET_NOTHING) {
+		fprintf(stderr, "Mysteriously vanished file '%s'!\n",
+				pp->filename);
+		r = RET_ERROR_MISSING;
+	}
+	if (r == RET_ERROR_WRONG_MD5)
+		fprintf(stderr, "Corrupted package diff '%s'!\n",
+				pp->filename);
+	if (!RET_WAS_ERROR(r)) {
+		r = patch_load(pp->filename,
+				checksums_getfilesize(p->checksums),
+				&pp->loaded);
+		ASSERT_NOT_NOTHING(r);
+	}
+	/* once loaded, the file is no longer needed */
+	(void)unlink(pp->filename);
+	if (RET_WAS_ERROR(r)) {
+		ri->patchesfailed = true;
+		return r;
+	}
+
+	assert (ri->patchesmissing > 0);
+	ri->patchesmissing--;
+	if (ri->patchesmissing > 0)
+		return RET_OK;
+	return apply_patches(ri);
+}
+
 static retvalue diff_got_callback(enum queue_action action, void *privdata, UNUSED(void *privdata2), UNUSED(const char *uri), const char *gotfilename, const char *wantedfilename, UNUSED(/*@null@*/const struct checksums *gotchecksums), UNUSED(const char *methodname)) {
-	struct remote_index *ri = privdata;
+	struct pendingpatch *pp = privdata;
+	struct remote_index *ri = pp->ri;
 	retvalue r;
 
-	if (action == qa_error)
+	if (ri->patchesfailed) {
+		/* already given up on patches for this file */
+		if (action == qa_got && strcmp(gotfilename,
+					wantedfilename) == 0)
+			(void)unlink(gotfilename);
+		return RET_NOTHING;
+	}
+	if (action == qa_error) {
+		ri->patchesfailed = true;
 		return queue_next_encoding(ri->from, ri);
+	}
 	if (action != qa_got)
 		return RET_ERROR;
 
-	ri->deletecompressedpatch = strcmp(gotfilename, wantedfilename) == 0;
-	r = uncompress_queue_file(gotfilename, ri->patchfilename,
-			c_gzip, diff_uncompressed, ri);
-	if (RET_WAS_ERROR(r))
+	pp->deletecompressed = strcmp(gotfilename, wantedfilename) == 0;
+	r = uncompress_queue_file(gotfilename, pp->filename,
+			c_gzip, diff_uncompressed, pp);
+	if (RET_WAS_ERROR(r)) {
+		ri->patchesfailed = true;
 		(void)unlink(gotfilename);
+	}
 	return r;
 }
 
@@ -20,7 +20,7 @@ struct remote_distribution;
 struct remote_index;
 
 /* register repository, strings as stored by reference */
-struct remote_repository *remote_repository_prepare(const char * /*name*/, const char * /*method*/, const char * /*fallback*/, const struct strlist * /*config*/);
+struct remote_repository *remote_repository_prepare(const char * /*name*/, const char * /*method*/, const char * /*fallback*/, const struct strlist * /*config*/, unsigned int /*downloadworkers*/, unsigned int /*downloadretries*/);
 
 /* register remote distribution of the given repository */
 retvalue remote_distribution_prepare(struct remote_repository *, const char * /*suite*/, bool /*ignorerelease*/, bool /*getinrelease*/, const char * /*verifyrelease*/, bool /*flat*/, bool * /*ignorehashes*/, /*@out@*/struct remote_distribution **);
@@ -0,0 +1,327 @@
+/*  This file is part of "reprepro"
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "error.h"
+#include "mprintf.h"
+#include "names.h"
+#include "dirs.h"
+#include "checksums.h"
+#include "sharedcache.h"
+
+/* The shared cache is a directory (--sharedcachedir) containing every
+ * file downloaded as <first two digits of sha256>/<sha256>.
+ * As the name only depends on the content, it can be shared by all
+ * update rules and by multiple repositories.
+ * Files are hardlinked into and out of the cache where possible, so a
+ * file both in the cache and in a pool only takes space once.
+ * (Thus the inode's ctime tells when the file was last put somewhere,
+ * which is used to decide what to delete first.) */
+
+bool sharedcache_haveadded = false;
+
+static retvalue calc_cachefilename(const struct checksums *checksums, /*@out@*/char **filename_p) {
+	const char *hash;
+	size_t len;
+	char *filename;
+
+	if (global.sharedcachedir == NULL)
+		return RET_NOTHING;
+	if (!checksums_getpart(checksums, cs_sha256sum, &hash, &len)
+			|| len < 2)
+		return RET_NOTHING;
+	filename = mprintf("%s/%.2s/%.*s", global.sharedcachedir,
+			hash, (int)len, hash);
+	if (FAILEDTOALLOC(filename))
+		return RET_ERROR_OOM;
+	*filename_p = filename;
+	return RET_OK;
+}
+
+/* like link(2), but create the directory of newpath if needed */
+static int makelink(const char *oldpath, const char *newpath) {
+	int e;
+
+	if (link(oldpath, newpath) == 0)
+		return 0;
+	e = errno;
+	if (e != ENOENT)
+		return e;
+	if (RET_WAS_ERROR(dirs_make_parent(newpath)))
+		return e;
+	if (link(oldpath, newpath) == 0)
+		return 0;
+	return errno;
+}
+
+retvalue sharedcache_get(const struct checksums *checksums, const char *destination) {
+	struct checksums *copied;
+	struct stat s;
+	char *filename;
+	retvalue r;
+	int e;
+
+	r = calc_cachefilename(checksums, &filename);
+	if (!RET_IS_OK(r))
+		return r;
+	if (lstat(filename, &s) != 0 || !S_ISREG(s.st_mode) ||
+			s.st_size != checksums_getfilesize(checksums)) {
+		free(filename);
+		return RET_NOTHING;
+	}
+	(void)unlink(destination);
+	e = makelink(filename, destination);
+	copied = NULL;
+	if (e == EXDEV || e == EPERM || e == EMLINK) {
+		r = checksums_copyfile(destination, filename, true, &copied);
+	} else if (e == ENOENT) {
+		/* was just removed by someone else */
+		free(filename);
+		return RET_NOTHING;
+	} else if (e != 0) {
+		fprintf(stderr, "Error %d linking '%s' to '%s': %s\n",
+				e, filename, destination, strerror(e));
+		free(filename);
+		return RET_ERRNO(e);
+	} else
+		/* only the size was looked at yet */
+		r = checksums_read(destination, &copied);
+	if (RET_IS_OK(r) && !checksums_check(checksums, copied, NULL)) {
+		fprintf(stderr,
+"Warning: '%s' does not have the expected checksums, removing it.\n",
+				filename);
+		(void)unlink(filename);
+		r = RET_NOTHING;
+	}
+	checksums_free(copied);
+	if (!RET_IS_OK(r)) {
+		(void)unlink(destination);
+		free(filename);
+		return r;
+	}
+	if (verbose > 1)
+		fprintf(stderr, "Got '%s' from the shared cache.\n",
+				destination);
+	free(filename);
+	return RET_OK;
+}
+
+static retvalue addfile(const char *source, const struct checksums *checksums) {
+	struct checksums *copied = NULL;
+	char *filename, *tempfilename;
+	retvalue r;
+	int e;
+
+	r = calc_cachefilename(checksums, &filename);
+	if (!RET_IS_OK(r))
+		return r;
+	e = makelink(source, filename);
+	if (e == EEXIST) {
+		free(filename);
+		return RET_NOTHING;
+	}
+	if (e == EXDEV || e == EPERM || e == EMLINK) {
+		/* copy to a temporary name first, so nothing else ever
+		 * sees an incomplete file: */
+		tempfilename = mprintf("%s.new%ld", filename, (long)getpid());
+		if (FAILEDTOALLOC(tempfilename)) {
+			free(filename);
+			return RET_ERROR_OOM;
+		}
+		r = checksums_copyfile(tempfilename, source, true, &copied);
+		checksums_free(copied);
+		if (RET_IS_OK(r) && rename(tempfilename, filename) != 0) {
+			e = errno;
+			fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
+					e, tempfilename, filename, strerror(e));
+			(void)unlink(tempfilename);
+			r = RET_ERRNO(e);
+		}
+		free(tempfilename);
+		if (!RET_IS_OK(r)) {
+			free(filename);
+			return r;
+		}
+	} else if (e != 0) {
+		fprintf(stderr, "Error %d linking '%s' to '%s': %s\n",
+				e, source, filename, strerror(e));
+		free(filename);
+		return RET_ERRNO(e);
+	}
+	if (verbose > 5)
+		fprintf(stderr, "Added '%s' to the shared cache.\n", source);
+	sharedcache_haveadded = true;
+	free(filename);
+	return RET_OK;
+}
+
+void sharedcache_add(const char *source, const struct checksums *checksums) {
+	retvalue r;
+
+	r = addfile(source, checksums);
+	/* the file itself is fine, so only the cache is missing out */
+	if (RET_WAS_ERROR(r))
+		fprintf(stderr,
+"Warning: could not add '%s' to the shared cache!\n", source);
+}
+
+struct cachedfile {
+	time_t ctime;
+	off_t size;
+	char *filename;
+};
+
+static int cachedfile_compare(const void *a, const void *b) {
+	const struct cachedfile *f1 = a, *f2 = b;
+
+	return (f1->ctime > f2->ctime) - (f1->ctime < f2->ctime);
+}
+
+/* collect all files in one subdirectory only linked from the cache */
+static retvalue readsubdir(const char *dirname, struct cachedfile **files_p, size_t *count_p, size_t *size_p, off_t *total_p) {
+	DIR *dir;
+	struct dirent *ent;
+	struct stat s;
+	retvalue r = RET_OK;
+
+	dir = opendir(dirname);
+	if (dir == NULL) {
+		int e = errno;
+		fprintf(stderr, "Error %d opening directory '%s': %s\n",
+				e, dirname, strerror(e));
+		return RET_ERRNO(e);
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		char *filename;
+
+		if (ent->d_name[0] == '.')
+			continue;
+		filename = calc_dirconcat(dirname, ent->d_name);
+		if (FAILEDTOALLOC(filename)) {
+			r = RET_ERROR_OOM;
+			break;
+		}
+		/* files still somewhere else (like in the pool) take
+		 * no space of their own, so are left alone */
+		if (lstat(filename, &s) != 0 || !S_ISREG(s.st_mode)
+				|| s.st_nlink > 1) {
+			free(filename);
+			continue;
+		}
+		if (*count_p >= *size_p) {
+			struct cachedfile *n;
+
+			*size_p = (*size_p == 0) ? 256 : 2 * *size_p;
+			n = realloc(*files_p,
+					*size_p * sizeof(struct cachedfile));
+			if (FAILEDTOALLOC(n)) {
+				free(filename);
+				r = RET_ERROR_OOM;
+				break;
+			}
+			*files_p = n;
+		}
+		(*files_p)[*count_p].ctime = s.st_ctime;
+		(*files_p)[*count_p].size = s.st_size;
+		(*files_p)[*count_p].filename = filename;
+		(*count_p)++;
+		*total_p += s.st_size;
+	}
+	(void)closedir(dir);
+	return r;
+}
+
+retvalue sharedcache_gc(off_t maxsize) {
+	struct cachedfile *files = NULL;
+	size_t count = 0, size = 0, i;
+	off_t total = 0;
+	long evicted = 0;
+	DIR *dir;
+	struct dirent *ent;
+	retvalue result, r;
+
+	if (global.sharedcachedir == NULL || maxsize <= 0)
+		return RET_NOTHING;
+
+	dir = opendir(global.sharedcachedir);
+	if (dir == NULL) {
+		int e = errno;
+		if (e == ENOENT)
+			return RET_NOTHING;
+		fprintf(stderr, "Error %d opening directory '%s': %s\n",
+				e, global.sharedcachedir, strerror(e));
+		return RET_ERRNO(e);
+	}
+	r = RET_OK;
+	while ((ent = readdir(dir)) != NULL) {
+		char *dirname;
+
+		if (ent->d_name[0] == '.' || strlen(ent->d_name) != 2)
+			continue;
+		dirname = calc_dirconcat(global.sharedcachedir, ent->d_name);
+		if (FAILEDTOALLOC(dirname)) {
+			r = RET_ERROR_OOM;
+			break;
+		}
+		r = readsubdir(dirname, &files, &count, &size, &total);
+		free(dirname);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	(void)closedir(dir);
+
+	result = RET_NOTHING;
+	if (!RET_WAS_ERROR(r))
+		qsort(files, count, sizeof(struct cachedfile),
+				cachedfile_compare);
+	for (i = 0 ; RET_WAS_NO_ERROR(r) && i < count && total > maxsize ;
+			i++) {
+		if (interrupted()) {
+			r = RET_ERROR_INTERRUPTED;
+			break;
+		}
+		if (verbose > 1)
+			printf("removing %s from the shared cache\n",
+					files[i].filename);
+		if (unlink(files[i].filename) != 0 && errno != ENOENT) {
+			int e = errno;
+			fprintf(stderr, "Error %d deleting '%s': %s\n",
+					e, files[i].filename, strerror(e));
+			RET_UPDATE(result, RET_ERRNO(e));
+		} else {
+			total -= files[i].size;
+			evicted++;
+			RET_UPDATE(result, RET_OK);
+		}
+	}
+	RET_ENDUPDATE(result, r);
+	if (verbose >= 0 && evicted > 0)
+		printf(
+"Removed %ld files from the shared cache, %lld bytes left.\n",
+				evicted, (long long)total);
+	for (i = 0 ; i < count ; i++)
+		free(files[i].filename);
+	free(files);
+	return result;
+}
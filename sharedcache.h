@@ -0,0 +1,25 @@
+#ifndef REPREPRO_SHAREDCACHE_H
+#define REPREPRO_SHAREDCACHE_H
+
+#ifndef REPREPRO_ERROR_H
+#include "error.h"
+#endif
+#ifndef REPREPRO_CHECKSUMS_H
+#include "checksums.h"
+#endif
+
+/* set if files were added to the shared cache in this run */
+extern bool sharedcache_haveadded;
+
+/* if a file with those checksums is in the cache, put it at destination
+ * (as hardlink if possible), RET_NOTHING if not (or no cache is set) */
+retvalue sharedcache_get(const struct checksums *, const char * /*destination*/);
+
+/* remember a file just downloaded and checked to have the checksums,
+ * failing to do so only causes a warning */
+void sharedcache_add(const char * /*filename*/, const struct checksums *);
+
+/* delete the least recently used files only in the cache until those
+ * take at most maxsize bytes */
+retvalue sharedcache_gc(off_t /*maxsize*/);
+#endif
@@ -24,6 +24,9 @@
 #include <time.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "signature_p.h"
 #include "mprintf.h"
@@ -32,10 +35,23 @@
 #include "names.h"
 #include "chunks.h"
 #include "readtextfile.h"
+#include "ignore.h"
+#include "sha256.h"
+
+bool signature_askspassphrase = false;
 
 #ifdef HAVE_LIBGPGME
 gpgme_ctx_t context = NULL;
 
+/* where to remember what checking the signatures of some data found,
+ * NULL if that is not to be done: */
+static /*@null@*/ char *cachedir = NULL;
+/* description of the keyring as of the last lookup: */
+static /*@null@*/ char *keyringstate = NULL;
+/* the first time the currently checked signatures or the keys used may
+ * expire, after which a cached result can no longer be used (0 = never) */
+time_t signature_validuntil;
+
 retvalue gpgerror(gpg_error_t err) {
 	if (err != 0) {
 		fprintf(stderr, "gpgme gave error %s:%d:  %s\n",
@@ -83,9 +99,11 @@ retvalue signature_init(bool allowpassphrase){
 	err = gpgme_set_protocol(context, GPGME_PROTOCOL_OpenPGP);
 	if (err != 0)
 		return gpgerror(err);
-	if (allowpassphrase)
+	if (allowpassphrase) {
 		gpgme_set_passphrase_cb(context, signature_getpassphrase,
 				NULL);
+		signature_askspassphrase = true;
+	}
 	gpgme_set_armor(context, 1);
 #endif /* HAVE_LIBGPGME */
 	return RET_OK;
@@ -97,6 +115,37 @@ void signatures_done(void) {
 		gpgme_release(context);
 		context = NULL;
 	}
+	free(cachedir);
+	cachedir = NULL;
+	free(keyringstate);
+	keyringstate = NULL;
+#endif /* HAVE_LIBGPGME */
+}
+
+retvalue signature_cacheresults(const char *directory) {
+#ifdef HAVE_LIBGPGME
+	free(cachedir);
+	cachedir = calc_dirconcat(directory, "signatures");
+	if (FAILEDTOALLOC(cachedir))
+		return RET_ERROR_OOM;
+	return RET_OK;
+#else
+	return RET_NOTHING;
+#endif /* HAVE_LIBGPGME */
+}
+
+#ifdef HAVE_LIBGPGME
+void signature_noteexpiry(time_t t) {
+	if (t > 0 && (signature_validuntil == 0 || t < signature_validuntil))
+		signature_validuntil = t;
+}
+#endif /* HAVE_LIBGPGME */
+
+time_t signature_lastvaliduntil(void) {
+#ifdef HAVE_LIBGPGME
+	return signature_validuntil;
+#else
+	return 0;
 #endif /* HAVE_LIBGPGME */
 }
 
@@ -138,6 +187,7 @@ static retvalue checksigs(const char *filename, struct signatures **signatures_p
 	for (s = result->signatures ; s != NULL ; s = s->next) {
 		enum signature_state state = sist_error;
 
+		signature_noteexpiry(s->exp_timestamp);
 		if (signatures_p != NULL) {
 			sig->keyid = strdup(s->fpr);
 			if (FAILEDTOALLOC(sig->keyid)) {
@@ -270,6 +320,12 @@ static retvalue check_primary_keys(struct signatures *signatures) {
 				return RET_ERROR_GPGME;
 		}
 		assert (gpgme_key != NULL);
+		for (subkey = gpgme_key->subkeys ; subkey != NULL ;
+		                                   subkey = subkey->next) {
+			if (subkey == gpgme_key->subkeys || (subkey->fpr != NULL
+					&& strcmp(subkey->fpr, sig->keyid) == 0))
+				signature_noteexpiry(subkey->expires);
+		}
 		/* the first "sub"key is the primary key */
 		subkey = gpgme_key->subkeys;
 		if (subkey->revoked) {
@@ -425,6 +481,341 @@ static retvalue extract_signed_data(const char *buffer, size_t bufferlen, const
 }
 #endif /* HAVE_LIBGPGME */
 
+#ifdef HAVE_LIBGPGME
+/* The results of checking the signatures of some data are stored in
+ * <cachedir>/<sha256 of the data>, together with the keyring state they
+ * were found with and until when they are valid.  That way files looked at
+ * again (like .changes files left in an incoming directory) do not need
+ * gpg to be called again, while any change to the keyring makes all old
+ * results unusable. */
+
+#define CACHE_MAXAGE (30*24*60*60)
+
+static retvalue calc_keyringstate(void) {
+	static const char * const files[] = {
+		"pubring.kbx", "pubring.gpg", "trustdb.gpg",
+		"public-keys.d/pubring.db"
+	};
+	const char *home;
+	char *homedir = NULL, *state, *n, *fullfilename;
+	struct stat st;
+	size_t i;
+
+	/* recalculated every time, as the keyring may change while
+	 * running (e.g. in incomingd) */
+	free(keyringstate);
+	keyringstate = NULL;
+	home = getenv("GNUPGHOME");
+	if (home == NULL || home[0] == '\0') {
+		const char *h = getenv("HOME");
+
+		if (h == NULL)
+			/* no idea where the keyring is, so no caching */
+			return RET_NOTHING;
+		homedir = calc_dirconcat(h, ".gnupg");
+		if (FAILEDTOALLOC(homedir))
+			return RET_ERROR_OOM;
+		home = homedir;
+	}
+	state = strdup(home);
+	for (i = 0 ; state != NULL && i < ARRAYCOUNT(files) ; i++) {
+		fullfilename = calc_dirconcat(home, files[i]);
+		if (FAILEDTOALLOC(fullfilename)) {
+			free(state);
+			state = NULL;
+			break;
+		}
+		if (stat(fullfilename, &st) != 0)
+			n = mprintf("%s %s -", state, files[i]);
+		else
+			n = mprintf("%s %s %llu %llu %lld %lld", state, files[i],
+					(unsigned long long)st.st_ino,
+					(unsigned long long)st.st_size,
+					(long long)st.st_mtime,
+					(long long)st.st_ctime);
+		free(fullfilename);
+		free(state);
+		state = n;
+	}
+	free(homedir);
+	if (FAILEDTOALLOC(state))
+		return RET_ERROR_OOM;
+	if (strchr(state, '\n') != NULL) {
+		free(state);
+		return RET_NOTHING;
+	}
+	keyringstate = state;
+	return RET_OK;
+}
+
+static retvalue cache_filename(const char *buffer, size_t bufferlen, /*@out@*/char **filename_p) {
+	struct SHA256_Context context;
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	char hex[2*SHA256_DIGEST_SIZE + 1];
+	size_t i;
+	retvalue r;
+
+	r = calc_keyringstate();
+	if (!RET_IS_OK(r))
+		return r;
+	SHA256Init(&context);
+	SHA256Update(&context, (const uint8_t*)buffer, bufferlen);
+	SHA256Final(&context, digest);
+	for (i = 0 ; i < SHA256_DIGEST_SIZE ; i++)
+		sprintf(hex + 2*i, "%02x", (unsigned int)digest[i]);
+	*filename_p = calc_dirconcat(cachedir, hex);
+	if (FAILEDTOALLOC(*filename_p))
+		return RET_ERROR_OOM;
+	return RET_OK;
+}
+
+static bool parse_signatureline(const char *line, struct signature *sig) {
+	const char *p, *keyid;
+	int state;
+
+	if (line[0] < '0' || line[0] > '9' || line[1] != ' ')
+		return false;
+	state = line[0] - '0';
+	if (state > sist_valid)
+		return false;
+	sig->state = state;
+	p = line + 2;
+	if ((p[0] != '0' && p[0] != '1') || (p[1] != '0' && p[1] != '1') ||
+			(p[2] != '0' && p[2] != '1') || p[3] != ' ')
+		return false;
+	sig->expired_key = p[0] == '1';
+	sig->expired_signature = p[1] == '1';
+	sig->revoced_key = p[2] == '1';
+	keyid = p + 4;
+	p = strchr(keyid, ' ');
+	if (p == NULL || p == keyid || p[1] == '\0')
+		return false;
+	sig->keyid = strndup(keyid, p - keyid);
+	sig->primary_keyid = strdup(p + 1);
+	return true;
+}
+
+/* RET_NOTHING if there is no usable result */
+static retvalue cache_read(const char *filename, /*@out@*/char **chunk_p, /*@out@*/struct signatures **signatures_p, /*@out@*/bool *broken_p) {
+	struct signatures *signatures;
+	char *data, *p, *line, *chunk;
+	long long until;
+	int count = 0, i;
+	bool broken;
+	retvalue r;
+	int fd;
+
+	fd = open(filename, O_RDONLY|O_NOCTTY);
+	if (fd < 0)
+		return RET_NOTHING;
+	r = readtextfilefd(fd, filename, &data, NULL);
+	(void)close(fd);
+	if (r == RET_ERROR_OOM)
+		return r;
+	if (!RET_IS_OK(r))
+		return RET_NOTHING;
+
+	/* Keyring: <state>\nValid-Until: <time>\nBroken: <0/1>\n
+	 * Signatures: <count>\n<count lines>\n\n<chunk> */
+	line = data;
+	p = strchr(line, '\n');
+	if (p == NULL || strncmp(line, "Keyring: ", 9) != 0 ||
+			(size_t)(p - line - 9) != strlen(keyringstate) ||
+			strncmp(line + 9, keyringstate, p - line - 9) != 0) {
+		free(data);
+		return RET_NOTHING;
+	}
+	line = p + 1;
+	if (sscanf(line, "Valid-Until: %lld\nBroken: %d\nSignatures: %d\n",
+				&until, &i, &count) != 3 || count < 0 ||
+			count > 1000 || (i != 0 && i != 1) ||
+			(until != 0 && until <= (long long)time(NULL))) {
+		free(data);
+		return RET_NOTHING;
+	}
+	broken = i != 0;
+	for (i = 0 ; i < 3 && line != NULL ; i++) {
+		line = strchr(line, '\n');
+		if (line != NULL)
+			line++;
+	}
+	signatures = calloc(1, sizeof(struct signatures) +
+			count * sizeof(struct signature));
+	if (FAILEDTOALLOC(signatures)) {
+		free(data);
+		return RET_ERROR_OOM;
+	}
+	for (i = 0 ; i < count && line != NULL ; i++) {
+		struct signature *sig = &signatures->signatures[i];
+
+		p = strchr(line, '\n');
+		if (p == NULL)
+			break;
+		*p = '\0';
+		signatures->count++;
+		if (!parse_signatureline(line, sig))
+			break;
+		if (FAILEDTOALLOC(sig->keyid) ||
+				FAILEDTOALLOC(sig->primary_keyid)) {
+			signatures_free(signatures);
+			free(data);
+			return RET_ERROR_OOM;
+		}
+		if (sig->state == sist_valid)
+			signatures->validcount++;
+		line = p + 1;
+	}
+	if (i < count || line == NULL || line[0] != '\n' || line[1] == '\0') {
+		signatures_free(signatures);
+		free(data);
+		return RET_NOTHING;
+	}
+	chunk = strdup(line + 1);
+	free(data);
+	if (FAILEDTOALLOC(chunk)) {
+		signatures_free(signatures);
+		return RET_ERROR_OOM;
+	}
+	*chunk_p = chunk;
+	*signatures_p = signatures;
+	*broken_p = broken;
+	return RET_OK;
+}
+
+/* remove results not looked at for a long time */
+static void cache_prune(void) {
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	time_t now = time(NULL);
+	char *fullfilename;
+
+	dir = opendir(cachedir);
+	if (dir == NULL)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		fullfilename = calc_dirconcat(cachedir, ent->d_name);
+		if (FAILEDTOALLOC(fullfilename))
+			break;
+		if (stat(fullfilename, &st) == 0 && S_ISREG(st.st_mode) &&
+				st.st_mtime + CACHE_MAXAGE < now)
+			(void)unlink(fullfilename);
+		free(fullfilename);
+	}
+	(void)closedir(dir);
+}
+
+/* failing to store a result is not an error, it is just not stored */
+static void cache_write(const char *filename, const char *chunk, const struct signatures *signatures, bool broken) {
+	static bool pruned = false;
+	char *tempfilename;
+	FILE *f;
+	int i;
+	bool failed;
+
+	if (!pruned) {
+		if (RET_WAS_ERROR(dirs_make_recursive(cachedir)))
+			return;
+		cache_prune();
+		pruned = true;
+	}
+	tempfilename = calc_addsuffix(filename, "new");
+	if (FAILEDTOALLOC(tempfilename))
+		return;
+	f = fopen(tempfilename, "w");
+	if (f == NULL) {
+		free(tempfilename);
+		return;
+	}
+	fprintf(f, "Keyring: %s\nValid-Until: %lld\nBroken: %d\n"
+			"Signatures: %d\n",
+			keyringstate, (long long)signature_validuntil,
+			broken ? 1 : 0,
+			(signatures == NULL) ? 0 : signatures->count);
+	for (i = 0 ; signatures != NULL && i < signatures->count ; i++) {
+		const struct signature *sig = &signatures->signatures[i];
+
+		fprintf(f, "%d %d%d%d %s %s\n", (int)sig->state,
+				sig->expired_key ? 1 : 0,
+				sig->expired_signature ? 1 : 0,
+				sig->revoced_key ? 1 : 0,
+				sig->keyid, sig->primary_keyid);
+	}
+	fprintf(f, "\n%s", chunk);
+	failed = ferror(f) != 0;
+	if (fclose(f) != 0)
+		failed = true;
+	if (failed || rename(tempfilename, filename) != 0)
+		(void)unlink(tempfilename);
+	free(tempfilename);
+}
+
+static retvalue cached_signed_data(const char *buffer, size_t bufferlen, const char *filenametoshow, char **chunkread, /*@null@*/ /*@out@*/struct signatures **signatures_p, bool *brokensignature) {
+	struct signatures *signatures = NULL;
+	char *cachefile = NULL;
+	bool broken = false;
+	retvalue r;
+
+	if (cachedir == NULL)
+		return extract_signed_data(buffer, bufferlen, filenametoshow,
+				chunkread, signatures_p, brokensignature);
+
+	r = cache_filename(buffer, bufferlen, &cachefile);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (RET_IS_OK(r))
+		r = cache_read(cachefile, chunkread, &signatures, &broken);
+	if (RET_WAS_ERROR(r)) {
+		free(cachefile);
+		return r;
+	}
+	if (r == RET_NOTHING) {
+		/* always get everything, so that it can be stored */
+		signature_validuntil = 0;
+		r = extract_signed_data(buffer, bufferlen, filenametoshow,
+				chunkread, &signatures, &broken);
+		if (RET_IS_OK(r) && cachefile != NULL)
+			cache_write(cachefile, *chunkread, signatures, broken);
+	} else if (verbose > 5)
+		fprintf(stderr,
+"Using remembered result of checking the signatures of '%s'.\n",
+				filenametoshow);
+	free(cachefile);
+	if (!RET_IS_OK(r))
+		return r;
+	if (signatures_p != NULL)
+		*signatures_p = signatures;
+	else
+		signatures_free(signatures);
+	if (brokensignature != NULL)
+		*brokensignature = broken;
+	return RET_OK;
+}
+#endif /* HAVE_LIBGPGME */
+
+retvalue signature_checkstate(char **state_p) {
+#ifdef HAVE_LIBGPGME
+	char *state;
+	retvalue r;
+
+	r = calc_keyringstate();
+	if (!RET_IS_OK(r))
+		return r;
+	state = mprintf("%s ignore %d%d%d", keyringstate,
+			IGNORABLE(expiredkey) ? 1 : 0,
+			IGNORABLE(revokedkey) ? 1 : 0,
+			IGNORABLE(expiredsignature) ? 1 : 0);
+	if (FAILEDTOALLOC(state))
+		return RET_ERROR_OOM;
+	*state_p = state;
+	return RET_OK;
+#else
+	return RET_NOTHING;
+#endif /* HAVE_LIBGPGME */
+}
+
 /* Read a single chunk from a file, that may be signed. */
 retvalue signature_readsignedchunk(const char *filename, const char *filenametoshow, char **chunkread, /*@null@*/ /*@out@*/struct signatures **signatures_p, bool *brokensignature) {
 	char *chunk;
@@ -483,7 +874,7 @@ retvalue signature_readsignedchunk(const char *filename, const char *filenametos
 	}
 
 #ifdef HAVE_LIBGPGME
-	r = extract_signed_data(chunk, chunklen, filenametoshow, chunkread,
+	r = cached_signed_data(chunk, chunklen, filenametoshow, chunkread,
 			signatures_p, brokensignature);
 	if (r != RET_NOTHING) {
 		free(chunk);
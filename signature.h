@@ -10,6 +10,10 @@
  * argument will only take effect if called the first time */
 retvalue signature_init(bool allowpassphrase);
 
+/* remember results of checking signatures in <directory>/signatures/
+ * (RET_NOTHING if signatures are never checked) */
+retvalue signature_cacheresults(const char * /*directory*/);
+
 struct signature_requirement;
 void signature_requirements_free(/*@only@*/struct signature_requirement *);
 retvalue signature_requirement_add(struct signature_requirement **, const char *);
@@ -17,6 +21,11 @@ void free_known_keys(void);
 
 retvalue signature_check(const struct signature_requirement *, const char *, const char *, const char *, size_t);
 retvalue signature_check_inline(const struct signature_requirement *, const char *, /*@out@*/char **);
+/* describe everything besides the data the result of the above depends on
+ * (the keyring and what problems are ignored), RET_NOTHING if unknown */
+retvalue signature_checkstate(/*@out@*/char **);
+/* when what the last of the above accepted may expire, 0 if never */
+time_t signature_lastvaliduntil(void);
 
 
 struct signatures {
@@ -60,6 +69,12 @@ retvalue signature_startsignedfile(/*@out@*/struct signedfile **);
 void signedfile_write(struct signedfile *, const void *, size_t);
 /* generate signature in temporary file */
 retvalue signedfile_create(struct signedfile *, const char *, char **, char **, const struct strlist *, bool /*willcleanup*/);
+/* like signedfile_create, but only write the unsigned file,
+ * the signatures are generated by signedfiles_sign */
+retvalue signedfile_prepare(struct signedfile *, const char *, char **, char **, const struct strlist *, bool /*willcleanup*/);
+/* generate the signatures of all files prepared by signedfile_prepare,
+ * up to <jobs> at the same time, and store the result of each */
+void signedfiles_sign(struct signedfile * const *, /*@out@*/retvalue * /*results*/, int /*count*/, long /*jobs*/);
 void signedfile_free(/*@only@*/struct signedfile *);
 
 void signatures_done(void);
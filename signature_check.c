@@ -608,6 +608,25 @@ static void print_signatures(FILE *f, gpgme_signature_t s, const char *releasegp
 	}
 }
 
+/* when any of the signatures or the keys that made them expire,
+ * the result can change without anything else changing */
+static void note_expiries(gpgme_signature_t s) {
+	gpgme_key_t key;
+	gpgme_subkey_t subkey;
+
+	for (; s != NULL ; s = s->next) {
+		signature_noteexpiry(s->exp_timestamp);
+		key = NULL;
+		if (s->fpr == NULL ||
+				gpgme_get_key(context, s->fpr, &key, 0) != 0)
+			continue;
+		for (subkey = key->subkeys ; subkey != NULL ;
+		                             subkey = subkey->next)
+			signature_noteexpiry(subkey->expires);
+		gpgme_key_unref(key);
+	}
+}
+
 static inline retvalue verify_signature(const struct signature_requirement *requirements, const char *releasegpg, const char *releasename) {
 	gpgme_verify_result_t result;
 	int i;
@@ -619,6 +638,7 @@ static inline retvalue verify_signature(const struct signature_requirement *requ
 "Internal error communicating with libgpgme: no result record!\n\n");
 		return RET_ERROR_GPGME;
 	}
+	note_expiries(result->signatures);
 
 	for (req = requirements ; req != NULL ; req = req->next) {
 		bool fullfilled = false;
@@ -671,6 +691,7 @@ retvalue signature_check(const struct signature_requirement *requirements, const
 		return RET_ERROR_OOM;
 
 	assert (context != NULL);
+	signature_validuntil = 0;
 
 	/* Read the file and its signature into memory: */
 	gpgfd = open(releasegpg, O_RDONLY|O_NOCTTY);
@@ -711,6 +732,7 @@ retvalue signature_check_inline(const struct signature_requirement *requirements
 	gpgme_data_t dh, dh_gpg;
 	int fd;
 
+	signature_validuntil = 0;
 	fd = open(filename, O_RDONLY|O_NOCTTY);
 	if (fd < 0) {
 		int e = errno;
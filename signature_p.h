@@ -6,12 +6,18 @@
 #include <gpgme.h>
 
 extern gpgme_ctx_t context;
+/* when the signatures or keys looked at may expire, 0 if never */
+extern time_t signature_validuntil;
+void signature_noteexpiry(time_t);
 #endif
 
 #include "globals.h"
 #include "error.h"
 #include "signature.h"
 
+/* if gpg may ask for a passphrase on the terminal */
+extern bool signature_askspassphrase;
+
 #ifdef HAVE_LIBGPGME
 retvalue gpgerror(gpg_error_t err);
 #endif
@@ -37,6 +37,7 @@
 #include "release.h"
 #include "filecntl.h"
 #include "hooks.h"
+#include "workers.h"
 
 #ifdef HAVE_LIBGPGME
 static retvalue check_signature_created(bool clearsign, bool willcleanup, /*@null@*/const struct strlist *options, const char *filename, const char *signaturename) {
@@ -346,6 +347,12 @@ struct signedfile {
 #define DATABUFFERUNITS (128ul * 1024ul)
 	size_t bufferlen, buffersize;
 	char *buffer;
+	/* what is still to be signed after signedfile_prepare,
+	 * plainfilename is NULL if nothing is: */
+	/*@null@*/const char *plainfilename;
+	char **signedfilename_p, **detachedfilename_p;
+	const struct strlist *options;
+	bool willcleanup;
 };
 
 retvalue signature_startsignedfile(struct signedfile **out) {
@@ -404,7 +411,7 @@ void signedfile_write(struct signedfile *f, const void *data, size_t len) {
 	assert (f->bufferlen <= f->buffersize);
 }
 
-retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, char **newsignedfilename_p, char **newdetachedsignature_p, const struct strlist *options, bool willcleanup) {
+retvalue signedfile_prepare(struct signedfile *f, const char *newplainfilename, char **newsignedfilename_p, char **newdetachedsignature_p, const struct strlist *options, bool willcleanup) {
 	size_t len, ofs;
 	int fd, ret;
 
@@ -452,9 +459,7 @@ retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, c
 				strerror(e));
 		return RET_ERRNO(e);
 	}
-	/* now do the actual signing */
 	if (options != NULL && options->count > 0) {
-		retvalue r;
 		const char *newsigned = *newsignedfilename_p;
 		const char *newdetached = *newdetachedsignature_p;
 
@@ -471,26 +476,11 @@ retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, c
 					newsigned, strerror(errno));
 			return RET_ERROR;
 		}
-		/* if an hook is given, use that instead */
-		if (options->values[0][0] == '!')
-			r = signature_with_extern(options, newplainfilename,
-					newsigned, newdetachedsignature_p);
-		else
-#ifdef HAVE_LIBGPGME
-			r = signature_sign(options,
-				newplainfilename,
-				f->buffer, f->bufferlen,
-				newdetached, newsigned,
-				willcleanup);
-#else /* HAVE_LIBGPGME */
-			fputs(
-"ERROR: Cannot creature signatures as this reprepro binary is not compiled\n"
-"with support for libgpgme. (Only external signing using 'Signwith: !hook'\n"
-"is supported.\n", stderr);
-			return RET_ERROR_GPGME;
-#endif
-		if (RET_WAS_ERROR(r))
-			return r;
+		f->plainfilename = newplainfilename;
+		f->signedfilename_p = newsignedfilename_p;
+		f->detachedfilename_p = newdetachedsignature_p;
+		f->options = options;
+		f->willcleanup = willcleanup;
 	} else {
 		/* no signatures requested */
 		free(*newsignedfilename_p);
@@ -500,3 +490,134 @@ retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, c
 	}
 	return RET_OK;
 }
+
+/* now do the actual signing */
+static retvalue signedfile_sign(struct signedfile *f) {
+	const struct strlist *options = f->options;
+	const char *newplainfilename = f->plainfilename;
+	retvalue r;
+
+	assert (newplainfilename != NULL);
+	f->plainfilename = NULL;
+
+	/* if an hook is given, use that instead */
+	if (options->values[0][0] == '!')
+		r = signature_with_extern(options, newplainfilename,
+				*f->signedfilename_p, f->detachedfilename_p);
+	else
+#ifdef HAVE_LIBGPGME
+		r = signature_sign(options,
+			newplainfilename,
+			f->buffer, f->bufferlen,
+			*f->detachedfilename_p, *f->signedfilename_p,
+			f->willcleanup);
+#else /* HAVE_LIBGPGME */
+	{
+		fputs(
+"ERROR: Cannot creature signatures as this reprepro binary is not compiled\n"
+"with support for libgpgme. (Only external signing using 'Signwith: !hook'\n"
+"is supported.\n", stderr);
+		r = RET_ERROR_GPGME;
+	}
+#endif
+	return r;
+}
+
+retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, char **newsignedfilename_p, char **newdetachedsignature_p, const struct strlist *options, bool willcleanup) {
+	retvalue r;
+
+	r = signedfile_prepare(f, newplainfilename, newsignedfilename_p,
+			newdetachedsignature_p, options, willcleanup);
+	if (RET_WAS_ERROR(r) || f->plainfilename == NULL)
+		return r;
+	return signedfile_sign(f);
+}
+
+/* Signing several files is done by worker processes (as each signature
+ * may take a while, especially with keys on some hardware token), each
+ * job is the number of a file, the reply tells if a detached signature
+ * was created (a signing hook may decide to not create one). */
+
+struct signjobs {
+	struct signedfile * const *files;
+	retvalue *results;
+};
+
+static retvalue signjob_do(void *privdata, const char *job, char **reply_p, size_t *size_p) {
+	struct signjobs *jobs = privdata;
+	struct signedfile *f = jobs->files[atoi(job)];
+	char *reply;
+	retvalue r;
+
+	r = signedfile_sign(f);
+	/* workers do not flush on exit */
+	(void)fflush(stdout);
+	if (!RET_IS_OK(r))
+		return r;
+	reply = malloc(1);
+	if (FAILEDTOALLOC(reply))
+		return RET_ERROR_OOM;
+	reply[0] = (*f->detachedfilename_p != NULL) ? 'y' : 'n';
+	*reply_p = reply;
+	*size_p = 1;
+	return RET_OK;
+}
+
+static retvalue signjob_done(void *privdata, const char *job, retvalue r, const char *reply, size_t size) {
+	struct signjobs *jobs = privdata;
+	int i = atoi(job);
+	struct signedfile *f = jobs->files[i];
+
+	f->plainfilename = NULL;
+	if (RET_IS_OK(r) && size == 1 && reply[0] == 'n') {
+		free(*f->detachedfilename_p);
+		*f->detachedfilename_p = NULL;
+	}
+	jobs->results[i] = r;
+	return r;
+}
+
+void signedfiles_sign(struct signedfile * const *files, retvalue *results, int count, long jobcount) {
+	struct signjobs jobs;
+	struct workers *workers;
+	char job[20];
+	retvalue r;
+	int i, todo = 0;
+
+	for (i = 0 ; i < count ; i++) {
+		if (RET_WAS_ERROR(files[i]->result))
+			results[i] = files[i]->result;
+		else if (files[i]->plainfilename == NULL)
+			results[i] = RET_OK;
+		else {
+			/* until the job reports back */
+			results[i] = RET_ERROR;
+			todo++;
+		}
+	}
+	if (todo == 0)
+		return;
+	/* several processes asking for a passphrase at the same time
+	 * would make a mess of the terminal */
+	if (signature_askspassphrase)
+		jobcount = 1;
+	jobs.files = files;
+	jobs.results = results;
+	r = workers_start(&workers, (jobcount < todo) ? jobcount : todo,
+			signjob_do, signjob_done, &jobs);
+	if (RET_WAS_ERROR(r)) {
+		for (i = 0 ; i < count ; i++) {
+			if (files[i]->plainfilename != NULL)
+				results[i] = r;
+		}
+		return;
+	}
+	for (i = 0 ; i < count && !interrupted() ; i++) {
+		if (files[i]->plainfilename == NULL)
+			continue;
+		snprintf(job, sizeof(job), "%d", i);
+		/* errors are recorded in results by signjob_done */
+		(void)workers_add(workers, job);
+	}
+	(void)workers_finish(workers);
+}
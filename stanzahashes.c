@@ -0,0 +1,376 @@
+/*  This file is part of "reprepro"
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "error.h"
+#include "strlist.h"
+#include "names.h"
+#include "chunks.h"
+#include "uncompression.h"
+#include "indexfile.h"
+#include "remoterepository.h"
+#include "stanzahashes.h"
+
+/* The hash of a name is the sum of the hashes of all its stanzas,
+ * so the order of the stanzas in the index files does not matter.
+ * Each stanza's hash also depends on the number of the index file,
+ * so moving a stanza from one index file to another is a change, too. */
+
+struct stanzahash {
+	/*@only@*/char *name;
+	uint64_t hash;
+};
+
+struct stanzahashes {
+	struct stanzahash *hashes;
+	size_t count, size;
+};
+
+retvalue stanzahashes_create(struct stanzahashes **table_p) {
+	struct stanzahashes *table;
+
+	table = zNEW(struct stanzahashes);
+	if (FAILEDTOALLOC(table))
+		return RET_ERROR_OOM;
+	*table_p = table;
+	return RET_OK;
+}
+
+void stanzahashes_free(struct stanzahashes *table) {
+	size_t i;
+
+	if (table == NULL)
+		return;
+	for (i = 0 ; i < table->count ; i++)
+		free(table->hashes[i].name);
+	free(table->hashes);
+	free(table);
+}
+
+static retvalue stanzahashes_add(struct stanzahashes *table, /*@only@*/char *name, uint64_t hash) {
+	if (table->count >= table->size) {
+		struct stanzahash *n;
+		size_t newsize;
+
+		newsize = (table->size == 0) ? 1024 : 2 * table->size;
+		n = realloc(table->hashes, newsize * sizeof(struct stanzahash));
+		if (FAILEDTOALLOC(n)) {
+			free(name);
+			return RET_ERROR_OOM;
+		}
+		table->hashes = n;
+		table->size = newsize;
+	}
+	table->hashes[table->count].name = name;
+	table->hashes[table->count].hash = hash;
+	table->count++;
+	return RET_OK;
+}
+
+static inline uint64_t stanza_hash(unsigned int number, const char *chunk) {
+	/* FNV-1a */
+	uint64_t hash = UINT64_C(14695981039346656037);
+
+	hash ^= number;
+	hash *= UINT64_C(1099511628211);
+	while (*chunk != '\0') {
+		hash ^= (unsigned char)*(chunk++);
+		hash *= UINT64_C(1099511628211);
+	}
+	return hash;
+}
+
+retvalue stanzahashes_addindex(struct stanzahashes *table, const char *filename, unsigned int number) {
+	struct indexfile *i;
+	const char *chunk;
+	char *name;
+	bool unusable = false;
+	retvalue result, r;
+
+	r = indexfile_open(&i, filename, c_none);
+	if (!RET_IS_OK(r))
+		return r;
+	while (RET_IS_OK(r = indexfile_getnextchunk(i, &chunk))) {
+		r = chunk_getvalue(chunk, "Package", &name);
+		if (RET_WAS_ERROR(r))
+			break;
+		if (r == RET_NOTHING)
+			/* this is complained about when parsing it */
+			continue;
+		if (strchr(name, '\n') != NULL) {
+			/* cannot be stored, so better not use any */
+			free(name);
+			unusable = true;
+			break;
+		}
+		r = stanzahashes_add(table, name, stanza_hash(number, chunk));
+		if (RET_WAS_ERROR(r))
+			break;
+		if (interrupted()) {
+			r = RET_ERROR_INTERRUPTED;
+			break;
+		}
+	}
+	result = RET_WAS_ERROR(r) ? r : RET_OK;
+	r = indexfile_close(i);
+	RET_ENDUPDATE(result, r);
+	if (unusable && RET_IS_OK(result))
+		return RET_NOTHING;
+	return result;
+}
+
+static int stanzahash_compare(const void *a, const void *b) {
+	const struct stanzahash *h1 = a, *h2 = b;
+
+	return strcmp(h1->name, h2->name);
+}
+
+void stanzahashes_finish(struct stanzahashes *table) {
+	size_t i, j;
+
+	if (table->count == 0)
+		return;
+	qsort(table->hashes, table->count, sizeof(struct stanzahash),
+			stanzahash_compare);
+	j = 0;
+	for (i = 1 ; i < table->count ; i++) {
+		if (strcmp(table->hashes[i].name, table->hashes[j].name)
+				== 0) {
+			table->hashes[j].hash += table->hashes[i].hash;
+			free(table->hashes[i].name);
+		} else
+			table->hashes[++j] = table->hashes[i];
+	}
+	table->count = j + 1;
+}
+
+retvalue stanzahashes_diff(const struct stanzahashes *old, const struct stanzahashes *new, struct stanzahashes **changed_p) {
+	struct stanzahashes *changed;
+	size_t o = 0, n = 0;
+	const char *name;
+	char *copy;
+	int c;
+	retvalue r;
+
+	r = stanzahashes_create(&changed);
+	if (RET_WAS_ERROR(r))
+		return r;
+	while (o < old->count || n < new->count) {
+		if (o >= old->count)
+			c = 1;
+		else if (n >= new->count)
+			c = -1;
+		else
+			c = strcmp(old->hashes[o].name, new->hashes[n].name);
+		if (c == 0) {
+			name = new->hashes[n].name;
+			if (old->hashes[o].hash == new->hashes[n].hash)
+				name = NULL;
+			o++; n++;
+		} else if (c < 0)
+			name = old->hashes[o++].name;
+		else
+			name = new->hashes[n++].name;
+		if (name == NULL)
+			continue;
+		copy = strdup(name);
+		if (FAILEDTOALLOC(copy))
+			r = RET_ERROR_OOM;
+		else
+			r = stanzahashes_add(changed, copy, 0);
+		if (RET_WAS_ERROR(r)) {
+			stanzahashes_free(changed);
+			return r;
+		}
+	}
+	*changed_p = changed;
+	return RET_OK;
+}
+
+bool stanzahashes_contains(const struct stanzahashes *table, const char *name) {
+	struct stanzahash key;
+
+	if (table->count == 0)
+		return false;
+	key.name = (char*)name;
+	return bsearch(&key, table->hashes, table->count,
+			sizeof(struct stanzahash), stanzahash_compare) != NULL;
+}
+
+size_t stanzahashes_count(const struct stanzahashes *table) {
+	return table->count;
+}
+
+static inline char *stanzahashesfilename(const char *identifier) {
+	return genlistsfilename("stanzas", 2, "", identifier, ENDOFARGUMENTS);
+}
+
+retvalue stanzahashes_write(const struct stanzahashes *table, const char *identifier, const struct strlist *indices) {
+	char *filename, *tempfilename;
+	FILE *f;
+	size_t i;
+	int e;
+
+	filename = stanzahashesfilename(identifier);
+	if (FAILEDTOALLOC(filename))
+		return RET_ERROR_OOM;
+	tempfilename = calc_addsuffix(filename, "new");
+	if (FAILEDTOALLOC(tempfilename)) {
+		free(filename);
+		return RET_ERROR_OOM;
+	}
+	f = fopen(tempfilename, "w");
+	if (f == NULL) {
+		e = errno;
+		fprintf(stderr, "Error %d creating '%s': %s\n",
+				e, tempfilename, strerror(e));
+		free(tempfilename);
+		free(filename);
+		return RET_ERRNO(e);
+	}
+	fprintf(f, "Stanzas of %s from:\n", identifier);
+	for (i = 0 ; i < (size_t)indices->count ; i++)
+		fprintf(f, "Index %s\n", indices->values[i]);
+	fputs("Hashes:\n", f);
+	for (i = 0 ; i < table->count ; i++)
+		fprintf(f, "%016" PRIx64 " %s\n", table->hashes[i].hash,
+				table->hashes[i].name);
+	if (ferror(f) != 0) {
+		fprintf(stderr, "An error occurred writing to '%s'!\n",
+				tempfilename);
+		(void)fclose(f);
+		e = EIO;
+	} else if (fclose(f) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d occurred writing to '%s': %s!\n",
+				e, tempfilename, strerror(e));
+	} else if (rename(tempfilename, filename) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d moving '%s' to '%s': %s!\n",
+				e, tempfilename, filename, strerror(e));
+	} else
+		e = 0;
+	if (e != 0)
+		(void)unlink(tempfilename);
+	free(tempfilename);
+	free(filename);
+	return (e == 0) ? RET_OK : RET_ERRNO(e);
+}
+
+void stanzahashes_remove(const char *identifier) {
+	char *filename;
+
+	filename = stanzahashesfilename(identifier);
+	if (FAILEDTOALLOC(filename))
+		return;
+	if (unlink(filename) != 0 && errno != ENOENT) {
+		int e = errno;
+		fprintf(stderr, "Error %d deleting '%s': %s!\n",
+				e, filename, strerror(e));
+	}
+	free(filename);
+}
+
+static retvalue readtable(FILE *f, const char *identifier, const struct strlist *indices, struct stanzahashes *table) {
+	char *line = NULL, *name, *e;
+	size_t linesize = 0;
+	ssize_t s;
+	unsigned long long hash;
+	int i = -1;
+	retvalue r = RET_NOTHING;
+
+	/* first check this was computed from the same index files */
+	while ((s = getline(&line, &linesize, f)) > 0) {
+		if (line[s-1] != '\n')
+			break;
+		line[s-1] = '\0';
+		if (i < 0) {
+			if (strncmp(line, "Stanzas of ", 11) != 0 ||
+					strncmp(line + 11, identifier,
+						strlen(identifier)) != 0 ||
+					strcmp(line + 11 + strlen(identifier),
+						" from:") != 0)
+				break;
+		} else if (i < indices->count) {
+			if (strncmp(line, "Index ", 6) != 0 ||
+					strcmp(line + 6, indices->values[i])
+					!= 0)
+				break;
+		} else if (i == indices->count) {
+			if (strcmp(line, "Hashes:") != 0)
+				break;
+			r = RET_OK;
+		} else {
+			errno = 0;
+			hash = strtoull(line, &e, 16);
+			if (errno != 0 || e != line + 16 || *e != ' ') {
+				r = RET_NOTHING;
+				break;
+			}
+			name = strdup(e + 1);
+			if (FAILEDTOALLOC(name)) {
+				r = RET_ERROR_OOM;
+				break;
+			}
+			r = stanzahashes_add(table, name, hash);
+			if (RET_WAS_ERROR(r))
+				break;
+		}
+		i++;
+	}
+	if (RET_IS_OK(r) && (s > 0 || ferror(f) != 0))
+		/* garbage or not fully read */
+		r = RET_NOTHING;
+	free(line);
+	return r;
+}
+
+retvalue stanzahashes_read(const char *identifier, const struct strlist *indices, struct stanzahashes **table_p) {
+	struct stanzahashes *table;
+	char *filename;
+	FILE *f;
+	retvalue r;
+
+	filename = stanzahashesfilename(identifier);
+	if (FAILEDTOALLOC(filename))
+		return RET_ERROR_OOM;
+	f = fopen(filename, "r");
+	free(filename);
+	if (f == NULL)
+		return RET_NOTHING;
+	r = stanzahashes_create(&table);
+	if (RET_WAS_ERROR(r)) {
+		(void)fclose(f);
+		return r;
+	}
+	r = readtable(f, identifier, indices, table);
+	(void)fclose(f);
+	if (!RET_IS_OK(r)) {
+		stanzahashes_free(table);
+		return r;
+	}
+	/* the file was written sorted, but better not rely on that */
+	stanzahashes_finish(table);
+	*table_p = table;
+	return RET_OK;
+}
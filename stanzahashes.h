@@ -0,0 +1,37 @@
+#ifndef REPREPRO_STANZAHASHES_H
+#define REPREPRO_STANZAHASHES_H
+
+#ifndef REPREPRO_ERROR_H
+#include "error.h"
+#endif
+
+struct strlist;
+
+/* A table of package names and a hash of all stanzas with that name
+ * in the index files of a target, used to only look at packages that
+ * changed since the last update */
+struct stanzahashes;
+
+retvalue stanzahashes_create(/*@out@*/struct stanzahashes **);
+void stanzahashes_free(/*@only@*/struct stanzahashes *);
+
+/* add the stanzas of the uncompressed index file, the number differentiates
+ * multiple files of the same target */
+retvalue stanzahashes_addindex(struct stanzahashes *, const char * /*filename*/, unsigned int /*number*/);
+/* to be called after the last addindex */
+void stanzahashes_finish(struct stanzahashes *);
+
+/* all names in one table but not the other or with different stanzas */
+retvalue stanzahashes_diff(const struct stanzahashes * /*old*/, const struct stanzahashes * /*new*/, /*@out@*/struct stanzahashes **);
+bool stanzahashes_contains(const struct stanzahashes *, const char *);
+size_t stanzahashes_count(const struct stanzahashes *);
+
+/* store as lists/_<identifier>_stanzas, together with a description
+ * of the index files it was computed from */
+retvalue stanzahashes_write(const struct stanzahashes *, const char * /*identifier*/, const struct strlist * /*indices*/);
+/* delete the file stored by stanzahashes_write, if there is one */
+void stanzahashes_remove(const char * /*identifier*/);
+/* RET_NOTHING if there is no file or it was computed from other indices */
+retvalue stanzahashes_read(const char * /*identifier*/, const struct strlist * /*indices*/, /*@out@*/struct stanzahashes **);
+
+#endif
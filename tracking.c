@@ -18,7 +18,9 @@
 
 #include <assert.h>
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
@@ -38,6 +40,16 @@
 #define PARANOIA
 #endif
 
+/* Tracking data is stored in a binary format:
+ * after the version follows a '\1' (to tell it apart from the older
+ * textual format), the number of files, then for each file its type,
+ * its refcount and the filekey (terminated by a '\0') and finally the
+ * indices of the files sorted by filekey. All numbers are 4 bytes in
+ * network byte order. */
+#define TRACKINGDATA_BINARY '\1'
+/* the first version able to read the binary format */
+#define TRACKINGDATA_BINARYVERSION "4.18.0"
+
 struct s_tracking {
 	char *codename;
 	struct table *table;
@@ -96,40 +108,62 @@ static inline enum filetype filetypechar(enum filetype filetype) {
 	return ft_XTRA_DATA;
 }
 
+/* look for filekey in the filekeys of pkg,
+ * *pos_p is set to the position in pkg->sorted where it was found
+ * or where it would need to be inserted */
+static bool trackedpackage_find(const struct trackedpackage *pkg, const char *filekey, /*@out@*/int *pos_p) {
+	int low = 0, high = pkg->filekeys.count;
+
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		int c = strcmp(pkg->filekeys.values[pkg->sorted[mid]], filekey);
+
+		if (c == 0) {
+			*pos_p = mid;
+			return true;
+		}
+		if (c < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*pos_p = low;
+	return false;
+}
+
 retvalue trackedpackage_addfilekey(trackingdb tracks, struct trackedpackage *pkg, enum filetype filetype, char *filekey, bool used) {
 	char *id;
 	enum filetype ft = filetypechar(filetype);
-	int i, *newrefcounts;
+	int i, pos, *newrefcounts, *newsorted;
 	enum filetype *newfiletypes;
 	retvalue r;
 
 	if (FAILEDTOALLOC(filekey))
 		return RET_ERROR_OOM;
 
-	for (i = 0 ; i < pkg->filekeys.count ; i++) {
-		if (strcmp(pkg->filekeys.values[i], filekey) == 0) {
-			if (pkg->filetypes[i] != ft) {
-				/* if old file has refcount 0, just repair: */
-				if (pkg->refcounts[i] <= 0) {
-					free(filekey);
-					pkg->filetypes[i] = ft;
-					if (used)
-						pkg->refcounts[i] = 1;
-					return RET_OK;
-				}
-				fprintf(stderr,
-"Filekey '%s' already registered for '%s_%s' as type '%c' is tried to be reregistered as type '%c'!\n",
-						filekey, pkg->sourcename,
-						pkg->sourceversion,
-						pkg->filetypes[i], ft);
+	if (trackedpackage_find(pkg, filekey, &pos)) {
+		i = pkg->sorted[pos];
+		if (pkg->filetypes[i] != ft) {
+			/* if old file has refcount 0, just repair: */
+			if (pkg->refcounts[i] <= 0) {
 				free(filekey);
-				return RET_ERROR;
+				pkg->filetypes[i] = ft;
+				if (used)
+					pkg->refcounts[i] = 1;
+				return RET_OK;
 			}
+			fprintf(stderr,
+"Filekey '%s' already registered for '%s_%s' as type '%c' is tried to be reregistered as type '%c'!\n",
+					filekey, pkg->sourcename,
+					pkg->sourceversion,
+					pkg->filetypes[i], ft);
 			free(filekey);
-			if (used)
-				pkg->refcounts[i]++;
-			return RET_OK;
+			return RET_ERROR;
 		}
+		free(filekey);
+		if (used)
+			pkg->refcounts[i]++;
+		return RET_OK;
 	}
 
 	newrefcounts = realloc(pkg->refcounts,
@@ -151,10 +185,20 @@ retvalue trackedpackage_addfilekey(trackingdb tracks, struct trackedpackage *pkg
 	}
 	newfiletypes[pkg->filekeys.count] = filetype;
 	pkg->filetypes = newfiletypes;
+	newsorted = realloc(pkg->sorted,
+			(pkg->filekeys.count + 1) * sizeof(int));
+	if (FAILEDTOALLOC(newsorted)) {
+		free(filekey);
+		return RET_ERROR_OOM;
+	}
+	pkg->sorted = newsorted;
 
 	r = strlist_add(&pkg->filekeys, filekey);
 	if (RET_WAS_ERROR(r))
 		return r;
+	memmove(newsorted + pos + 1, newsorted + pos,
+			(pkg->filekeys.count - 1 - pos) * sizeof(int));
+	newsorted[pos] = pkg->filekeys.count - 1;
 
 	id = calc_trackreferee(tracks->codename,
 			pkg->sourcename, pkg->sourceversion);
@@ -181,21 +225,20 @@ retvalue trackedpackage_adddupfilekeys(trackingdb tracks, struct trackedpackage
 }
 
 static inline retvalue trackedpackage_removefilekey(trackingdb tracks, struct trackedpackage *pkg, const char *filekey) {
-	int i;
+	int i, pos;
 
-	for (i = 0 ; i < pkg->filekeys.count ; i++) {
-		if (strcmp(pkg->filekeys.values[i], filekey) == 0) {
-			if (pkg->refcounts[i] > 0) {
-				pkg->refcounts[i]--;
-			} else
-				fprintf(stderr,
+	if (trackedpackage_find(pkg, filekey, &pos)) {
+		i = pkg->sorted[pos];
+		if (pkg->refcounts[i] > 0) {
+			pkg->refcounts[i]--;
+		} else
+			fprintf(stderr,
 "Warning: tracking database of %s has inconsistent refcounts of %s_%s.\n",
-						tracks->codename,
-						pkg->sourcename,
-						pkg->sourceversion);
+					tracks->codename,
+					pkg->sourcename,
+					pkg->sourceversion);
 
-			return RET_OK;
-		}
+		return RET_OK;
 	}
 	fprintf(stderr,
 "Warning: tracking database of %s missed files for %s_%s.\n",
@@ -225,6 +268,7 @@ void trackedpackage_free(struct trackedpackage *pkg) {
 		strlist_done(&pkg->filekeys);
 		free(pkg->refcounts);
 		free(pkg->filetypes);
+		free(pkg->sorted);
 		free(pkg);
 	}
 }
@@ -265,21 +309,54 @@ static retvalue tracking_new(const char *sourcename, const char *version, /*@out
 	return RET_OK;
 }
 
-static inline retvalue parse_data(const char *name, const char *version, const char *data, size_t datalen, /*@out@*/struct trackedpackage **pkg) {
-	struct trackedpackage *p;
+static inline uint32_t getuint32(const char *d) {
+	const unsigned char *u = (const unsigned char *)d;
+
+	return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+	       ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+}
+
+static inline char *putuint32(char *d, uint32_t v) {
+	*(d++) = (char)(v >> 24);
+	*(d++) = (char)(v >> 16);
+	*(d++) = (char)(v >> 8);
+	*(d++) = (char)v;
+	return d;
+}
+
+/* qsort has no callback data, so this needs a global variable: */
+static const struct strlist *sortkeys;
+
+static int filekey_compare(const void *a, const void *b) {
+	return strcmp(sortkeys->values[*(const int *)a],
+			sortkeys->values[*(const int *)b]);
+}
+
+static retvalue trackedpackage_sort(struct trackedpackage *p) {
 	int i;
 
-	p = zNEW(struct trackedpackage);
-	if (FAILEDTOALLOC(p))
-		return RET_ERROR_OOM;
-	p->sourcename = strdup(name);
-	p->sourceversion = strdup(version);
-	if (FAILEDTOALLOC(p->sourcename)
-			|| FAILEDTOALLOC(p->sourceversion)
-		/*	|| FAILEDTOALLOC(p->sourcedir) */) {
-		trackedpackage_free(p);
+	free(p->sorted);
+	p->sorted = nNEW(p->filekeys.count, int);
+	if (FAILEDTOALLOC(p->sorted))
 		return RET_ERROR_OOM;
-	}
+	for (i = 0 ; i < p->filekeys.count ; i++)
+		p->sorted[i] = i;
+	sortkeys = &p->filekeys;
+	qsort(p->sorted, p->filekeys.count, sizeof(int), filekey_compare);
+	sortkeys = NULL;
+	return RET_OK;
+}
+
+static retvalue corrupt(const struct trackedpackage *p) {
+	fprintf(stderr, "Internal Error: Corrupt tracking data for %s %s\n",
+			p->sourcename, p->sourceversion);
+	return RET_ERROR;
+}
+
+/* the format used by older versions, only read to convert it */
+static inline retvalue parse_textdata(struct trackedpackage *p, const char *data, size_t datalen) {
+	int i;
+
 	while (datalen > 0 && *data != '\0') {
 		char *filekey;
 		const char *separator;
@@ -289,57 +366,122 @@ static inline retvalue parse_data(const char *name, const char *version, const c
 		if (((p->filekeys.count)&31) == 0) {
 			enum filetype *n = realloc(p->filetypes,
 				(p->filekeys.count+32)*sizeof(enum filetype));
-			if (FAILEDTOALLOC(n)) {
-				trackedpackage_free(p);
+			if (FAILEDTOALLOC(n))
 				return RET_ERROR_OOM;
-			}
 			p->filetypes = n;
 		}
 		p->filetypes[p->filekeys.count] = *data;
 		data++; datalen--;
 		separator = memchr(data, '\0', datalen);
-		if (separator == NULL) {
-			fprintf(stderr,
-"Internal Error: Corrupt tracking data for %s %s\n",
-					name, version);
-			trackedpackage_free(p);
-			return RET_ERROR;
-		}
+		if (separator == NULL)
+			return corrupt(p);
 		filekeylen = separator - data;
 		filekey = strndup(data, filekeylen);
-		if (FAILEDTOALLOC(filekey)) {
-			trackedpackage_free(p);
+		if (FAILEDTOALLOC(filekey))
 			return RET_ERROR_OOM;
-		}
 		r = strlist_add(&p->filekeys, filekey);
-		if (RET_WAS_ERROR(r)) {
-			trackedpackage_free(p);
+		if (RET_WAS_ERROR(r))
 			return r;
-		}
 		data += filekeylen + 1;
 		datalen -= filekeylen + 1;
 	}
 	data++; datalen--;
 	p->refcounts = nzNEW(p->filekeys.count, int);
-	if (FAILEDTOALLOC(p->refcounts)) {
-		trackedpackage_free(p);
+	if (FAILEDTOALLOC(p->refcounts))
 		return RET_ERROR_OOM;
-	}
 	for (i = 0 ; i < p->filekeys.count ; i++) {
-		if ((p->refcounts[i] = parsenumber(&data, &datalen)) < 0) {
-			fprintf(stderr,
-"Internal Error: Corrupt tracking data for %s %s\n",
-					name, version);
-			trackedpackage_free(p);
-			return RET_ERROR;
-		}
+		if ((p->refcounts[i] = parsenumber(&data, &datalen)) < 0)
+			return corrupt(p);
 	}
-	if (datalen > 0) {
-		fprintf(stderr,
-"Internal Error: Trailing garbage in tracking data for %s %s\n (%ld bytes)",
-					name, version, (long)datalen);
+	if (datalen > 0)
+		return corrupt(p);
+	return trackedpackage_sort(p);
+}
+
+static inline retvalue parse_binarydata(struct trackedpackage *p, const char *data, size_t datalen) {
+	const char *end = data + datalen;
+	uint32_t count, i, ofs;
+	retvalue r;
+
+	assert (datalen > 0 && *data == TRACKINGDATA_BINARY);
+	data++;
+	if (end - data < 4)
+		return corrupt(p);
+	count = getuint32(data);
+	data += 4;
+	/* every file needs at least 10 bytes */
+	if (count > (size_t)(end - data) / 10)
+		return corrupt(p);
+	r = strlist_init_n(count, &p->filekeys);
+	if (RET_WAS_ERROR(r))
+		return r;
+	p->filetypes = nNEW(count, enum filetype);
+	p->refcounts = nNEW(count, int);
+	p->sorted = nNEW(count, int);
+	if (FAILEDTOALLOC(p->filetypes) || FAILEDTOALLOC(p->refcounts)
+			|| FAILEDTOALLOC(p->sorted))
+		return RET_ERROR_OOM;
+	for (i = 0 ; i < count ; i++) {
+		const char *separator;
+		char *filekey;
+		uint32_t refcount;
+
+		if (end - data < 6)
+			return corrupt(p);
+		p->filetypes[i] = *(data++);
+		refcount = getuint32(data);
+		data += 4;
+		if (refcount > INT_MAX)
+			return corrupt(p);
+		p->refcounts[i] = refcount;
+		separator = memchr(data, '\0', end - data);
+		if (separator == NULL)
+			return corrupt(p);
+		filekey = strndup(data, separator - data);
+		if (FAILEDTOALLOC(filekey))
+			return RET_ERROR_OOM;
+		r = strlist_add(&p->filekeys, filekey);
+		if (RET_WAS_ERROR(r))
+			return r;
+		data = separator + 1;
+	}
+	if ((size_t)(end - data) != 4 * (size_t)count)
+		return corrupt(p);
+	for (i = 0 ; i < count ; i++) {
+		ofs = getuint32(data);
+		data += 4;
+		if (ofs >= count)
+			return corrupt(p);
+		p->sorted[i] = ofs;
+		if (i > 0 && strcmp(p->filekeys.values[p->sorted[i-1]],
+					p->filekeys.values[ofs]) > 0)
+			return corrupt(p);
+	}
+	return RET_OK;
+}
+
+static inline retvalue parse_data(const char *name, const char *version, const char *data, size_t datalen, /*@out@*/struct trackedpackage **pkg) {
+	struct trackedpackage *p;
+	retvalue r;
+
+	p = zNEW(struct trackedpackage);
+	if (FAILEDTOALLOC(p))
+		return RET_ERROR_OOM;
+	p->sourcename = strdup(name);
+	p->sourceversion = strdup(version);
+	if (FAILEDTOALLOC(p->sourcename)
+			|| FAILEDTOALLOC(p->sourceversion)
+		/*	|| FAILEDTOALLOC(p->sourcedir) */) {
 		trackedpackage_free(p);
-		return RET_ERROR;
+		return RET_ERROR_OOM;
+	}
+	if (datalen > 0 && *data == TRACKINGDATA_BINARY)
+		r = parse_binarydata(p, data, datalen);
+	else
+		r = parse_textdata(p, data, datalen);
+	if (RET_WAS_ERROR(r)) {
+		trackedpackage_free(p);
+		return r;
 	}
 	p->flags.isnew = false;
 	p->flags.deleted = false;
@@ -373,50 +515,33 @@ static retvalue gen_data(struct trackedpackage *pkg, /*@out@*/char **newdata_p,
 	int i;
 	char *d, *data;
 	size_t datalen;
+	retvalue r;
 
-	datalen = versionsize + 1;
-	for (i = 0 ; i < pkg->filekeys.count ; i++) {
-		size_t l;
-		l = strlen(pkg->filekeys.values[i]);
-		if (l > 0)
-			datalen += l+9;
-	}
+	/* the database now contains something older versions cannot read */
+	r = database_requireversion(TRACKINGDATA_BINARYVERSION);
+	if (RET_WAS_ERROR(r))
+		return r;
+	datalen = versionsize + 5;
+	for (i = 0 ; i < pkg->filekeys.count ; i++)
+		datalen += strlen(pkg->filekeys.values[i]) + 10;
 	data = malloc(datalen + 1);
 	if (FAILEDTOALLOC(data))
 		return RET_ERROR_OOM;
 	memcpy(data, pkg->sourceversion, versionsize);
 	d = data + versionsize;
+	*(d++) = TRACKINGDATA_BINARY;
+	d = putuint32(d, pkg->filekeys.count);
 	for (i = 0 ; i < pkg->filekeys.count ; i++) {
-		size_t l;
-		l = strlen(pkg->filekeys.values[i]);
-		if (l > 0) {
-			*d = pkg->filetypes[i];
-			d++;
-			memcpy(d, pkg->filekeys.values[i], l + 1);
-			d+=l+1;
-		}
-	}
-	*d ='\0'; d++;
-	for (i = 0 ; i < pkg->filekeys.count ; i++) {
-		int j;
-#define MAXREFCOUNTOCTETS 7
-		char countstring[MAXREFCOUNTOCTETS];
-		size_t count = pkg->refcounts[i];
-
-		countstring[MAXREFCOUNTOCTETS-1] = '\0';
-		for (j = MAXREFCOUNTOCTETS-2 ; j >= 0 ; j--) {
-			countstring[j] = '0' + (count & 7);
-			count >>= 3;
-			if (count == 0)
-				break;
-		}
-#undef MAXREFCOUNTOCTETS
-		assert (count == 0);
+		size_t l = strlen(pkg->filekeys.values[i]);
 
-		memcpy(d, countstring+j, 7 - j);
-		d+=7-j;
-		datalen -= j;
+		assert (pkg->refcounts[i] >= 0);
+		*(d++) = pkg->filetypes[i];
+		d = putuint32(d, pkg->refcounts[i]);
+		memcpy(d, pkg->filekeys.values[i], l + 1);
+		d += l + 1;
 	}
+	for (i = 0 ; i < pkg->filekeys.count ; i++)
+		d = putuint32(d, pkg->sorted[i]);
 	*d ='\0';
 	assert ((size_t)(d-data) == datalen);
 	*newdata_p = data;
@@ -817,6 +942,7 @@ retvalue trackingdata_switch(struct trackingdata *data, const char *source, cons
 		strlist_done(&data->pkg->filekeys);
 		free(data->pkg->refcounts);
 		free(data->pkg->filetypes);
+		free(data->pkg->sorted);
 		free(data->pkg);
 		data->pkg = NULL;
 		if (RET_WAS_ERROR(r))
@@ -947,6 +1073,7 @@ static inline retvalue trackedpackage_removeall(trackingdb tracks, struct tracke
 	strlist_done(&pkg->filekeys);
 	strlist_init(&pkg->filekeys);
 	free(pkg->refcounts); pkg->refcounts = NULL;
+	free(pkg->sorted); pkg->sorted = NULL;
 	return result;
 }
 
@@ -970,11 +1097,14 @@ static inline bool tracking_needed(trackingdb tracks, struct trackedpackage *pkg
 static inline retvalue trackedpackage_removeunneeded(trackingdb tracks, struct trackedpackage *pkg) {
 	retvalue result = RET_OK, r;
 	char *id = NULL;
-	int i, j, count;
+	int i, j, k, count, *newofs;
 
 	assert(tracks->type == dt_MINIMAL);
 
 	count = pkg->filekeys.count;
+	newofs = nNEW(count, int);
+	if (FAILEDTOALLOC(newofs))
+		return RET_ERROR_OOM;
 	j = 0;
 	for (i = 0 ; i < count ; i++) {
 		if (tracking_needed(tracks, pkg, i)) {
@@ -983,9 +1113,11 @@ static inline retvalue trackedpackage_removeunneeded(trackingdb tracks, struct t
 				pkg->refcounts[j] = pkg->refcounts[i];
 				pkg->filetypes[j] = pkg->filetypes[i];
 			}
+			newofs[i] = j;
 			j++;
 		} else {
 			char *filekey = pkg->filekeys.values[i];
+			newofs[i] = -1;
 			pkg->filekeys.values[i] = NULL;
 			if (FAILEDTOALLOC(id)) {
 				id = calc_trackreferee(tracks->codename,
@@ -1003,6 +1135,14 @@ static inline retvalue trackedpackage_removeunneeded(trackingdb tracks, struct t
 	}
 	assert (j <= pkg->filekeys.count);
 	pkg->filekeys.count = j;
+	/* keep the sorted order of the remaining ones */
+	k = 0;
+	for (i = 0 ; i < count ; i++) {
+		if (newofs[pkg->sorted[i]] >= 0)
+			pkg->sorted[k++] = newofs[pkg->sorted[i]];
+	}
+	assert (k == j);
+	free(newofs);
 	free(id);
 	return result;
 }
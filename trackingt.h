@@ -14,6 +14,8 @@ struct trackedpackage {
 	struct strlist filekeys;
 	int *refcounts;
 	enum filetype *filetypes;
+	/* indices into filekeys, ordered by the filekey they point to */
+	int *sorted;
 	struct {
 		bool isnew;
 		bool deleted;
@@ -24,6 +24,7 @@
 #include <assert.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <sys/select.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <poll.h>
@@ -65,15 +66,41 @@ const char * const uncompression_config[c_COUNT] = {
 	/*@null@*/void *privdata;
 	/* if already started, the pid > 0 */
 	pid_t pid;
+	/* read end of a pipe the child keeps open until it exits,
+	 * so the download loop can wait for it, -1 if none */
+	int exitfd;
+	/* done by a forked copy of ourself instead of a program */
+	bool builtin;
 } *tasks = NULL;
 
+/* how many uncompressions run at the same time while downloading */
+#define UNCOMPRESS_MAXRUNNING 2
+
 static void uncompress_task_free(/*@only@*/struct uncompress_task *t) {
+	if (t->exitfd >= 0)
+		(void)close(t->exitfd);
 	free(t->compressedfilename);
 	free(t->uncompressedfilename);
 	free(t);
 }
 
-static retvalue startchild(enum compression c, int stdinfd, int stdoutfd, /*@out@*/pid_t *pid_p) {
+/* create a pipe whose write end is only to be kept by the child */
+static retvalue exitpipe(/*@out@*/int *readfd, /*@out@*/int *writefd) {
+	int filedes[2], e;
+
+	if (pipe(filedes) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d creating pipe: %s\n", e, strerror(e));
+		return RET_ERRNO(e);
+	}
+	markcloseonexec(filedes[0]);
+	*readfd = filedes[0];
+	*writefd = filedes[1];
+	return RET_OK;
+}
+
+/* exitfd (if not -1) is kept open as fd 3 of the uncompressor */
+static retvalue startchild(enum compression c, int stdinfd, int stdoutfd, int exitfd, /*@out@*/pid_t *pid_p) {
 	int e, i;
 	pid_t pid;
 
@@ -83,6 +110,8 @@ static retvalue startchild(enum compression c, int stdinfd, int stdoutfd, /*@out
 		fprintf(stderr, "Error %d forking: %s\n", e, strerror(e));
 		(void)close(stdinfd);
 		(void)close(stdoutfd);
+		if (exitfd >= 0)
+			(void)close(exitfd);
 		return RET_ERRNO(e);
 	}
 	if (pid == 0) {
@@ -101,7 +130,16 @@ static retvalue startchild(enum compression c, int stdinfd, int stdoutfd, /*@out
 					e, stdinfd, strerror(e));
 			raise(SIGUSR2);
 		}
-		closefrom(3);
+		if (exitfd >= 0) {
+			if (exitfd != 3 && dup2(exitfd, 3) < 0) {
+				e = errno;
+				fprintf(stderr, "Error %d in dup(%d, 3): %s\n",
+						e, exitfd, strerror(e));
+				raise(SIGUSR2);
+			}
+			closefrom(4);
+		} else
+			closefrom(3);
 		execlp(extern_uncompressors[c], extern_uncompressors[c],
 				ENDOFARGUMENTS);
 		e = errno;
@@ -112,6 +150,8 @@ static retvalue startchild(enum compression c, int stdinfd, int stdoutfd, /*@out
 	}
 	(void)close(stdinfd);
 	(void)close(stdoutfd);
+	if (exitfd >= 0)
+		(void)close(exitfd);
 	*pid_p = pid;
 	return RET_OK;
 }
@@ -128,7 +168,7 @@ static retvalue startpipeoutchild(enum compression c, int fd, /*@out@*/int *pipe
 		return RET_ERRNO(e);
 	}
 	markcloseonexec(filedes[0]);
-	r = startchild(c, fd, filedes[1], pid_p);
+	r = startchild(c, fd, filedes[1], -1, pid_p);
 	if (RET_WAS_ERROR(r))
 		/* fd and filedes[1] are closed by startchild on error */
 		(void)close(filedes[0]);
@@ -157,25 +197,66 @@ static retvalue startpipeinoutchild(enum compression c, /*@out@*/int *infd, /*@o
 	return r;
 }
 
+static inline retvalue builtin_uncompress(const char *compressed, const char *destination, enum compression compression);
+
+/* uncompress in a child, so the parent can continue downloading */
+static retvalue startbuiltinchild(struct uncompress_task *t) {
+	pid_t pid;
+	int e, writefd;
+	retvalue r;
+
+	if (verbose > 1) {
+		fprintf(stderr, "Uncompress '%s' into '%s'...\n",
+				t->compressedfilename,
+				t->uncompressedfilename);
+	}
+	r = exitpipe(&t->exitfd, &writefd);
+	if (RET_WAS_ERROR(r))
+		return r;
+	/* do not let the child output what is still buffered */
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		e = errno;
+		fprintf(stderr, "Error %d forking: %s\n", e, strerror(e));
+		(void)close(writefd);
+		(void)close(t->exitfd);
+		t->exitfd = -1;
+		return RET_ERRNO(e);
+	}
+	if (pid == 0) {
+		/* writefd stays open until the child exits */
+		r = builtin_uncompress(t->compressedfilename,
+				t->uncompressedfilename, t->compression);
+		(void)fflush(stderr);
+		_exit(RET_IS_OK(r) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	(void)close(writefd);
+	t->pid = pid;
+	return RET_OK;
+}
+
 static retvalue uncompress_start_queued(void) {
 	struct uncompress_task *t;
 	int running_count = 0;
-	int e, stdinfd, stdoutfd;
+	int e, stdinfd, stdoutfd, writefd;
+	retvalue r;
 
 	for (t = tasks ; t != NULL ; t = t->next) {
 		if (t->pid > 0)
 			running_count++;
 	}
-	// TODO: make the maximum number configurable,
-	// until that 1 is the best guess...
-	if (running_count >= 1)
+	if (running_count >= UNCOMPRESS_MAXRUNNING)
 		return RET_OK;
 	t = tasks;
 	while (t != NULL && t->pid > 0)
 		t = t->next;
 	if (t == NULL)
 		/* nothing to do... */
-		return RET_NOTHING;
+		return running_count > 0 ? RET_OK : RET_NOTHING;
+	if (t->builtin)
+		return startbuiltinchild(t);
 	if (verbose > 1) {
 		fprintf(stderr, "Uncompress '%s' into '%s' using '%s'...\n",
 				t->compressedfilename,
@@ -202,11 +283,20 @@ static retvalue uncompress_start_queued(void) {
 		// TODO: call callback
 		return RET_ERRNO(e);
 	}
-	return startchild(t->compression, stdinfd, stdoutfd, &t->pid);
+	r = exitpipe(&t->exitfd, &writefd);
+	if (RET_WAS_ERROR(r)) {
+		(void)close(stdinfd);
+		(void)close(stdoutfd);
+		return r;
+	}
+	r = startchild(t->compression, stdinfd, stdoutfd, writefd, &t->pid);
+	if (RET_WAS_ERROR(r)) {
+		(void)close(t->exitfd);
+		t->exitfd = -1;
+	}
+	return r;
 }
 
-static inline retvalue builtin_uncompress(const char *compressed, const char *destination, enum compression compression);
-
 /* we got an pid, check if it is a uncompressor we care for */
 retvalue uncompress_checkpid(pid_t pid, int status) {
 	struct uncompress_task *t, **t_p;
@@ -222,7 +312,18 @@ retvalue uncompress_checkpid(pid_t pid, int status) {
 		/* not one we started */
 		return RET_NOTHING;
 	}
-	if (WIFEXITED(status)) {
+	if (t->builtin) {
+		/* the child already told what went wrong */
+		error = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+		if (error) {
+			(void)unlink(t->uncompressedfilename);
+			if (WIFSIGNALED(status))
+				fprintf(stderr,
+"Uncompressing '%s' killed by signal %d!\n",
+					t->compressedfilename,
+					(int)(WTERMSIG(status)));
+		}
+	} else if (WIFEXITED(status)) {
 		if (WEXITSTATUS(status) != 0) {
 			fprintf(stderr,
 "'%s' < %s > %s exited with errorcode %d!\n",
@@ -251,12 +352,12 @@ retvalue uncompress_checkpid(pid_t pid, int status) {
 		/* no need to leave partial stuff around */
 		(void)unlink(t->uncompressedfilename);
 	}
-	if (!error && verbose > 10)
+	if (!error && !t->builtin && verbose > 10)
 		printf("'%s' < %s > %s finished successfully!\n",
 				extern_uncompressors[t->compression],
 					t->compressedfilename,
 					t->uncompressedfilename);
-	if (error && uncompression_builtin(t->compression)) {
+	if (error && !t->builtin && uncompression_builtin(t->compression)) {
 		/* try builtin method instead */
 		r = builtin_uncompress(t->compressedfilename,
 				t->uncompressedfilename, t->compression);
@@ -288,6 +389,18 @@ bool uncompress_running(void) {
 	return tasks != NULL;
 }
 
+void uncompress_fdset(fd_set *readfds, int *maxfd) {
+	struct uncompress_task *t;
+
+	for (t = tasks ; t != NULL ; t = t->next) {
+		if (t->pid <= 0 || t->exitfd < 0)
+			continue;
+		FD_SET(t->exitfd, readfds);
+		if (t->exitfd > *maxfd)
+			*maxfd = t->exitfd;
+	}
+}
+
 /* check if a program is available. This is needed because things like execlp
  * are to late (we want to know if downloading a Packages.bz2 does make sense
  * when compiled without libbz2 before actually calling the uncompressor) */
@@ -410,7 +523,7 @@ static inline retvalue builtin_uncompress(const char *compressed, const char *de
 	return RET_OK;
 }
 
-static retvalue uncompress_queue_external(enum compression compression, const char *compressed, const char *uncompressed, /*@null@*/finishaction *action, /*@null@*/void *privdata) {
+static retvalue uncompress_queue_task(enum compression compression, bool builtin, const char *compressed, const char *uncompressed, /*@null@*/finishaction *action, /*@null@*/void *privdata) {
 	struct uncompress_task *t, **t_p;
 	retvalue r;
 
@@ -429,7 +542,9 @@ static retvalue uncompress_queue_external(enum compression compression, const ch
 		uncompress_task_free(t);
 		return RET_ERROR_OOM;
 	}
+	t->exitfd = -1;
 	t->compression = compression;
+	t->builtin = builtin;
 	t->callback = action;
 	t->privdata = privdata;
 	*t_p = t;
@@ -444,7 +559,7 @@ retvalue uncompress_queue_file(const char *compressed, const char *destination,
 
 	(void)unlink(destination);
 	if (extern_uncompressors[compression] != NULL) {
-		r = uncompress_queue_external(compression, compressed,
+		r = uncompress_queue_task(compression, false, compressed,
 				destination, action, privdata);
 		if (r != RET_NOTHING) {
 			return r;
@@ -452,17 +567,14 @@ retvalue uncompress_queue_file(const char *compressed, const char *destination,
 		if (!uncompression_builtin(compression))
 			return RET_ERROR;
 	}
-	if (verbose > 1) {
-		fprintf(stderr, "Uncompress '%s' into '%s'...\n",
-				compressed, destination);
-	}
 	assert (uncompression_builtin(compression));
-	r = builtin_uncompress(compressed, destination, compression);
-	if (RET_WAS_ERROR(r)) {
-		(void)unlink(destination);
+	/* this is called while downloading, so do not stop everything
+	 * else while uncompressing but let a child do the work: */
+	r = uncompress_queue_task(compression, true, compressed,
+			destination, action, privdata);
+	if (r != RET_NOTHING)
 		return r;
-	}
-	return action(privdata, compressed, false);
+	return RET_ERROR_INTERNAL;
 }
 
 retvalue uncompress_file(const char *compressed, const char *destination, enum compression compression) {
@@ -479,7 +591,7 @@ retvalue uncompress_file(const char *compressed, const char *destination, enum c
 		}
 		r = builtin_uncompress(compressed, destination, compression);
 	} else if (extern_uncompressors[compression] != NULL) {
-		r = uncompress_queue_external(compression,
+		r = uncompress_queue_task(compression, false,
 				compressed, destination, NULL, NULL);
 		if (r == RET_NOTHING)
 			r = RET_ERROR;
@@ -1263,6 +1375,27 @@ int uncompress_read(struct compressedfile *file, void *buffer, int size) {
 	}
 }
 
+/* skip over uncompressed data without reading it, returns the number
+ * of bytes skipped, 0 if this is not possible and -1 on errors */
+off_t uncompress_skip(struct compressedfile *file, off_t request) {
+	if (file->external || file->compression != c_none)
+		return 0;
+	if (file->len >= 0 && request > file->len)
+		request = file->len;
+	if (request <= 0)
+		return 0;
+	if (lseek(file->fd, request, SEEK_CUR) == (off_t)-1) {
+		/* not seekable, let the caller read it instead */
+		if (errno == ESPIPE)
+			return 0;
+		file->error = errno;
+		return -1;
+	}
+	if (file->len >= 0)
+		file->len -= request;
+	return request;
+}
+
 static retvalue uncompress_commonclose(struct compressedfile *file, int *errno_p, const char **msg_p) {
 	retvalue result;
 	int ret;
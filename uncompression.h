@@ -1,6 +1,8 @@
 #ifndef REPREPRO_UNCOMPRESS_H
 #define REPREPRO_UNCOMPRESS_H
 
+#include <sys/select.h>
+
 /* "", ".gz", ... */
 extern const char * const uncompression_suffix[c_COUNT];
 extern /*@null@*/ char *extern_uncompressors[c_COUNT];
@@ -37,6 +39,8 @@ enum compression compression_by_suffix(const char *, size_t *);
 retvalue uncompress_checkpid(pid_t, int);
 /* still waiting for a client to exit */
 bool uncompress_running(void);
+/* add the fds that become readable when a running uncompressor exits */
+void uncompress_fdset(fd_set *, int * /*maxfd*/);
 
 typedef retvalue finishaction(void *, const char *, bool /*failed*/);
 /* uncompress and call action when finished */
@@ -53,6 +57,7 @@ struct compressedfile;
 
 retvalue uncompress_open(/*@out@*/struct compressedfile **, const char *, enum compression);
 int uncompress_read(struct compressedfile *, void *buffer, int);
+off_t uncompress_skip(struct compressedfile *, off_t);
 retvalue uncompress_error(/*@const@*/struct compressedfile *);
 void uncompress_abort(/*@only@*/struct compressedfile *);
 retvalue uncompress_close(/*@only@*/struct compressedfile *);
@@ -77,6 +77,7 @@
 #include "filterlist.h"
 #include "log.h"
 #include "donefile.h"
+#include "stanzahashes.h"
 #include "freespace.h"
 #include "configparser.h"
 #include "filecntl.h"
@@ -171,6 +172,11 @@ struct update_pattern {
 	bool getinrelease;
 	/* the form in which index files are preferably downloaded */
 	struct encoding_preferences downloadlistsas;
+	//e.g. "DownloadWorkers: 4" (not set means 1)
+	unsigned int downloadworkers;
+	//e.g. "DownloadRetries: 10" (not set means 0)
+	unsigned int downloadretries;
+	bool downloadretries_set;
 	/* if true ignore sources with Extra-Source-Only */
 	bool omitextrasource;
 	/* if the specific field is there (to destinguish from an empty one) */
@@ -234,8 +240,12 @@ struct update_target {
 	bool ignoredelete;
 	/* don't do anything because of --skipold */
 	bool nothingnew;
+	/* processed before, so only changed packages need to be looked at */
+	bool checkstanzas;
 	/* if true do not generate donefiles */
 	bool incomplete;
+	/* hashes of the stanzas in the indices, and the names changed */
+	/*@null@*/struct stanzahashes *stanzas, *changed;
 };
 
 struct update_distribution {
@@ -306,6 +316,8 @@ static void updates_freetargets(/*@only@*/struct update_target *t) {
 			free(ui->afterhookfilename);
 			free(ui);
 		}
+		stanzahashes_free(ut->stanzas);
+		stanzahashes_free(ut->changed);
 		free(ut);
 	}
 }
@@ -335,7 +347,10 @@ static inline retvalue newupdatetarget(struct update_target **ts, /*@dependent@*
 	ut->upgradelist = NULL;
 	ut->ignoredelete = false;
 	ut->nothingnew = false;
+	ut->checkstanzas = false;
 	ut->incomplete = false;
+	ut->stanzas = NULL;
+	ut->changed = NULL;
 	*ts = ut;
 	return RET_OK;
 }
@@ -520,6 +535,30 @@ CFUSETPROC(update_pattern, architectures) {
 }
 CFhashesSETPROC(update_pattern, ignorehashes);
 
+CFUSETPROC(update_pattern, downloadworkers) {
+	CFSETPROCVAR(update_pattern, this);
+	long long workers;
+	retvalue r;
+
+	r = config_getnumber(iter, "DownloadWorkers", &workers, 1, 64);
+	if (RET_IS_OK(r))
+		this->downloadworkers = workers;
+	return r;
+}
+
+CFUSETPROC(update_pattern, downloadretries) {
+	CFSETPROCVAR(update_pattern, this);
+	long long retries;
+	retvalue r;
+
+	r = config_getnumber(iter, "DownloadRetries", &retries, 0, 10000);
+	if (RET_IS_OK(r)) {
+		this->downloadretries = retries;
+		this->downloadretries_set = true;
+	}
+	return r;
+}
+
 static const struct configfield updateconfigfields[] = {
 	CFr("Name", update_pattern, name),
 	CF("From", update_pattern, from),
@@ -541,7 +580,9 @@ static const struct configfield updateconfigfields[] = {
 	CF("OmitExtraSourceOnly", update_pattern, omitextrasource),
 	CF("FilterList", update_pattern, filterlist),
 	CF("FilterSrcList", update_pattern, filtersrclist),
-	CF("DownloadListsAs", update_pattern, downloadlistsas)
+	CF("DownloadListsAs", update_pattern, downloadlistsas),
+	CF("DownloadWorkers", update_pattern, downloadworkers),
+	CF("DownloadRetries", update_pattern, downloadretries)
 };
 
 CFfinishparse(update_pattern) {
@@ -590,6 +631,22 @@ CFfinishparse(update_pattern) {
 				config_line(iter));
 			return RET_ERROR;
 		}
+		if (n->from != NULL && n->downloadworkers != 0) {
+			fprintf(stderr,
+"%s:%u to %u: Update pattern may not contain From: and DownloadWorkers: fields ad the same time.\n",
+				config_filename(iter), config_firstline(iter),
+				config_line(iter));
+			return RET_ERROR;
+		}
+		if (n->from != NULL && n->downloadretries_set) {
+			fprintf(stderr,
+"%s:%u to %u: Update pattern may not contain From: and DownloadRetries: fields ad the same time.\n",
+				config_filename(iter), config_firstline(iter),
+				config_line(iter));
+			return RET_ERROR;
+		}
+		if (n->downloadworkers == 0)
+			n->downloadworkers = 1;
 		if (n->suite_from != NULL && strcmp(n->suite_from, "*") != 0 &&
 				strncmp(n->suite_from, "*/", 2) != 0 &&
 				strchr(n->suite_from, '*') != NULL) {
@@ -790,7 +847,9 @@ static retvalue instance_pattern(struct update_pattern *pattern, const struct di
 			declaration->repository = remote_repository_prepare(
 					declaration->name, declaration->method,
 					declaration->fallback,
-					&declaration->config);
+					&declaration->config,
+					declaration->downloadworkers,
+					declaration->downloadretries);
 		if (FAILEDTOALLOC(declaration->repository)) {
 			free(update->suite_from);
 			free(update);
@@ -1778,6 +1837,81 @@ static upgrade_decision ud_decide_by_pattern(void *privdata, const struct target
 }
 
 
+static inline const char *indexfilename(const struct update_index_connector *uindex) {
+	if (uindex->afterhookfilename != NULL)
+		return uindex->afterhookfilename;
+	else
+		return remote_index_file(uindex->remote);
+}
+
+/* what the stanza hashes of a target are computed from */
+static retvalue describeindices(const struct update_target *u, /*@out@*/struct strlist *indices) {
+	const struct update_index_connector *uindex;
+	retvalue r;
+
+	strlist_init(indices);
+	for (uindex = u->indices ; uindex != NULL ; uindex = uindex->next) {
+		if (uindex->origin == NULL)
+			r = strlist_add_dup(indices, "-");
+		else
+			r = strlist_add_dup(indices,
+					remote_index_basefile(uindex->remote));
+		if (RET_WAS_ERROR(r)) {
+			strlist_done(indices);
+			return r;
+		}
+	}
+	return RET_OK;
+}
+
+/* hash all stanzas of the target's index files. If the target was
+ * processed before from the same index files, compare with what was seen
+ * then, so only packages with changed stanzas need to be looked at */
+static retvalue calcstanzas(/*@null@*/FILE *out, struct update_target *u) {
+	struct update_index_connector *uindex;
+	struct stanzahashes *old;
+	struct strlist indices;
+	unsigned int number = 0;
+	retvalue r;
+
+	r = stanzahashes_create(&u->stanzas);
+	if (RET_WAS_ERROR(r))
+		return r;
+	for (uindex = u->indices ; uindex != NULL ;
+			uindex = uindex->next, number++) {
+		if (uindex->origin == NULL)
+			continue;
+		if (uindex->failed || uindex->origin->failed)
+			r = RET_NOTHING;
+		else
+			r = stanzahashes_addindex(u->stanzas,
+					indexfilename(uindex), number);
+		if (!RET_IS_OK(r)) {
+			stanzahashes_free(u->stanzas);
+			u->stanzas = NULL;
+			return r;
+		}
+	}
+	stanzahashes_finish(u->stanzas);
+	if (!u->checkstanzas)
+		return RET_OK;
+
+	r = describeindices(u, &indices);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = stanzahashes_read(u->target->identifier, &indices, &old);
+	strlist_done(&indices);
+	if (!RET_IS_OK(r))
+		return r;
+	r = stanzahashes_diff(old, u->stanzas, &u->changed);
+	stanzahashes_free(old);
+	if (RET_IS_OK(r) && verbose > 2 && out != NULL)
+		fprintf(out,
+"  only looking at %lu packages with changed stanzas\n",
+				(unsigned long)stanzahashes_count(u->changed));
+	return r;
+}
+
 static inline retvalue searchformissing(/*@null@*/FILE *out, struct update_target *u) {
 	struct update_index_connector *uindex;
 	retvalue result, r;
@@ -1796,7 +1930,10 @@ static inline retvalue searchformissing(/*@null@*/FILE *out, struct update_targe
 	if (verbose > 2 && out != NULL)
 		fprintf(out, "  processing updates for '%s'\n",
 				u->target->identifier);
-	r = upgradelist_initialize(&u->upgradelist, u->target);
+	r = calcstanzas(out, u);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = upgradelist_initialize(&u->upgradelist, u->target, u->changed);
 	if (RET_WAS_ERROR(r))
 		return r;
 
@@ -1819,10 +1956,7 @@ static inline retvalue searchformissing(/*@null@*/FILE *out, struct update_targe
 			continue;
 		}
 
-		if (uindex->afterhookfilename != NULL)
-			filename = uindex->afterhookfilename;
-		else
-			filename = remote_index_file(uindex->remote);
+		filename = indexfilename(uindex);
 
 		if (uindex->failed || uindex->origin->failed) {
 			if (verbose >= 1)
@@ -1984,6 +2118,22 @@ static void markdone(struct update_distribution *d) {
 				markdone_cleaner(done);
 			else
 				remote_index_markdone(i->remote, done);
+		if (t->stanzas != NULL) {
+			struct strlist indices;
+
+			r = describeindices(t, &indices);
+			if (RET_IS_OK(r)) {
+				r = stanzahashes_write(t->stanzas,
+						t->target->identifier,
+						&indices);
+				strlist_done(&indices);
+			}
+			/* an old file no longer describes what the target
+			 * was updated to, so the next update would miss
+			 * changes when still using it */
+			if (!RET_IS_OK(r))
+				stanzahashes_remove(t->target->identifier);
+		}
 	}
 	markdone_finish(done);
 }
@@ -2030,6 +2180,8 @@ static retvalue markold(struct update_distribution *ud) {
 				break;
 			}
 		}
+		/* processed completely the last time */
+		ut->checkstanzas = !ut->nothingnew;
 
 	}
 	donefile_close(donefile);
@@ -2216,6 +2368,12 @@ retvalue updates_update(struct update_distribution *distributions, bool nolistsd
 		printf("Getting packages...\n");
 	r = aptmethod_download(run);
 	RET_UPDATE(result, r);
+	/* everything downloaded is there now, so check again if
+	 * what is reserved for the database and others is still free */
+	if (!RET_WAS_ERROR(result)) {
+		r = space_checkmargins(cache->devices);
+		RET_ENDUPDATE(result, r);
+	}
 	r = downloadcache_free(cache);
 	RET_ENDUPDATE(result, r);
 	if (verbose > 0)
@@ -2616,8 +2774,9 @@ static void marktargetsneeded(struct cachedlistfile *files, const struct distrib
 }
 
 retvalue updates_cleanlists(const struct distribution *distributions, const struct update_pattern *patterns) {
-	retvalue result;
+	retvalue result, r;
 	const struct distribution *d;
+	const struct target *t;
 	const struct update_pattern *p, *q;
 	struct cachedlistfile *files;
 	int i;
@@ -2637,6 +2796,9 @@ retvalue updates_cleanlists(const struct distribution *distributions, const stru
 		if (d->updates.count == 0)
 			continue;
 		cachedlistfile_need(files, "lastseen", 2, "", d->codename, NULL);
+		for (t = d->targets ; t != NULL ; t = t->next)
+			cachedlistfile_need(files, "stanzas", 2, "",
+					t->identifier, NULL);
 		for (i = 0; i < d->updates.count ; i++) {
 			const char *name = d->updates.values[i];
 
@@ -2694,5 +2856,9 @@ retvalue updates_cleanlists(const struct distribution *distributions, const stru
 	}
 	cachedlistfile_deleteunneeded(files);
 	cachedlistfile_freelist(files);
+	/* those would only be continued by a future update */
+	r = downloadcache_cleanpartial();
+	if (RET_WAS_ERROR(r))
+		return r;
 	return RET_OK;
 }
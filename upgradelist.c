@@ -15,6 +15,7 @@
  */
 #include <config.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -30,9 +31,11 @@
 #include "files.h"
 #include "upgradelist.h"
 #include "descriptions.h"
+#include "stanzahashes.h"
 
 struct package_data {
 	struct package_data *next;
+	uint32_t hash;
 	/* the name of the package: */
 	char *name;
 	/* the version in our repository:
@@ -68,11 +71,17 @@ struct package_data {
 
 struct upgradelist {
 	/*@dependent@*/struct target *target;
+	/* sorted by name: */
 	struct package_data *list;
-	/* package the next package will most probably be after.
-	 * (NULL=before start of list) */
-	/*@null@*//*@dependent@*/struct package_data *last;
-	/* internal...*/
+	/* packages not yet merged into list, in no specific order: */
+	/*@null@*/struct package_data *added;
+	/* open addressing hash table of all packages in list or added: */
+	/*@dependent@*/struct package_data **hashtable;
+	size_t hashsize, count;
+	/* if not NULL, only look at packages with those names,
+	 * the others are known to stay as they are: */
+	/*@null@*/const struct stanzahashes *onlythese;
+	size_t unchanged;
 };
 
 static void package_data_free(/*@only@*/struct package_data *data){
@@ -88,10 +97,115 @@ static void package_data_free(/*@only@*/struct package_data *data){
 	free(data);
 }
 
+static inline uint32_t name_hash(const char *name) {
+	/* FNV-1a */
+	uint32_t hash = 2166136261U;
+
+	while (*name != '\0') {
+		hash ^= (unsigned char)*(name++);
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static /*@null@*/struct package_data *upgradelist_find(const struct upgradelist *upgrade, const char *name, uint32_t hash) {
+	struct package_data *p;
+	size_t i;
+
+	if (upgrade->hashsize == 0)
+		return NULL;
+	i = hash & (upgrade->hashsize - 1);
+	while ((p = upgrade->hashtable[i]) != NULL) {
+		if (p->hash == hash && strcmp(p->name, name) == 0)
+			return p;
+		i = (i + 1) & (upgrade->hashsize - 1);
+	}
+	return NULL;
+}
+
+/* add a package not yet known to the index and to the added list */
+static retvalue upgradelist_add(struct upgradelist *upgrade, struct package_data *package) {
+	size_t i;
+
+	if (2 * (upgrade->count + 1) > upgrade->hashsize) {
+		struct package_data **n;
+		size_t newsize, j;
+
+		newsize = (upgrade->hashsize == 0) ? 1024
+			: 2 * upgrade->hashsize;
+		n = nzNEW(newsize, struct package_data *);
+		if (FAILEDTOALLOC(n))
+			return RET_ERROR_OOM;
+		for (j = 0 ; j < upgrade->hashsize ; j++) {
+			struct package_data *p = upgrade->hashtable[j];
+
+			if (p == NULL)
+				continue;
+			i = p->hash & (newsize - 1);
+			while (n[i] != NULL)
+				i = (i + 1) & (newsize - 1);
+			n[i] = p;
+		}
+		free(upgrade->hashtable);
+		upgrade->hashtable = n;
+		upgrade->hashsize = newsize;
+	}
+	i = package->hash & (upgrade->hashsize - 1);
+	while (upgrade->hashtable[i] != NULL)
+		i = (i + 1) & (upgrade->hashsize - 1);
+	upgrade->hashtable[i] = package;
+	upgrade->count++;
+	package->next = upgrade->added;
+	upgrade->added = package;
+	return RET_OK;
+}
+
+static struct package_data *mergelists(/*@null@*/struct package_data *a, /*@null@*/struct package_data *b) {
+	struct package_data *head = NULL, **tail_p = &head;
+
+	while (a != NULL && b != NULL) {
+		if (strcmp(a->name, b->name) <= 0) {
+			*tail_p = a;
+			a = a->next;
+		} else {
+			*tail_p = b;
+			b = b->next;
+		}
+		tail_p = &(*tail_p)->next;
+	}
+	*tail_p = (a != NULL) ? a : b;
+	return head;
+}
+
+/* sort the newly added packages into the list
+ * (called after each index, so the order the packages
+ * are given in does not matter) */
+static void upgradelist_merge(struct upgradelist *upgrade) {
+	/* bins[i] is a sorted list of 2^i packages or NULL */
+	struct package_data *bins[64], *p, *sorted;
+	int i;
+
+	if (upgrade->added == NULL)
+		return;
+	memset(bins, 0, sizeof(bins));
+	while (upgrade->added != NULL) {
+		p = upgrade->added;
+		upgrade->added = p->next;
+		p->next = NULL;
+		for (i = 0 ; i < 63 && bins[i] != NULL ; i++) {
+			p = mergelists(bins[i], p);
+			bins[i] = NULL;
+		}
+		bins[i] = mergelists(bins[i], p);
+	}
+	sorted = NULL;
+	for (i = 0 ; i < 64 ; i++)
+		sorted = mergelists(bins[i], sorted);
+	upgrade->list = mergelists(upgrade->list, sorted);
+}
+
 /* This is called before any package lists are read.
- * It is called once for every package we already have in this target.
- * upgrade->list points to the first in the sorted list,
- * upgrade->last to the last one inserted */
+ * It is called once for every package we already have in this target. */
 static retvalue save_package_version(struct upgradelist *upgrade, const char *packagename, const char *chunk) {
 	char *version;
 	retvalue r;
@@ -117,29 +231,15 @@ static retvalue save_package_version(struct upgradelist *upgrade, const char *pa
 	package->version_in_use = version;
 	version = NULL; // just to be sure...
 	package->version = package->version_in_use;
+	package->hash = name_hash(package->name);
 
-	if (upgrade->list == NULL) {
-		/* first chunk to add: */
-		upgrade->list = package;
-		upgrade->last = package;
-	} else {
-		if (strcmp(packagename, upgrade->last->name) > 0) {
-			upgrade->last->next = package;
-			upgrade->last = package;
-		} else {
-			/* this should only happen if the underlying
-			 * database-method get changed, so just throwing
-			 * out here */
-			fprintf(stderr, "Package database is not sorted!!!\n");
-			assert(false);
-			exit(EXIT_FAILURE);
-		}
-	}
-
-	return RET_OK;
+	r = upgradelist_add(upgrade, package);
+	if (RET_WAS_ERROR(r))
+		package_data_free(package);
+	return r;
 }
 
-retvalue upgradelist_initialize(struct upgradelist **ul, struct target *t) {
+retvalue upgradelist_initialize(struct upgradelist **ul, struct target *t, const struct stanzahashes *onlythese) {
 	struct upgradelist *upgrade;
 	retvalue r, r2;
 	const char *packagename;
@@ -151,6 +251,7 @@ retvalue upgradelist_initialize(struct upgradelist **ul, struct target *t) {
 		return RET_ERROR_OOM;
 
 	upgrade->target = t;
+	upgrade->onlythese = onlythese;
 
 	/* Beginn with the packages currently in the archive */
 
@@ -160,6 +261,11 @@ retvalue upgradelist_initialize(struct upgradelist **ul, struct target *t) {
 		return r;
 	}
 	while (target_nextpackage(&iterator, &packagename, &packagedata)) {
+		if (onlythese != NULL &&
+				!stanzahashes_contains(onlythese, packagename)) {
+			upgrade->unchanged++;
+			continue;
+		}
 		r2 = save_package_version(upgrade, packagename, packagedata.chunk);
 		RET_UPDATE(r, r2);
 		if (RET_WAS_ERROR(r2))
@@ -167,14 +273,13 @@ retvalue upgradelist_initialize(struct upgradelist **ul, struct target *t) {
 	}
 	r2 = target_closeiterator(&iterator);
 	RET_UPDATE(r, r2);
+	upgradelist_merge(upgrade);
 
 	if (RET_WAS_ERROR(r)) {
 		upgradelist_free(upgrade);
 		return r;
 	}
 
-	upgrade->last = NULL;
-
 	*ul = upgrade;
 	return RET_OK;
 }
@@ -185,6 +290,7 @@ void upgradelist_free(struct upgradelist *upgrade) {
 	if (upgrade == NULL)
 		return;
 
+	upgrade->list = mergelists(upgrade->list, upgrade->added);
 	l = upgrade->list;
 	while (l != NULL) {
 		struct package_data *n = l->next;
@@ -192,6 +298,7 @@ void upgradelist_free(struct upgradelist *upgrade) {
 		l = n;
 	}
 
+	free(upgrade->hashtable);
 	free(upgrade);
 	return;
 }
@@ -199,7 +306,8 @@ void upgradelist_free(struct upgradelist *upgrade) {
 static retvalue upgradelist_trypackage(struct upgradelist *upgrade, void *privdata, upgrade_decide_function *predecide, void *predecide_data, const char *packagename_const, /*@null@*//*@only@*/char *packagename, const char *sourcename, /*@only@*/char *version, const char *sourceversion, architecture_t architecture, const char *chunk) {
 	retvalue r;
 	upgrade_decision decision;
-	struct package_data *current, *insertafter;
+	struct package_data *current;
+	uint32_t hash;
 
 	if (architecture == architecture_all) {
 		if (upgrade->target->packagetype == pt_dsc) {
@@ -210,72 +318,9 @@ static retvalue upgradelist_trypackage(struct upgradelist *upgrade, void *privda
 		}
 	}
 
-	/* insertafter = NULL will mean insert before list */
-	insertafter = upgrade->last;
-	/* the next one to test, current = NULL will mean not found */
-	if (insertafter != NULL)
-		current = insertafter->next;
-	else
-		current = upgrade->list;
-
-	/* the algorithm assumes almost all packages are feed in
-	 * alphabetically. So the next package will likely be quite
-	 * after the last one. Otherwise we walk down the long list
-	 * again and again... and again... and even some more...*/
-
-	while (true) {
-		int cmp;
-
-		assert (insertafter == NULL || insertafter->next == current);
-		assert (insertafter != NULL || current == upgrade->list);
+	hash = name_hash(packagename_const);
+	current = upgradelist_find(upgrade, packagename_const, hash);
 
-		if (current == NULL)
-			cmp = -1; /* every package is before the end of list */
-		else
-			cmp = strcmp(packagename_const, current->name);
-
-		if (cmp == 0)
-			break;
-
-		if (cmp < 0) {
-			int precmp;
-
-			if (insertafter == NULL) {
-				/* if we are before the first
-				 * package, add us there...*/
-				current = NULL;
-				break;
-			}
-			// I only hope noone creates indices anti-sorted:
-			precmp = strcmp(packagename_const, insertafter->name);
-			if (precmp == 0) {
-				current = insertafter;
-				break;
-			} else if (precmp < 0) {
-				/* restart at the beginning: */
-				current = upgrade->list;
-				insertafter = NULL;
-				if (verbose > 10) {
-					fprintf(stderr, "restarting search...");
-				}
-				continue;
-			} else { // precmp > 0
-				/* insert after insertafter: */
-				current = NULL;
-				break;
-			}
-			assert ("This is not reached" == NULL);
-		}
-		/* cmp > 0 : may come later... */
-		assert (current != NULL);
-		insertafter = current;
-		current = current->next;
-		if (current == NULL) {
-			/* add behind insertafter at end of list */
-			break;
-		}
-		/* otherwise repeat until place found */
-	}
 	if (current == NULL) {
 		/* adding a package not yet known */
 		struct package_data *new;
@@ -286,7 +331,6 @@ static retvalue upgradelist_trypackage(struct upgradelist *upgrade, void *privda
 				NULL, version, sourceversion,
 				chunk);
 		if (decision != UD_UPGRADE) {
-			upgrade->last = insertafter;
 			if (decision == UD_LOUDNO)
 				fprintf(stderr,
 "Loudly rejecting '%s' '%s' to enter '%s'!\n",
@@ -340,14 +384,12 @@ static retvalue upgradelist_trypackage(struct upgradelist *upgrade, void *privda
 			free(new->new_control);
 			new->new_control = newcontrol;
 		}
-		if (insertafter != NULL) {
-			new->next = insertafter->next;
-			insertafter->next = new;
-		} else {
-			new->next = upgrade->list;
-			upgrade->list = new;
+		new->hash = hash;
+		r = upgradelist_add(upgrade, new);
+		if (RET_WAS_ERROR(r)) {
+			package_data_free(new);
+			return r;
 		}
-		upgrade->last = new;
 	} else {
 		/* The package already exists: */
 		char *control, *newcontrol;
@@ -355,8 +397,6 @@ static retvalue upgradelist_trypackage(struct upgradelist *upgrade, void *privda
 		struct checksumsarray origfiles;
 		int versioncmp;
 
-		upgrade->last = current;
-
 		r = dpkgversions_cmp(version, current->version, &versioncmp);
 		if (RET_WAS_ERROR(r)) {
 			free(packagename);
@@ -505,10 +545,16 @@ retvalue upgradelist_update(struct upgradelist *upgrade, void *privdata, const c
 		return r;
 
 	result = RET_NOTHING;
-	upgrade->last = NULL;
 	while (indexfile_getnext(i, &packagename, &version, &control,
 				&package_architecture,
 				upgrade->target, ignorewrongarchitecture)) {
+		if (upgrade->onlythese != NULL &&
+				!stanzahashes_contains(upgrade->onlythese,
+					packagename)) {
+			free(packagename);
+			free(version);
+			continue;
+		}
 		r = upgrade->target->getsourceandversion(control, packagename,
 				&sourcename, &sourceversion);
 		if (RET_IS_OK(r)) {
@@ -534,6 +580,7 @@ retvalue upgradelist_update(struct upgradelist *upgrade, void *privdata, const c
 	}
 	r = indexfile_close(i);
 	RET_ENDUPDATE(result, r);
+	upgradelist_merge(upgrade);
 	return result;
 }
 
@@ -543,7 +590,6 @@ retvalue upgradelist_pull(struct upgradelist *upgrade, struct target *source, up
 	struct packagedata packagedata;
 	struct target_cursor iterator;
 
-	upgrade->last = NULL;
 	r = target_openiterator(source, READONLY, &iterator);
 	if (RET_WAS_ERROR(r))
 		return r;
@@ -613,6 +659,7 @@ retvalue upgradelist_pull(struct upgradelist *upgrade, struct target *source, up
 	}
 	r = target_closeiterator(&iterator);
 	RET_ENDUPDATE(result, r);
+	upgradelist_merge(upgrade);
 	return result;
 }
 
@@ -676,7 +723,7 @@ retvalue upgradelist_predelete(struct upgradelist *upgrade, struct logger *logge
 
 bool upgradelist_isbigdelete(const struct upgradelist *upgrade) {
 	struct package_data *pkg;
-	long long deleted = 0, all = 0;
+	long long deleted = 0, all = upgrade->unchanged;
 
 	if (upgrade->list == NULL)
 		return false;
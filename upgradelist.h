@@ -12,8 +12,11 @@ typedef upgrade_decision upgrade_decide_function(void *privdata, const struct ta
 struct target;
 struct logger;
 struct upgradelist;
+struct stanzahashes;
 
-retvalue upgradelist_initialize(struct upgradelist **, /*@dependent@*/struct target *);
+/* if the last argument is not NULL, only packages with those names are
+ * looked at (the caller knows nothing changed for the others) */
+retvalue upgradelist_initialize(struct upgradelist **, /*@dependent@*/struct target *, /*@null@*//*@dependent@*/const struct stanzahashes *);
 void upgradelist_free(/*@only@*/struct upgradelist *);
 
 typedef void dumpaction(const char */*packagename*/, /*@null@*/const char */*oldversion*/, /*@null@*/const char */*newversion*/, /*@null@*/const char */*bestcandidate*/, /*@null@*/const struct strlist */*newfilekeys*/, /*@null@*/const char */*newcontrol*/, void *);
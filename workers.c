@@ -0,0 +1,374 @@
+/*  This file is part of "reprepro"
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "workers.h"
+
+/* The children get a job per line on their stdin pipe and reply
+ * with a struct workerreply followed by the reply data. */
+
+struct workerreply {
+	int result;
+	size_t size;
+};
+
+struct worker {
+	pid_t pid;
+	int tochild, fromchild;
+	/* the job currently worked on, NULL if idle */
+	/*@null@*/char *job;
+};
+
+struct workers {
+	workers_dofunction *dofunction;
+	workers_donefunction *donefunction;
+	void *privdata;
+	/* started workers, how many may be started, busy ones */
+	int count, max, running;
+	/*@null@*/struct worker *workers;
+	retvalue result;
+};
+
+static bool writeall(int fd, const void *data, size_t len) {
+	const char *p = data;
+	ssize_t w;
+
+	while (len > 0) {
+		w = write(fd, p, len);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return false;
+		p += w;
+		len -= w;
+	}
+	return true;
+}
+
+static bool readall(int fd, void *data, size_t len) {
+	char *p = data;
+	ssize_t r;
+
+	while (len > 0) {
+		r = read(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+		p += r;
+		len -= r;
+	}
+	return true;
+}
+
+static void worker_main(struct workers *workers, int in, int out) NORETURN;
+static void worker_main(struct workers *workers, int in, int out) {
+	struct workerreply reply;
+	char *line = NULL, *data;
+	size_t linesize = 0;
+	ssize_t len;
+	FILE *f;
+	retvalue r;
+
+	f = fdopen(in, "r");
+	if (f == NULL)
+		_exit(EXIT_FAILURE);
+	while ((len = getline(&line, &linesize, f)) > 0) {
+		if (line[len - 1] != '\n')
+			break;
+		line[len - 1] = '\0';
+		data = NULL;
+		reply.size = 0;
+		r = workers->dofunction(workers->privdata, line,
+				&data, &reply.size);
+		if (!RET_IS_OK(r))
+			reply.size = 0;
+		reply.result = r;
+		if (!writeall(out, &reply, sizeof(reply)) ||
+				!writeall(out, data, reply.size))
+			_exit(EXIT_FAILURE);
+		free(data);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+retvalue workers_start(struct workers **workers_p, long count, workers_dofunction *dofunction, workers_donefunction *donefunction, void *privdata) {
+	struct workers *workers;
+
+	workers = zNEW(struct workers);
+	if (FAILEDTOALLOC(workers))
+		return RET_ERROR_OOM;
+	workers->dofunction = dofunction;
+	workers->donefunction = donefunction;
+	workers->privdata = privdata;
+	workers->result = RET_NOTHING;
+	if (count > 1) {
+		workers->workers = nzNEW(count, struct worker);
+		if (FAILEDTOALLOC(workers->workers)) {
+			free(workers);
+			return RET_ERROR_OOM;
+		}
+		workers->max = count;
+	}
+	*workers_p = workers;
+	return RET_OK;
+}
+
+static retvalue worker_start(struct workers *workers) {
+	struct worker *w = &workers->workers[workers->count];
+	int tochild[2], fromchild[2], e, i;
+
+	if (pipe(tochild) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d creating pipe: %s\n",
+				e, strerror(e));
+		return RET_ERRNO(e);
+	}
+	if (pipe(fromchild) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d creating pipe: %s\n",
+				e, strerror(e));
+		(void)close(tochild[0]); (void)close(tochild[1]);
+		return RET_ERRNO(e);
+	}
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+	w->pid = fork();
+	if (w->pid < 0) {
+		e = errno;
+		fprintf(stderr, "Error %d forking: %s\n", e, strerror(e));
+		(void)close(tochild[0]); (void)close(tochild[1]);
+		(void)close(fromchild[0]); (void)close(fromchild[1]);
+		return RET_ERRNO(e);
+	}
+	if (w->pid == 0) {
+		/* child: must not see the other workers' pipes,
+		 * or they would never get an end of file */
+		for (i = 0 ; i < workers->count ; i++) {
+			if (workers->workers[i].tochild >= 0)
+				(void)close(workers->workers[i].tochild);
+			(void)close(workers->workers[i].fromchild);
+		}
+		(void)close(tochild[1]);
+		(void)close(fromchild[0]);
+		worker_main(workers, tochild[0], fromchild[1]);
+	}
+	(void)close(tochild[0]);
+	(void)close(fromchild[1]);
+	w->tochild = tochild[1];
+	w->fromchild = fromchild[0];
+	w->job = NULL;
+	workers->count++;
+	return RET_OK;
+}
+
+/* do not give it any more work */
+static void worker_died(struct worker *w) {
+	fprintf(stderr,
+"Error: worker process died unexpectedly while doing '%s'!\n", w->job);
+	(void)close(w->tochild);
+	w->tochild = -1;
+}
+
+static retvalue worker_receive(struct workers *workers, struct worker *w) {
+	struct workerreply reply;
+	char *data = NULL;
+	retvalue r;
+
+	assert (w->job != NULL);
+	workers->running--;
+	if (!readall(w->fromchild, &reply, sizeof(reply))) {
+		worker_died(w);
+		r = RET_ERROR;
+	} else if (reply.size > 0) {
+		data = malloc(reply.size);
+		if (FAILEDTOALLOC(data))
+			r = RET_ERROR_OOM;
+		else if (!readall(w->fromchild, data, reply.size)) {
+			worker_died(w);
+			r = RET_ERROR;
+		} else
+			r = reply.result;
+	} else
+		r = reply.result;
+	r = workers->donefunction(workers->privdata, w->job, r,
+			data, reply.size);
+	free(data);
+	free(w->job);
+	w->job = NULL;
+	return r;
+}
+
+/* wait until at least one worker has finished its job */
+static retvalue waitforworkers(struct workers *workers) {
+	fd_set readfds;
+	int i, maxfd = -1, n;
+	retvalue result = RET_NOTHING, r;
+
+	FD_ZERO(&readfds);
+	for (i = 0 ; i < workers->count ; i++) {
+		if (workers->workers[i].job == NULL)
+			continue;
+		FD_SET(workers->workers[i].fromchild, &readfds);
+		if (workers->workers[i].fromchild > maxfd)
+			maxfd = workers->workers[i].fromchild;
+	}
+	assert (maxfd >= 0);
+	n = select(maxfd + 1, &readfds, NULL, NULL, NULL);
+	if (n < 0) {
+		int e = errno;
+
+		if (e == EINTR)
+			return RET_NOTHING;
+		fprintf(stderr, "Error %d waiting for worker processes: %s\n",
+				e, strerror(e));
+		/* give up on all of them */
+		for (i = 0 ; i < workers->count ; i++) {
+			struct worker *w = &workers->workers[i];
+
+			if (w->tochild >= 0)
+				(void)close(w->tochild);
+			w->tochild = -1;
+			free(w->job);
+			w->job = NULL;
+		}
+		workers->running = 0;
+		return RET_ERRNO(e);
+	}
+	for (i = 0 ; i < workers->count ; i++) {
+		struct worker *w = &workers->workers[i];
+
+		if (w->job == NULL || !FD_ISSET(w->fromchild, &readfds))
+			continue;
+		r = worker_receive(workers, w);
+		RET_UPDATE(result, r);
+	}
+	return result;
+}
+
+static retvalue dodirectly(struct workers *workers, const char *job) {
+	char *data = NULL;
+	size_t size = 0;
+	retvalue r;
+
+	r = workers->dofunction(workers->privdata, job, &data, &size);
+	if (!RET_IS_OK(r))
+		size = 0;
+	r = workers->donefunction(workers->privdata, job, r, data, size);
+	free(data);
+	return r;
+}
+
+retvalue workers_add(struct workers *workers, const char *job) {
+	struct worker *w = NULL;
+	retvalue r;
+	bool ok;
+	int i;
+
+	assert (strchr(job, '\n') == NULL);
+	if (workers->workers == NULL) {
+		r = dodirectly(workers, job);
+		RET_UPDATE(workers->result, r);
+		return r;
+	}
+	while (w == NULL) {
+		for (i = 0 ; i < workers->count ; i++) {
+			if (workers->workers[i].job == NULL &&
+					workers->workers[i].tochild >= 0) {
+				w = &workers->workers[i];
+				break;
+			}
+		}
+		if (w != NULL)
+			break;
+		if (workers->count < workers->max) {
+			r = worker_start(workers);
+			if (RET_IS_OK(r))
+				continue;
+			/* make do with the ones already running */
+			workers->max = workers->count;
+			if (workers->running == 0) {
+				RET_UPDATE(workers->result, r);
+				return r;
+			}
+		}
+		if (workers->running == 0) {
+			/* all workers died */
+			workers->result = RET_ERROR;
+			return RET_ERROR;
+		}
+		r = waitforworkers(workers);
+		RET_UPDATE(workers->result, r);
+		if (interrupted())
+			return RET_ERROR_INTERRUPTED;
+	}
+	w->job = strdup(job);
+	if (FAILEDTOALLOC(w->job))
+		return RET_ERROR_OOM;
+	ok = writeall(w->tochild, job, strlen(job)) &&
+		writeall(w->tochild, "\n", 1);
+	if (!ok) {
+		worker_died(w);
+		free(w->job);
+		w->job = NULL;
+		workers->result = RET_ERROR;
+		return RET_ERROR;
+	}
+	workers->running++;
+	return RET_OK;
+}
+
+retvalue workers_finish(struct workers *workers) {
+	retvalue result, r;
+	int i, status;
+
+	while (workers->running > 0) {
+		r = waitforworkers(workers);
+		RET_UPDATE(workers->result, r);
+	}
+	result = workers->result;
+	for (i = 0 ; i < workers->count ; i++) {
+		struct worker *w = &workers->workers[i];
+
+		if (w->tochild >= 0)
+			(void)close(w->tochild);
+		(void)close(w->fromchild);
+		free(w->job);
+		while (waitpid(w->pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				int e = errno;
+				fprintf(stderr,
+"Error %d waiting for worker process: %s\n",
+						e, strerror(e));
+				RET_UPDATE(result, RET_ERRNO(e));
+				break;
+			}
+		}
+	}
+	free(workers->workers);
+	free(workers);
+	return result;
+}
@@ -0,0 +1,27 @@
+#ifndef REPREPRO_WORKERS_H
+#define REPREPRO_WORKERS_H
+
+#ifndef REPREPRO_ERROR_H
+#include "error.h"
+#endif
+
+/* A pool of forked processes to do work not needing the database
+ * (the children must not use any libdb handles) in parallel.
+ * A job is a line of text, the reply some data the parent gets
+ * together with the job in the done function. */
+struct workers;
+
+/* called in the child */
+typedef retvalue workers_dofunction(void * /*privdata*/, const char * /*job*/, /*@out@*/char ** /*reply*/, /*@out@*/size_t *);
+/* called in the parent, in the order the jobs are finished */
+typedef retvalue workers_donefunction(void * /*privdata*/, const char * /*job*/, retvalue, const char * /*reply*/, size_t);
+
+/* with count <= 1 all jobs are done directly by workers_add */
+retvalue workers_start(/*@out@*/struct workers **, long /*count*/, workers_dofunction *, workers_donefunction *, void * /*privdata*/);
+/* hand out the job, if all workers are busy wait for one to finish.
+ * Errors of other jobs are only returned by workers_finish */
+retvalue workers_add(struct workers *, const char * /*job*/);
+/* wait for all jobs to be done and stop the workers */
+retvalue workers_finish(/*@only@*/struct workers *);
+
+#endif